@@ -23,7 +23,8 @@ LOCAL_MODULE := fingerprint.$(TARGET_DEVICE)
 LOCAL_MODULE_RELATIVE_PATH := hw
 LOCAL_SRC_FILES := fingerprint.c \
 		   QSEEComFunc.c \
-		   common.c
+		   common.c \
+		   fpc_trace.c
 
 ifeq ($(filter-out satsuki sumire suzuran,$(TARGET_DEVICE)),)
 LOCAL_SRC_FILES += fpc_imp_kitakami.c
@@ -36,6 +37,7 @@ endif
 
 LOCAL_CFLAGS += -std=c99
 LOCAL_SHARED_LIBRARIES := liblog \
+			  libcutils \
 			  libdl \
 			  libutils
 
@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
 
 #define LOG_TAG "QSEE_WRAPPER"
 //#define LOG_NDEBUG 0
@@ -45,6 +46,95 @@ typedef struct {
     void *libHandle;
 } _priv_data_t;
 
+/*
+ * One ION client (/dev/ion descriptor) for the whole process, opened
+ * by the first qsee_open_handle() and closed by the last
+ * qsee_free_handle(): every allocation and free goes through it,
+ * instead of opening the device every time.
+ * Every buffer is tracked until freed, so that the ones still
+ * around when the client gets closed can be reported and reclaimed.
+ */
+struct _ion_buf_t {
+    unsigned char *v_addr;
+    uint32_t len;
+    int32_t map_fd;
+    struct ion_handle_data handle;
+    struct _ion_buf_t *next;
+};
+
+typedef struct {
+    int32_t fd;
+    uint32_t users;
+    struct _ion_buf_t *bufs;
+    struct qsee_ion_stats stats;
+} _ion_client_t;
+
+static _ion_client_t ion_client = { .fd = -1 };
+static pthread_mutex_t ion_client_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int32_t ion_client_get(void)
+{
+    int32_t ret = 0;
+
+    pthread_mutex_lock(&ion_client_lock);
+    if (ion_client.users == 0) {
+        /* O_DSYNC -> uncached memory */
+        ion_client.fd = open("/dev/ion", O_RDONLY | O_DSYNC | O_CLOEXEC);
+        if (ion_client.fd < 0) {
+            ALOGE("Error::Cannot open ION device: %s\n", strerror(errno));
+            ret = -1;
+            goto exit;
+        }
+        memset(&ion_client.stats, 0, sizeof(ion_client.stats));
+    }
+    ion_client.users++;
+exit:
+    pthread_mutex_unlock(&ion_client_lock);
+    return ret;
+}
+
+static void ion_client_put(void)
+{
+    struct _ion_buf_t *buf;
+    struct qsee_ion_stats *stats = &ion_client.stats;
+
+    pthread_mutex_lock(&ion_client_lock);
+    if (ion_client.users == 0 || --ion_client.users > 0) {
+        pthread_mutex_unlock(&ion_client_lock);
+        return;
+    }
+
+    ALOGD("ION: %u allocs, %u frees, %u failures, peak %u bytes\n",
+          stats->allocs, stats->frees, stats->failures, stats->peak_bytes);
+
+    while ((buf = ion_client.bufs) != NULL) {
+        ALOGE("ION: leaked buffer %p (%u bytes), reclaiming\n",
+              buf->v_addr, buf->len);
+        munmap(buf->v_addr, buf->len);
+        close(buf->map_fd);
+        ioctl(ion_client.fd, ION_IOC_FREE, &buf->handle);
+        ion_client.bufs = buf->next;
+        free(buf);
+    }
+    stats->live_buffers = 0;
+    stats->live_bytes = 0;
+
+    close(ion_client.fd);
+    ion_client.fd = -1;
+    pthread_mutex_unlock(&ion_client_lock);
+}
+
+int qsee_ion_get_stats(struct qsee_ion_stats *stats)
+{
+    if (stats == NULL)
+        return -1;
+
+    pthread_mutex_lock(&ion_client_lock);
+    *stats = ion_client.stats;
+    pthread_mutex_unlock(&ion_client_lock);
+    return 0;
+}
+
 
 
 int32_t qsee_open_handle(struct qsee_handle_t** ret_handle)
@@ -77,6 +167,9 @@ int32_t qsee_open_handle(struct qsee_handle_t** ret_handle)
 
     handle->_data = data;
 
+    if (ion_client_get() < 0)
+        goto exit_err_handle_only;
+
     ALOGD("Loaded QSEECom API library...\n");
     // Setup internal functions
     handle->ion_alloc = qcom_km_ion_memalloc;
@@ -175,6 +268,8 @@ int32_t qsee_open_handle(struct qsee_handle_t** ret_handle)
     return 0;
 
 exit_err_handle:
+    ion_client_put();
+exit_err_handle_only:
     if(handle != NULL) {
         free(handle);
     }
@@ -197,6 +292,7 @@ int qsee_free_handle(struct qsee_handle_t** handle_ptr)
     handle = *handle_ptr;
     data = (_priv_data_t*)handle->_data;
 
+    ion_client_put();
     dlclose(data->libHandle);
     free(data);
     free(handle);
@@ -210,27 +306,34 @@ int32_t qcom_km_ion_memalloc(struct qcom_km_ion_info_t *handle,
 {
     int32_t ret = 0;
     int32_t iret = 0;
-    int32_t fd = 0;
     unsigned char *v_addr;
     struct ion_allocation_data ion_alloc_data;
     int32_t ion_fd;
     int32_t rc;
     struct ion_fd_data ifd_data;
     struct ion_handle_data handle_data;
-    /* open ION device for memory management
-     * O_DSYNC -> uncached memory
-    */
+    struct _ion_buf_t *buf;
+
     if(handle == NULL) {
         ALOGE("Error:: null handle received");
         return -1;
     }
-    ion_fd  = open("/dev/ion", O_RDONLY | O_DSYNC);
-    if (ion_fd < 0) {
-        ALOGE("Error::Cannot open ION device");
-        return -1;
-    }
     handle->ion_sbuffer = NULL;
     handle->ifd_data_fd = 0;
+
+    buf = (struct _ion_buf_t*)malloc(sizeof(struct _ion_buf_t));
+    if (buf == NULL) {
+        ALOGE("Error allocating memory: %s\n", strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&ion_client_lock);
+    ion_fd = ion_client.fd;
+    if (ion_fd < 0) {
+        ALOGE("Error::ION client is not open");
+        ret = -1;
+        goto alloc_fail;
+    }
     /* Size of allocation */
     ion_alloc_data.len = (size + 4095) & (~4095);
     /* 4K aligned */
@@ -268,24 +371,33 @@ int32_t qcom_km_ion_memalloc(struct qcom_km_ion_info_t *handle,
     handle->ion_sbuffer = v_addr;
     handle->ion_alloc_handle.handle = ion_alloc_data.handle;
     handle->sbuf_len = size;
+
+    buf->v_addr = v_addr;
+    buf->len = ion_alloc_data.len;
+    buf->map_fd = ifd_data.fd;
+    buf->handle.handle = ion_alloc_data.handle;
+    buf->next = ion_client.bufs;
+    ion_client.bufs = buf;
+
+    ion_client.stats.allocs++;
+    ion_client.stats.live_buffers++;
+    ion_client.stats.live_bytes += buf->len;
+    if (ion_client.stats.live_bytes > ion_client.stats.peak_bytes)
+        ion_client.stats.peak_bytes = ion_client.stats.live_bytes;
+    pthread_mutex_unlock(&ion_client_lock);
     return ret;
 map_fail:
-    if (handle->ion_sbuffer != NULL) {
-        iret = munmap(handle->ion_sbuffer, ion_alloc_data.len);
-        if (iret)
-            ALOGE("Error::Failed to unmap memory for load image. ret = %d", ret);
-    }
+    close(ifd_data.fd);
 ioctl_fail:
     handle_data.handle = ion_alloc_data.handle;
-    if (handle->ifd_data_fd)
-        close(handle->ifd_data_fd);
     iret = ioctl(ion_fd, ION_IOC_FREE, &handle_data);
     if (iret) {
         ALOGE("Error::ION FREE ioctl returned error = %d",iret);
     }
 alloc_fail:
-    if (ion_fd > 0)
-        close(ion_fd);
+    ion_client.stats.failures++;
+    pthread_mutex_unlock(&ion_client_lock);
+    free(buf);
     return ret;
 }
 
@@ -293,19 +405,42 @@ alloc_fail:
 int32_t qcom_km_ion_dealloc(struct qcom_km_ion_info_t *handle)
 {
     struct ion_handle_data handle_data;
+    struct _ion_buf_t **pbuf, *buf = NULL;
     int32_t ret = 0;
+
+    pthread_mutex_lock(&ion_client_lock);
+    for (pbuf = &ion_client.bufs; *pbuf != NULL; pbuf = &(*pbuf)->next) {
+        if ((*pbuf)->v_addr == handle->ion_sbuffer) {
+            buf = *pbuf;
+            *pbuf = buf->next;
+            break;
+        }
+    }
+    if (buf == NULL) {
+        /* Never allocated, already freed or reclaimed */
+        ALOGE("Error::Freeing unknown ION buffer %p", handle->ion_sbuffer);
+        pthread_mutex_unlock(&ion_client_lock);
+        return -1;
+    }
+
     /* Deallocate the memory for the listener */
-    ret = munmap(handle->ion_sbuffer, (handle->sbuf_len + 4095) & (~4095));
+    ret = munmap(buf->v_addr, buf->len);
     if (ret) {
         ALOGE("Error::Unmapping ION Buffer failed with ret = %d", ret);
     }
-    handle_data.handle = handle->ion_alloc_handle.handle;
-    close(handle->ifd_data_fd);
-    ret = ioctl(handle->ion_fd, ION_IOC_FREE, &handle_data);
+    handle_data.handle = buf->handle.handle;
+    close(buf->map_fd);
+    ret = ioctl(ion_client.fd, ION_IOC_FREE, &handle_data);
     if (ret) {
         ALOGE("Error::ION Memory FREE ioctl failed with ret = %d", ret);
     }
-    close(handle->ion_fd);
+
+    ion_client.stats.frees++;
+    ion_client.stats.live_buffers--;
+    ion_client.stats.live_bytes -= buf->len;
+    pthread_mutex_unlock(&ion_client_lock);
+
+    free(buf);
     return ret;
 }
 
@@ -73,8 +73,18 @@ typedef struct qsee_handle_t {
     load_trustlet_def load_trustlet;
 } qsee_handle_t;
 
+// ION usage since the first qsee_open_handle()
+struct qsee_ion_stats {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+    uint32_t live_buffers;
+    uint32_t live_bytes;
+    uint32_t peak_bytes;
+};
+
 struct qcom_km_ion_info_t {
-    int32_t ion_fd;
+    int32_t ion_fd;     // Shared ION client, owned by QSEEComFunc
     int32_t ifd_data_fd;
     struct ion_handle_data ion_alloc_handle;
     unsigned char * ion_sbuffer;
@@ -84,5 +94,6 @@ struct qcom_km_ion_info_t {
 int qsee_open_handle(struct qsee_handle_t **handle);
 int qsee_free_handle(struct qsee_handle_t** handle);
 char* qsee_error_strings(int err);
+int qsee_ion_get_stats(struct qsee_ion_stats *stats);
 
 #endif
@@ -1,11 +1,14 @@
 #include "common.h"
+#include "fpc_trace.h"
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #define LOG_TAG "FPC COMMON"
+#define IRQ_POLL_TIMEOUT_MS 1000
 
 #include <cutils/log.h>
 
@@ -35,44 +38,129 @@ err_t sysfs_write(char *path, char *s)
     return ret;
 }
 
-err_t sys_fs_irq_poll(char *path)
+/*
+ * The sensor IRQ node stays open for the lifetime of the HAL and is
+ * watched through epoll along with an eventfd, so a cancel request wakes
+ * up a waiting capture right away instead of after the poll timeout.
+ */
+static struct {
+    int irq_fd;
+    int cancel_fd;
+    int epoll_fd;
+} irq_watcher = { -1, -1, -1 };
+
+err_t sys_fs_irq_open(char *path)
 {
-
     char buf[80];
-    int ret = 0;
-    int result;
-    struct pollfd pollfds[2];
+    struct epoll_event ev;
 
-    pollfds[0].fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (irq_watcher.irq_fd >= 0)
+        return 0;
 
-    if (pollfds[0].fd < 0) {
+    irq_watcher.irq_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (irq_watcher.irq_fd < 0) {
         strerror_r(errno, buf, sizeof(buf));
         ALOGE("Error opening %s: %s\n", path, buf);
-        return -1 ;
+        goto err;
     }
 
+    irq_watcher.cancel_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    irq_watcher.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (irq_watcher.cancel_fd < 0 || irq_watcher.epoll_fd < 0) {
+        strerror_r(errno, buf, sizeof(buf));
+        ALOGE("Error creating IRQ watcher: %s\n", buf);
+        goto err;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLPRI | EPOLLERR;
+    ev.data.fd = irq_watcher.irq_fd;
+    if (epoll_ctl(irq_watcher.epoll_fd, EPOLL_CTL_ADD, irq_watcher.irq_fd, &ev) < 0)
+        goto err_ctl;
+
+    ev.events = EPOLLIN;
+    ev.data.fd = irq_watcher.cancel_fd;
+    if (epoll_ctl(irq_watcher.epoll_fd, EPOLL_CTL_ADD, irq_watcher.cancel_fd, &ev) < 0)
+        goto err_ctl;
+
+    return 0;
+
+err_ctl:
+    strerror_r(errno, buf, sizeof(buf));
+    ALOGE("Error watching %s: %s\n", path, buf);
+err:
+    sys_fs_irq_close();
+    return -1;
+}
+
+void sys_fs_irq_close()
+{
+    if (irq_watcher.epoll_fd >= 0)
+        close(irq_watcher.epoll_fd);
+    if (irq_watcher.cancel_fd >= 0)
+        close(irq_watcher.cancel_fd);
+    if (irq_watcher.irq_fd >= 0)
+        close(irq_watcher.irq_fd);
+
+    irq_watcher.irq_fd = irq_watcher.cancel_fd = irq_watcher.epoll_fd = -1;
+}
+
+// Make any current and future sys_fs_irq_poll() return until reset
+void sys_fs_irq_cancel()
+{
+    uint64_t one = 1;
+
+    if (irq_watcher.cancel_fd >= 0)
+        write(irq_watcher.cancel_fd, &one, sizeof(one));
+}
+
+// Drop a pending cancel, called before starting a new operation
+void sys_fs_irq_reset()
+{
+    uint64_t val;
+
+    if (irq_watcher.cancel_fd >= 0)
+        read(irq_watcher.cancel_fd, &val, sizeof(val));
+}
+
+// Returns 0 on IRQ, -1 on timeout, cancel or error
+err_t sys_fs_irq_poll()
+{
+    struct epoll_event evs[2];
     char dummybuf;
-    read(pollfds[0].fd, &dummybuf, 1);
-    pollfds[0].events = POLLPRI;
+    int result, i;
+    uint64_t t;
 
-    result = poll(pollfds, 1, 1000);
+    if (irq_watcher.irq_fd < 0) {
+        ALOGE("IRQ watcher not open\n");
+        return -1;
+    }
 
-    switch (result) {
-        case 0:
-            ALOGD ("timeout\n");
-            close(pollfds[0].fd);
-            return -1;
-        case -1:
-            ALOGE ("poll error \n");
-            close(pollfds[0].fd);
-            return -1;
-        default:
-            ALOGD ("IRQ GOT \n");
-            close(pollfds[0].fd);
-            break;
+    // Reading the node acknowledges the previous notification
+    lseek(irq_watcher.irq_fd, 0, SEEK_SET);
+    read(irq_watcher.irq_fd, &dummybuf, 1);
+
+    t = fpc_trace_now_ns();
+    do {
+        result = epoll_wait(irq_watcher.epoll_fd, evs, 2, IRQ_POLL_TIMEOUT_MS);
+    } while (result < 0 && errno == EINTR);
+    fpc_trace_stage(FPC_TRACE_IRQ, t);
+
+    if (result == 0) {
+        ALOGD ("timeout\n");
+        return -1;
+    } else if (result < 0) {
+        ALOGE ("poll error \n");
+        return -1;
     }
 
-    close(pollfds[0].fd);
+    for (i = 0; i < result; i++) {
+        if (evs[i].data.fd == irq_watcher.cancel_fd) {
+            ALOGD ("IRQ wait cancelled\n");
+            return -1;
+        }
+    }
 
-    return ret;
-}
\ No newline at end of file
+    ALOGD ("IRQ GOT \n");
+    return 0;
+}
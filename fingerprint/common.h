@@ -5,6 +5,10 @@
 
 typedef int32_t err_t;
 err_t sysfs_write(char *path, char *s);
-err_t sys_fs_irq_poll(char *path);
+err_t sys_fs_irq_open(char *path);
+void sys_fs_irq_close();
+err_t sys_fs_irq_poll();
+void sys_fs_irq_cancel();
+void sys_fs_irq_reset();
 
 #endif //FINGERPRINT_COMMON_H
@@ -28,6 +28,7 @@
 #include <netinet/in.h>
 #include <byteswap.h>
 #include "fpc_imp.h"
+#include "fpc_trace.h"
 
 
 uint64_t challenge = 0;
@@ -40,6 +41,109 @@ fingerprint_notify_t callback;
 static char db_path[255];
 static uint32_t fpc_gid = 0;
 
+/*
+ * Messages from the auth thread are delivered to the framework by a
+ * separate thread, so that the next capture does not wait on the
+ * callback. TZ commands all go through one handle and cannot overlap,
+ * but the callback and the TZ work around it can.
+ */
+#define NOTIFY_QUEUE_LEN 8
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct {
+        fingerprint_msg_t msg;
+        uint32_t trace_id;  // Attempt the callback time is accounted to
+    } queue[NOTIFY_QUEUE_LEN];
+    unsigned int head, count;
+    bool running, stop;
+} notifier = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void notify_deliver(fingerprint_msg_t *msg, uint32_t trace_id)
+{
+    uint64_t t = fpc_trace_now_ns();
+
+    callback(msg);
+    fpc_trace_stage_for(trace_id, FPC_TRACE_CALLBACK, t);
+}
+
+static void *notify_thread_loop()
+{
+    fingerprint_msg_t msg;
+    uint32_t trace_id;
+
+    pthread_mutex_lock(&notifier.lock);
+    for (;;) {
+        while (notifier.count == 0 && !notifier.stop)
+            pthread_cond_wait(&notifier.cond, &notifier.lock);
+        if (notifier.count == 0)
+            break;
+
+        msg = notifier.queue[notifier.head].msg;
+        trace_id = notifier.queue[notifier.head].trace_id;
+        notifier.head = (notifier.head + 1) % NOTIFY_QUEUE_LEN;
+        notifier.count--;
+        pthread_cond_broadcast(&notifier.cond);
+
+        pthread_mutex_unlock(&notifier.lock);
+        notify_deliver(&msg, trace_id);
+        pthread_mutex_lock(&notifier.lock);
+    }
+    pthread_mutex_unlock(&notifier.lock);
+
+    return NULL;
+}
+
+static void notify_start()
+{
+    notifier.head = notifier.count = 0;
+    notifier.stop = false;
+    notifier.running = pthread_create(&notifier.thread, NULL,
+                                      notify_thread_loop, NULL) == 0;
+    if (!notifier.running)
+        ALOGE("%s : Error creating thread, notifying inline\n", __func__);
+}
+
+static void notify_post(fingerprint_msg_t *msg)
+{
+    unsigned int tail;
+
+    if (!notifier.running) {
+        notify_deliver(msg, fpc_trace_id());
+        return;
+    }
+
+    pthread_mutex_lock(&notifier.lock);
+    while (notifier.count == NOTIFY_QUEUE_LEN)
+        pthread_cond_wait(&notifier.cond, &notifier.lock);
+    tail = (notifier.head + notifier.count) % NOTIFY_QUEUE_LEN;
+    notifier.queue[tail].msg = *msg;
+    notifier.queue[tail].trace_id = fpc_trace_id();
+    notifier.count++;
+    pthread_cond_broadcast(&notifier.cond);
+    pthread_mutex_unlock(&notifier.lock);
+}
+
+// Deliver whatever is still queued; nothing is sent after this returns
+static void notify_finish()
+{
+    if (!notifier.running)
+        return;
+
+    pthread_mutex_lock(&notifier.lock);
+    notifier.stop = true;
+    pthread_cond_broadcast(&notifier.cond);
+    pthread_mutex_unlock(&notifier.lock);
+
+    pthread_join(notifier.thread, NULL);
+    notifier.running = false;
+}
+
 void *enroll_thread_loop()
 {
     ALOGI("%s", __func__);
@@ -143,10 +247,22 @@ void *auth_thread_loop()
 {
     ALOGI("%s", __func__);
     fpc_auth_start();
+    notify_start();
 
     int status = 1;
+    int trace_result = 0;
+    uint64_t t;
+
+    // One trace record per capture attempt, see fpc_trace.h
+    for (;;) {
+        fpc_trace_begin();
+        t = fpc_trace_now_ns();
+        status = fpc_capture_image();
+        fpc_trace_stage(FPC_TRACE_CAPTURE, t);
+        trace_result = status;
+        if (status < 0)
+            break;
 
-    while((status = fpc_capture_image()) >= 0 ) {
         ALOGD("%s : Got Input with status %d", __func__, status);
 
         pthread_mutex_lock(&lock);
@@ -156,20 +272,26 @@ void *auth_thread_loop()
         }
         pthread_mutex_unlock(&lock);
 
-        if(status >= 1000)
+        if(status >= 1000) {
+            // No finger yet: the wait is not part of any unlock
+            fpc_trace_abort();
             continue;
+        }
 
         if (status <= FINGERPRINT_ACQUIRED_TOO_FAST) {
             fingerprint_msg_t msg;
             msg.type = FINGERPRINT_ACQUIRED;
             msg.data.acquired.acquired_info = status;
-            callback(&msg);
+            notify_post(&msg);
         }
 
         if (status == FINGERPRINT_ACQUIRED_GOOD) {
 
             uint32_t print_id = 0;
+            t = fpc_trace_now_ns();
             int verify_state = fpc_auth_step(&print_id);
+            fpc_trace_stage(FPC_TRACE_AUTH, t);
+            trace_result = verify_state;
             ALOGI("%s : Auth step = %d", __func__, verify_state);
 
             if (verify_state >= 0) {
@@ -178,7 +300,9 @@ void *auth_thread_loop()
                     ALOGI("%s : Got print id : %u", __func__, print_id);
 
                     hw_auth_token_t hat;
+                    t = fpc_trace_now_ns();
                     fpc_get_hw_auth_obj(&hat, sizeof(hw_auth_token_t));
+                    fpc_trace_stage(FPC_TRACE_HAT, t);
 
                     ALOGI("%s : hat->challenge %" PRIu64, __func__, hat.challenge);
                     ALOGI("%s : hat->user_id %" PRIu64, __func__, hat.user_id);
@@ -194,14 +318,27 @@ void *auth_thread_loop()
 
                     msg.data.authenticated.hat = hat;
 
-                    callback(&msg);
+                    notify_post(&msg);
+
+                    // Matched: stop here, the session ends while the
+                    // framework is being notified
                     break;
                 }
             }
         }
+
+        fpc_trace_end(trace_result);
     }
 
+    if (trace_result >= 1000)
+        fpc_trace_abort();
+    else
+        fpc_trace_end(trace_result);
+
     fpc_auth_end();
+    notify_finish();
+    // After the last callback, which is part of the last attempt
+    fpc_trace_log();
     ALOGI("%s : finishing",__func__);
 
     pthread_mutex_lock(&lock);
@@ -258,6 +395,8 @@ static int fingerprint_enroll(struct fingerprint_device __attribute__((unused))
     auth_thread_running = true;
     pthread_mutex_unlock(&lock);
 
+    sys_fs_irq_reset();
+
     if(pthread_create(&thread, NULL, enroll_thread_loop, NULL)) {
         ALOGE("%s : Error creating thread\n", __func__);
         auth_thread_running = false;
@@ -295,6 +434,9 @@ static int fingerprint_cancel(struct fingerprint_device __attribute__((unused))
     auth_thread_running = false;
     pthread_mutex_unlock(&lock);
 
+    // Wake up the thread if it is waiting for a finger
+    sys_fs_irq_cancel();
+
     ALOGI("%s : join running thread",__func__);
     pthread_join(thread, NULL);
 
@@ -422,6 +564,8 @@ static int fingerprint_authenticate(struct fingerprint_device __attribute__((unu
     auth_thread_running = true;
     pthread_mutex_unlock(&lock);
 
+    sys_fs_irq_reset();
+
     // FIXME: Verify whether this needs to run on each
     fpc_set_auth_challenge(0);
 
@@ -20,6 +20,7 @@
 #include "tz_api_kitakami.h"
 #include <string.h>
 #include "common.h"
+#include "fpc_trace.h"
 
 #define LOG_TAG "FPC IMP"
 #define LOG_NDEBUG 0
@@ -61,6 +62,33 @@ err_t device_disable()
     return 1;
 }
 
+/*
+ * Every command buffer starts with its command id, keep that in the trace
+ * of the current unlock attempt along with how long TZ took.
+ */
+static int traced_send_cmd(struct QSEECom_handle *handle, void *send_buf,
+        uint32_t sbuf_len, void *rcv_buf, uint32_t rbuf_len)
+{
+    uint32_t cmd = *(uint32_t *)send_buf;
+    uint64_t t = fpc_trace_now_ns();
+    int ret = qsee_handle->send_cmd(handle, send_buf, sbuf_len, rcv_buf, rbuf_len);
+
+    fpc_trace_tz(cmd, t);
+    return ret;
+}
+
+static int traced_send_modified_cmd(struct QSEECom_handle *handle, void *send_buf,
+        uint32_t sbuf_len, void *rcv_buf, uint32_t rbuf_len,
+        struct QSEECom_ion_fd_info *ifd_data)
+{
+    uint32_t cmd = *(uint32_t *)send_buf;
+    uint64_t t = fpc_trace_now_ns();
+    int ret = qsee_handle->send_modified_cmd(handle, send_buf, sbuf_len, rcv_buf, rbuf_len, ifd_data);
+
+    fpc_trace_tz(cmd, t);
+    return ret;
+}
+
 err_t send_modified_command_to_tz(uint32_t cmd, struct QSEECom_handle * handle, void * buffer, uint32_t len)
 {
 
@@ -88,7 +116,7 @@ err_t send_modified_command_to_tz(uint32_t cmd, struct QSEECom_handle * handle,
 
     memcpy((unsigned char *)ihandle.ion_sbuffer, buffer, len);
 
-    int ret = qsee_handle->send_modified_cmd(handle,send_cmd,64,rec_cmd,64,&ion_fd_info);
+    int ret = traced_send_modified_cmd(handle,send_cmd,64,rec_cmd,64,&ion_fd_info);
 
     if(ret < 0) {
         qsee_handle->ion_free(&ihandle);
@@ -114,7 +142,7 @@ err_t send_normal_command(uint32_t cmd, uint32_t param, struct QSEECom_handle *
     send_cmd->cmd_id = cmd;
     send_cmd->ret_val = param;
 
-    int ret = qsee_handle->send_cmd(handle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(handle,send_cmd,64,rec_cmd,64);
 
     if(ret < 0) {
         return -1;
@@ -132,7 +160,7 @@ int64_t get_int64_command(uint32_t cmd, uint32_t param, struct QSEECom_handle *
     send_cmd->cmd_id = cmd;
     send_cmd->ret_val = param;
 
-    int ret = qsee_handle->send_cmd(handle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(handle,send_cmd,64,rec_cmd,64);
 
     if(ret < 0) {
         return -1;
@@ -184,7 +212,7 @@ err_t fpc_get_hw_auth_obj(void * buffer, uint32_t length)
 
     memset((unsigned char *)ihandle.ion_sbuffer, 0, length);
 
-    int ret = qsee_handle->send_modified_cmd(mFPCHandle,send_cmd,64,rec_cmd,64,&ion_fd_info);
+    int ret = traced_send_modified_cmd(mFPCHandle,send_cmd,64,rec_cmd,64,&ion_fd_info);
 
     memcpy(buffer, (unsigned char *)ihandle.ion_sbuffer, length);
 
@@ -261,7 +289,7 @@ err_t fpc_wait_for_finger()
 
     ALOGD("Attempting to poll device IRQ\n");
 
-    if (sys_fs_irq_poll(SPI_IRQ_FILE) < 0) {
+    if (sys_fs_irq_poll() < 0) {
         sysfs_write(SPI_CLK_FILE,"1");
         sysfs_write(SPI_WAKE_FILE,"0");
         return 1;
@@ -320,7 +348,7 @@ err_t fpc_enroll_step(uint32_t *remaining_touches)
     send_cmd->cmd_id = FPC_ENROLL_STEP;
     send_cmd->ret_val = 0x24;
 
-    int ret = qsee_handle->send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
 
     if(ret < 0) {
         return -1;
@@ -346,7 +374,7 @@ err_t fpc_enroll_start(int print_index)
     send_cmd->na1 = 0x45;
     send_cmd->print_index = print_index;
 
-    int ret = qsee_handle->send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
 
     if(ret < 0) {
         return -1;
@@ -382,7 +410,7 @@ fpc_fingerprint_index_t fpc_get_print_ids(uint32_t count)
     send_cmd->ret_val = count;
     send_cmd->length = count;
 
-    int ret = qsee_handle->send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
 
     data.prints[0] = rec_cmd->p1;
     data.prints[1] = rec_cmd->p2;
@@ -415,7 +443,7 @@ err_t fpc_auth_start()
     send_cmd->p5 = prints.prints[4];
     send_cmd->print_count = prints.print_count;
 
-    int ret = qsee_handle->send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
 
     if(ret < 0) {
         ALOGE("Error sending FPC_AUTH_START to tz\n");
@@ -434,7 +462,7 @@ err_t fpc_auth_step(uint32_t *print_id)
     send_cmd->cmd_id = FPC_AUTH_STEP;
     send_cmd->ret_val = 0x00;
 
-    int ret = qsee_handle->send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
 
     if(ret < 0) {
         return -1;
@@ -472,7 +500,7 @@ err_t fpc_get_print_id(int id)
     send_cmd->cmd_id = FPC_GET_PRINT_ID;
     send_cmd->ret_val = id;
 
-    int ret = qsee_handle->send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
 
     if(ret < 0) {
         return -1;
@@ -491,7 +519,7 @@ err_t fpc_get_print_count()
     send_cmd->cmd_id = FPC_GET_ID_COUNT;
     send_cmd->ret_val = 0x00;
 
-    int ret = qsee_handle->send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
 
     if(ret < 0) {
         return -1;
@@ -513,7 +541,7 @@ fpc_fingerprint_index_t fpc_get_print_index(uint32_t count)
     send_cmd->ret_val = count;
     send_cmd->length = count;
 
-    int ret = qsee_handle->send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
 
     data.prints[0] = (uint32_t)fpc_get_print_id(rec_cmd->p1);
     data.prints[1] = (uint32_t)fpc_get_print_id(rec_cmd->p2);
@@ -535,7 +563,7 @@ err_t fpc_get_user_db_length()
     send_cmd->cmd_id = FPC_GET_DB_LENGTH;
     send_cmd->ret_val = 0x00;
 
-    int ret = qsee_handle->send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
+    int ret = traced_send_cmd(mFPCHandle,send_cmd,64,rec_cmd,64);
 
     if(ret < 0) {
         return -1;
@@ -585,7 +613,7 @@ err_t fpc_load_user_db(char* path)
     send_cmd->length = fsize;
     send_cmd->extra = 0x00;
 
-    int ret = qsee_handle->send_modified_cmd(mFPCHandle,send_cmd,64,rec_cmd,64,&ion_fd_info);
+    int ret = traced_send_modified_cmd(mFPCHandle,send_cmd,64,rec_cmd,64,&ion_fd_info);
 
     if(ret < 0) {
         qsee_handle->ion_free(&ihandle);
@@ -630,7 +658,7 @@ err_t fpc_store_user_db(uint32_t length, char* path)
 
     memset((unsigned char *)ihandle.ion_sbuffer, 0, length);
 
-    int ret = qsee_handle->send_modified_cmd(mFPCHandle,send_cmd,64,rec_cmd,64,&ion_fd_info);
+    int ret = traced_send_modified_cmd(mFPCHandle,send_cmd,64,rec_cmd,64,&ion_fd_info);
 
     if(ret < 0) {
         qsee_handle->ion_free(&ihandle);
@@ -667,6 +695,7 @@ err_t fpc_set_gid(uint32_t __unused gid)
 
 err_t fpc_close()
 {
+    sys_fs_irq_close();
     if (device_disable() < 0) {
         ALOGE("Error stopping device\n");
         return -1;
@@ -774,6 +803,11 @@ err_t fpc_init() {
 
     qsee_handle->set_bandwidth(mFPCHandle,false);
 
+    if (sys_fs_irq_open(SPI_IRQ_FILE) < 0) {
+        ALOGE("Error opening device IRQ\n");
+        return -1;
+    }
+
     return 1;
 
 }
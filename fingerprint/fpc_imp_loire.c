@@ -19,10 +19,13 @@
 #include "fpc_imp.h"
 #include "tz_api_loire.h"
 #include "common.h"
+#include "fpc_trace.h"
 
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #define LOG_TAG "FPC IMP"
@@ -41,16 +44,135 @@ static struct QSEECom_handle * mKeymasterHandle;
 static struct qsee_handle_t* qsee_handle = NULL;
 uint32_t auth_id = 0;
 
-static err_t poll_irq(char *path)
+/*
+ * ION buffers for the TZ commands, allocated once in fpc_init():
+ * every allocation opens /dev/ion, allocates, maps and mmaps, and
+ * an authentication attempt sends dozens of commands.
+ * Entries are sorted by size, so that the smallest free buffer
+ * that fits gets used. Commands not fitting in any free buffer
+ * get a one-off allocation, as before.
+ */
+#define ION_POOL_ALIGN(x) (((x) + 4095) & (~4095))
+
+struct ion_pool_entry {
+    uint32_t size;
+    bool allocated;
+    bool busy;
+    struct qcom_km_ion_info_t ihandle;
+};
+
+static struct ion_pool_entry ion_pool[] = {
+    { .size = 4096 },
+    { .size = 4096 },
+    { .size = 16384 },
+    { .size = 65536 },
+};
+
+#define ION_POOL_ENTRIES (sizeof(ion_pool) / sizeof(ion_pool[0]))
+
+static pthread_mutex_t ion_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void ion_pool_init()
 {
-    err_t ret = 0;
-    sysfs_write(SPI_WAKE_FILE, "disable");
-    sysfs_write(SPI_WAKE_FILE, "enable");
+    unsigned int i;
 
-    ret = sys_fs_irq_poll(path);
+    for (i = 0; i < ION_POOL_ENTRIES; i++) {
+        if (ion_pool[i].allocated)
+            continue;
 
-    sysfs_write(SPI_WAKE_FILE, "disable");
-    return ret;
+        if (qsee_handle->ion_alloc(&ion_pool[i].ihandle, ion_pool[i].size) < 0) {
+            ALOGE("Cannot preallocate %u bytes ION buffer\n", ion_pool[i].size);
+            continue;
+        }
+        ion_pool[i].allocated = true;
+        ion_pool[i].busy = false;
+    }
+}
+
+static void ion_pool_release()
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&ion_pool_lock);
+    for (i = 0; i < ION_POOL_ENTRIES; i++) {
+        if (!ion_pool[i].allocated)
+            continue;
+
+        if (ion_pool[i].busy)
+            ALOGE("Releasing ION buffer still in use\n");
+        qsee_handle->ion_free(&ion_pool[i].ihandle);
+        ion_pool[i].allocated = false;
+        ion_pool[i].busy = false;
+    }
+    pthread_mutex_unlock(&ion_pool_lock);
+}
+
+/*
+ * Get a zeroed ION buffer of at least size bytes, as freshly
+ * allocated ones are. sbuf_len is set to size, which is what TZ
+ * gets told about.
+ */
+static int32_t ion_buf_get(struct qcom_km_ion_info_t *ihandle, uint32_t size)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&ion_pool_lock);
+    for (i = 0; i < ION_POOL_ENTRIES; i++) {
+        if (!ion_pool[i].allocated || ion_pool[i].busy ||
+            ion_pool[i].size < size)
+            continue;
+
+        ion_pool[i].busy = true;
+        *ihandle = ion_pool[i].ihandle;
+        pthread_mutex_unlock(&ion_pool_lock);
+
+        ihandle->sbuf_len = size;
+        memset(ihandle->ion_sbuffer, 0, ION_POOL_ALIGN(size));
+        return 0;
+    }
+    pthread_mutex_unlock(&ion_pool_lock);
+
+    return qsee_handle->ion_alloc(ihandle, size);
+}
+
+static void ion_buf_put(struct qcom_km_ion_info_t *ihandle)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&ion_pool_lock);
+    for (i = 0; i < ION_POOL_ENTRIES; i++) {
+        if (ion_pool[i].allocated &&
+            ion_pool[i].ihandle.ion_sbuffer == ihandle->ion_sbuffer) {
+            ion_pool[i].busy = false;
+            pthread_mutex_unlock(&ion_pool_lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&ion_pool_lock);
+
+    qsee_handle->ion_free(ihandle);
+}
+
+/*
+ * The IRQ may wake the system up only while waiting for a finger.
+ * Keep it enabled across the polls of a capture instead of toggling it
+ * around each of them: every change is a sysfs open and write.
+ */
+static bool wakeup_enabled = false;
+
+static void set_wakeup(bool enable)
+{
+    if (enable == wakeup_enabled)
+        return;
+
+    if (sysfs_write(SPI_WAKE_FILE, enable ? "enable" : "disable") == 0)
+        wakeup_enabled = enable;
+}
+
+static err_t poll_irq()
+{
+    set_wakeup(true);
+    return sys_fs_irq_poll();
 }
 
 
@@ -123,9 +245,15 @@ err_t send_modified_command_to_tz(struct QSEECom_handle * handle, struct qcom_km
     ion_fd_info.data[0].cmd_buf_offset = 4;
 
     send_cmd->v_addr = (intptr_t) ihandle.ion_sbuffer;
-    uint32_t length = (ihandle.sbuf_len + 4095) & (~4095);
+    uint32_t length = ION_POOL_ALIGN(ihandle.sbuf_len);
     send_cmd->length = length;
+
+    // Every payload starts with its group and command ids
+    const fpc_send_std_cmd_t *payload = (const fpc_send_std_cmd_t *) ihandle.ion_sbuffer;
+    uint32_t trace_cmd = (payload->group_id << 16) | (payload->cmd_id & 0xffff);
+    uint64_t t = fpc_trace_now_ns();
     int result = qsee_handle->send_modified_cmd(handle,send_cmd,64,rec_cmd,64,&ion_fd_info);
+    fpc_trace_tz(trace_cmd, t);
 
     if(result)
     {
@@ -149,12 +277,11 @@ err_t send_normal_command(struct QSEECom_handle * handle, int command)
 
     ihandle.ion_fd = 0;
 
-    if (qsee_handle->ion_alloc(&ihandle, 0x40) <0) {
+    if (ion_buf_get(&ihandle, 0x40) <0) {
         ALOGE("ION allocation  failed");
         return -1;
     }
 
-    // TODO: use single shared buffer instead of allocating/free'ing again and again
     fpc_send_std_cmd_t* send_cmd = (fpc_send_std_cmd_t*) ihandle.ion_sbuffer;
 
     send_cmd->group_id = 0x1;
@@ -167,14 +294,14 @@ err_t send_normal_command(struct QSEECom_handle * handle, int command)
         ret = send_cmd->ret_val;
     }
 
-    qsee_handle->ion_free(&ihandle);
+    ion_buf_put(&ihandle);
     return ret;
 }
 
 err_t send_buffer_command(struct QSEECom_handle * handle, uint32_t group_id, uint32_t cmd_id, const uint8_t *buffer, uint32_t length)
 {
     struct qcom_km_ion_info_t ihandle;
-    if (qsee_handle->ion_alloc(&ihandle, length + sizeof(fpc_send_buffer_t)) <0) {
+    if (ion_buf_get(&ihandle, length + sizeof(fpc_send_buffer_t)) <0) {
         ALOGE("ION allocation  failed");
         return -1;
     }
@@ -187,11 +314,12 @@ err_t send_buffer_command(struct QSEECom_handle * handle, uint32_t group_id, uin
 
     if(send_modified_command_to_tz(handle, ihandle) < 0) {
         ALOGE("Error sending data to tz\n");
+        ion_buf_put(&ihandle);
         return -1;
     }
 
     int result = cmd_data->status;
-    qsee_handle->ion_free(&ihandle);
+    ion_buf_put(&ihandle);
     return result;
 }
 
@@ -199,7 +327,7 @@ err_t send_buffer_command(struct QSEECom_handle * handle, uint32_t group_id, uin
 err_t send_command_result_buffer(struct QSEECom_handle * handle, uint32_t group_id, uint32_t cmd_id, uint8_t *buffer, uint32_t length)
 {
     struct qcom_km_ion_info_t ihandle;
-    if (qsee_handle->ion_alloc(&ihandle, length + sizeof(fpc_send_buffer_t)) <0) {
+    if (ion_buf_get(&ihandle, length + sizeof(fpc_send_buffer_t)) <0) {
         ALOGE("ION allocation  failed");
         return -1;
     }
@@ -211,12 +339,13 @@ err_t send_command_result_buffer(struct QSEECom_handle * handle, uint32_t group_
 
     if(send_modified_command_to_tz(handle, ihandle) < 0) {
         ALOGE("Error sending data to tz\n");
+        ion_buf_put(&ihandle);
         return -1;
     }
     memcpy(buffer, &keydata_cmd->data[0], length);
 
     int result = keydata_cmd->status;
-    qsee_handle->ion_free(&ihandle);
+    ion_buf_put(&ihandle);
     return result;
 }
 
@@ -225,7 +354,7 @@ err_t send_custom_cmd(struct QSEECom_handle * handle, void *buffer, uint32_t len
     ALOGD(__func__);
     struct qcom_km_ion_info_t ihandle;
 
-    if (qsee_handle->ion_alloc(&ihandle, len) <0) {
+    if (ion_buf_get(&ihandle, len) <0) {
         ALOGE("ION allocation  failed");
         return -1;
     }
@@ -234,12 +363,13 @@ err_t send_custom_cmd(struct QSEECom_handle * handle, void *buffer, uint32_t len
 
     if(send_modified_command_to_tz(handle, ihandle) < 0) {
         ALOGE("Error sending data to tz\n");
+        ion_buf_put(&ihandle);
         return -1;
     }
 
     // Copy back result
     memcpy(buffer, ihandle.ion_sbuffer, len);
-    qsee_handle->ion_free(&ihandle);
+    ion_buf_put(&ihandle);
 
     return 0;
 };
@@ -373,7 +503,7 @@ err_t fpc_wait_finger_down()
         if(result)
             return result;
 
-        if((result = poll_irq(SPI_IRQ_FILE)) == -1) {
+        if((result = poll_irq()) == -1) {
                 ALOGE("Error waiting for irq: %d\n", result);
                 return -1;
         }
@@ -416,6 +546,8 @@ err_t fpc_capture_image()
         ret = 1000;
     }
 
+    set_wakeup(false);
+
     if (device_disable() < 0) {
         ALOGE("Error stopping device\n");
         return -1;
@@ -611,6 +743,9 @@ err_t fpc_close()
 {
     ALOGD(__func__);
     qsee_handle->shutdown_app(&mFPC_handle);
+    ion_pool_release();
+    sys_fs_irq_close();
+    set_wakeup(false);
     if (device_disable() < 0) {
         ALOGE("Error stopping device\n");
         return -1;
@@ -628,6 +763,8 @@ err_t fpc_init()
         return -1;
     }
 
+    ion_pool_init();
+
     if (device_enable() < 0) {
         ALOGE("Error starting device\n");
         return -1;
@@ -693,5 +830,10 @@ err_t fpc_init()
         return -1;
     }
 
+    if (sys_fs_irq_open(SPI_IRQ_FILE) < 0) {
+        ALOGE("Error opening device IRQ\n");
+        return -1;
+    }
+
     return 1;
 }
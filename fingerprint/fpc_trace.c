@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2016 Shane Francis / Jens Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fpc_trace.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_TAG "FPC TRACE"
+#define LOG_NDEBUG 0
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+typedef struct {
+    uint32_t seq;           // Odd while the record is being written
+    fpc_trace_record_t rec;
+} fpc_trace_slot_t;
+
+static const char *stage_names[FPC_TRACE_STAGES] = {
+    "irq", "capture", "auth", "hat", "callback", "tz", "total",
+};
+
+// Attempt in progress, only ever touched by the thread owning it
+static fpc_trace_record_t cur;
+static pthread_t cur_owner;
+static bool cur_active;
+
+static bool keep_id;
+
+/*
+ * Stages timed on other threads for a given attempt (the framework
+ * callback), before or after it ended. Ring writers hold late_lock.
+ */
+static pthread_mutex_t late_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t late_id;
+static uint32_t late_us[FPC_TRACE_STAGES];
+
+static fpc_trace_slot_t ring[FPC_TRACE_RECORDS];
+static uint32_t ring_head;
+static uint32_t next_id;
+static uint32_t hist[FPC_TRACE_STAGES][FPC_TRACE_BUCKETS];
+
+uint64_t fpc_trace_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t ns_to_us(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+
+    return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static bool is_owner()
+{
+    return __atomic_load_n(&cur_active, __ATOMIC_ACQUIRE) &&
+           pthread_equal(cur_owner, pthread_self());
+}
+
+static void add_us(uint32_t *acc, uint32_t us)
+{
+    *acc = *acc > UINT32_MAX - us ? UINT32_MAX : *acc + us;
+}
+
+static unsigned int bucket_of(uint32_t us)
+{
+    unsigned int b;
+
+    if (us <= 2)
+        return 0;
+
+    b = 31 - __builtin_clz(us - 1);
+    return b >= FPC_TRACE_BUCKETS ? FPC_TRACE_BUCKETS - 1 : b;
+}
+
+void fpc_trace_begin()
+{
+    uint32_t id = cur.id;
+
+    memset(&cur, 0, sizeof(cur));
+    // An aborted attempt leaves its number to the next one
+    cur.id = keep_id ? id : __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    keep_id = false;
+    cur.start_ns = fpc_trace_now_ns();
+    cur_owner = pthread_self();
+    __atomic_store_n(&cur_active, true, __ATOMIC_RELEASE);
+}
+
+void fpc_trace_stage(fpc_trace_stage_t stage, uint64_t start_ns)
+{
+    uint32_t us;
+
+    if (stage >= FPC_TRACE_STAGES || !is_owner())
+        return;
+
+    // A stage may run more than once per attempt (e.g. IRQ wait timeouts)
+    us = ns_to_us(fpc_trace_now_ns() - start_ns);
+    add_us(&cur.stage_us[stage], us);
+}
+
+/*
+ * Id of the attempt in progress on this thread, for fpc_trace_stage_for().
+ * Returns FPC_TRACE_NO_ID if there is none.
+ */
+uint32_t fpc_trace_id()
+{
+    return is_owner() ? cur.id : FPC_TRACE_NO_ID;
+}
+
+/*
+ * Account a stage run on another thread to the given attempt, which may
+ * have ended already. Such stages get one histogram entry per run.
+ */
+void fpc_trace_stage_for(uint32_t id, fpc_trace_stage_t stage,
+        uint64_t start_ns)
+{
+    fpc_trace_slot_t *slot;
+    uint32_t head, seq, us;
+    unsigned int age;
+
+    if (id == FPC_TRACE_NO_ID || stage >= FPC_TRACE_STAGES)
+        return;
+
+    us = ns_to_us(fpc_trace_now_ns() - start_ns);
+    __atomic_fetch_add(&hist[stage][bucket_of(us)], 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&late_lock);
+    head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+    for (age = 0; age < FPC_TRACE_RECORDS && age < head; age++) {
+        slot = &ring[(head - 1 - age) % FPC_TRACE_RECORDS];
+        if (slot->rec.id != id)
+            continue;
+
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        add_us(&slot->rec.stage_us[stage], us);
+        __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&late_lock);
+        return;
+    }
+
+    // Not ended yet: folded in by fpc_trace_end()
+    if (late_id != id) {
+        memset(late_us, 0, sizeof(late_us));
+        late_id = id;
+    }
+    add_us(&late_us[stage], us);
+    pthread_mutex_unlock(&late_lock);
+}
+
+void fpc_trace_tz(uint32_t cmd, uint64_t start_ns)
+{
+    fpc_trace_tz_t *tz;
+
+    if (!is_owner())
+        return;
+
+    fpc_trace_stage(FPC_TRACE_TZ, start_ns);
+
+    if (cur.num_tz >= FPC_TRACE_MAX_TZ) {
+        cur.num_tz++;
+        return;
+    }
+
+    tz = &cur.tz[cur.num_tz++];
+    tz->cmd = cmd;
+    tz->start_us = ns_to_us(start_ns - cur.start_ns);
+    tz->duration_us = ns_to_us(fpc_trace_now_ns() - start_ns);
+}
+
+void fpc_trace_end(int32_t result)
+{
+    fpc_trace_slot_t *slot;
+    uint32_t seq;
+    int i;
+
+    if (!is_owner())
+        return;
+
+    cur.stage_us[FPC_TRACE_TOTAL] = 0;
+    fpc_trace_stage(FPC_TRACE_TOTAL, cur.start_ns);
+    cur.result = result;
+    __atomic_store_n(&cur_active, false, __ATOMIC_RELEASE);
+
+    for (i = 0; i < FPC_TRACE_STAGES; i++) {
+        // Stages the attempt never reached stay out of the histogram
+        if (i != FPC_TRACE_TOTAL && cur.stage_us[i] == 0)
+            continue;
+        __atomic_fetch_add(&hist[i][bucket_of(cur.stage_us[i])], 1,
+                __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&late_lock);
+    if (late_id == cur.id) {
+        for (i = 0; i < FPC_TRACE_STAGES; i++)
+            add_us(&cur.stage_us[i], late_us[i]);
+        memset(late_us, 0, sizeof(late_us));
+    }
+
+    slot = &ring[__atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED) %
+            FPC_TRACE_RECORDS];
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&slot->rec, &cur, sizeof(cur));
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&late_lock);
+}
+
+/*
+ * Drop the attempt in progress without recording it, e.g. when the
+ * sensor timed out waiting for a finger: idle waits are not latency.
+ */
+void fpc_trace_abort()
+{
+    if (!is_owner())
+        return;
+
+    keep_id = true;
+    __atomic_store_n(&cur_active, false, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy out the record of the age-th last completed attempt (0 = latest).
+ * Returns 0 on success, -1 if there is no such record.
+ */
+int fpc_trace_get_record(unsigned int age, fpc_trace_record_t *rec)
+{
+    const fpc_trace_slot_t *slot;
+    uint32_t head, seq;
+    int tries;
+
+    head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    if (age >= FPC_TRACE_RECORDS || age >= head)
+        return -1;
+
+    slot = &ring[(head - 1 - age) % FPC_TRACE_RECORDS];
+
+    for (tries = 0; tries < 16; tries++) {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        memcpy(rec, &slot->rec, sizeof(*rec));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+            return 0;
+    }
+
+    return -1;
+}
+
+// Upper bound in us of the bucket holding the given percentile
+static uint32_t hist_percentile(const uint32_t *h, uint32_t total, int pct)
+{
+    uint64_t want = ((uint64_t)total * pct + 99) / 100;
+    uint64_t seen = 0;
+    int b;
+
+    for (b = 0; b < FPC_TRACE_BUCKETS; b++) {
+        seen += h[b];
+        if (seen >= want)
+            return 2U << b;
+    }
+
+    return 2U << (FPC_TRACE_BUCKETS - 1);
+}
+
+/*
+ * Print the per-stage percentiles and, if records is set, the recent
+ * attempts with their TZ commands. Output stops at the last line that
+ * fits in the buffer.
+ */
+int fpc_trace_dump(char *buf, size_t len, bool records)
+{
+    fpc_trace_record_t rec;
+    uint32_t h[FPC_TRACE_BUCKETS], total;
+    size_t off = 0;
+    int i, b, n;
+    unsigned int age;
+
+#define OUT(...) do { \
+        n = snprintf(buf + off, len - off, __VA_ARGS__); \
+        if (n < 0 || (size_t)n >= len - off) { \
+            buf[off] = '\0'; \
+            return (int)off; \
+        } \
+        off += n; \
+    } while (0)
+
+    if (len == 0)
+        return 0;
+    buf[0] = '\0';
+
+    OUT("stage     count   p50us   p90us   p99us\n");
+    for (i = 0; i < FPC_TRACE_STAGES; i++) {
+        total = 0;
+        for (b = 0; b < FPC_TRACE_BUCKETS; b++) {
+            h[b] = __atomic_load_n(&hist[i][b], __ATOMIC_RELAXED);
+            total += h[b];
+        }
+        if (total == 0)
+            continue;
+        OUT("%-8s %6u %7u %7u %7u\n", stage_names[i], total,
+                hist_percentile(h, total, 50),
+                hist_percentile(h, total, 90),
+                hist_percentile(h, total, 99));
+    }
+
+    for (age = 0; records && fpc_trace_get_record(age, &rec) == 0; age++) {
+        OUT("#%u result=%d", rec.id, rec.result);
+        for (i = 0; i < FPC_TRACE_STAGES; i++)
+            OUT(" %s=%u", stage_names[i], rec.stage_us[i]);
+        OUT("\n");
+        for (i = 0; i < (int)rec.num_tz && i < FPC_TRACE_MAX_TZ; i++)
+            OUT("    tz 0x%08x @%u %uus\n", rec.tz[i].cmd,
+                    rec.tz[i].start_us, rec.tz[i].duration_us);
+        if (rec.num_tz > FPC_TRACE_MAX_TZ)
+            OUT("    tz ... %u more\n", rec.num_tz - FPC_TRACE_MAX_TZ);
+    }
+
+#undef OUT
+
+    return (int)off;
+}
+
+/*
+ * Log the last attempt and the percentiles of every stage so far.
+ * Setting FPC_TRACE_PROP adds the recent attempts and their TZ commands.
+ */
+void fpc_trace_log()
+{
+    fpc_trace_record_t rec;
+    char buf[FPC_TRACE_DUMP_MAX];
+    char prop[PROPERTY_VALUE_MAX];
+    char *line, *saveptr;
+
+    if (fpc_trace_get_record(0, &rec))
+        return;
+
+    ALOGD("Attempt #%u result %d: irq %uus capture %uus auth %uus hat %uus "
+          "callback %uus tz %uus (%u cmds) total %uus\n",
+          rec.id, rec.result,
+          rec.stage_us[FPC_TRACE_IRQ], rec.stage_us[FPC_TRACE_CAPTURE],
+          rec.stage_us[FPC_TRACE_AUTH], rec.stage_us[FPC_TRACE_HAT],
+          rec.stage_us[FPC_TRACE_CALLBACK], rec.stage_us[FPC_TRACE_TZ],
+          rec.num_tz, rec.stage_us[FPC_TRACE_TOTAL]);
+
+    property_get(FPC_TRACE_PROP, prop, "0");
+    fpc_trace_dump(buf, sizeof(buf), atoi(prop) != 0);
+
+    for (line = strtok_r(buf, "\n", &saveptr); line != NULL;
+            line = strtok_r(NULL, "\n", &saveptr))
+        ALOGD("%s\n", line);
+}
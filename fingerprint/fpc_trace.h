@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 Shane Francis / Jens Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __FPC_TRACE_H_
+#define __FPC_TRACE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FPC_TRACE_RECORDS   32  // Attempts kept in the ring
+#define FPC_TRACE_MAX_TZ    32  // TZ commands kept per attempt
+#define FPC_TRACE_BUCKETS   24  // Bucket n: up to 2^(n+1) us
+#define FPC_TRACE_DUMP_MAX  4096
+#define FPC_TRACE_PROP      "debug.fpc.trace_records"    // Log attempts too
+#define FPC_TRACE_NO_ID     UINT32_MAX
+
+typedef enum {
+    FPC_TRACE_IRQ,          // Waiting for the sensor IRQ
+    FPC_TRACE_CAPTURE,      // fpc_capture_image(), IRQ wait included
+    FPC_TRACE_AUTH,         // fpc_auth_step(): TZ matcher
+    FPC_TRACE_HAT,          // fpc_get_hw_auth_obj()
+    FPC_TRACE_CALLBACK,     // Framework callback, on the notifier thread
+    FPC_TRACE_TZ,           // All the TZ commands
+    FPC_TRACE_TOTAL,        // Whole attempt
+    FPC_TRACE_STAGES,
+} fpc_trace_stage_t;
+
+typedef struct {
+    uint32_t cmd;           // TZ command, (group << 16) | id if grouped
+    uint32_t start_us;      // From the attempt start
+    uint32_t duration_us;
+} fpc_trace_tz_t;
+
+typedef struct {
+    uint32_t id;            // Attempt number
+    uint64_t start_ns;
+    int32_t result;
+    uint32_t stage_us[FPC_TRACE_STAGES];
+    uint32_t num_tz;
+    fpc_trace_tz_t tz[FPC_TRACE_MAX_TZ];
+} fpc_trace_record_t;
+
+uint64_t fpc_trace_now_ns();
+void fpc_trace_begin();
+void fpc_trace_stage(fpc_trace_stage_t stage, uint64_t start_ns);
+uint32_t fpc_trace_id();
+void fpc_trace_stage_for(uint32_t id, fpc_trace_stage_t stage,
+        uint64_t start_ns);
+void fpc_trace_tz(uint32_t cmd, uint64_t start_ns);
+void fpc_trace_end(int32_t result);
+void fpc_trace_abort();
+int fpc_trace_get_record(unsigned int age, fpc_trace_record_t *rec);
+int fpc_trace_dump(char *buf, size_t len, bool records);
+void fpc_trace_log();
+
+#endif
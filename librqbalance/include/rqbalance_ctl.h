@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RQBALANCE_CTL_H__
+#define __RQBALANCE_CTL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * struct perf_lock_request
+ * One entry of a perf_lock_acq_batch() request
+ *
+ * The fields have the same meaning as the perf_lock_acq() parameters.
+ */
+struct perf_lock_request {
+	int id;
+	int time;
+	int *argument;
+	int arraysz;
+};
+
+int perf_lock_acq(int id, int time, int argument[], int arraysz);
+int perf_lock_rel(int id);
+int perf_lock_acq_batch(struct perf_lock_request reqs[], int count,
+			int handles[]);
+int perf_lock_rel_batch(int handles[], int count);
+int perf_lock_shm_attach(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,11 +18,18 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -31,7 +38,11 @@
 #include <hardware/power.h>
 #include <utils/Log.h>
 
+#include "rqbalance_ctl.h"
+
+#ifndef POWERSERVER_SOCKET	/* Host builds use their own */
 #define POWERSERVER_SOCKET		"/data/misc/powerhal/rqbsvr"
+#endif
 
 #define MAX_ARGUMENTS	20
 struct rqbalance_halext_params {
@@ -42,18 +53,154 @@ struct rqbalance_halext_params {
 	uint32_t arraysz;
 };
 
-static int send_powerserver_data(struct rqbalance_halext_params params)
+/* Keep in sync with power/rqbalance_halext.h */
+#define HALEXT_MSG_MAGIC	0x52514258	/* "RQBX" */
+#define HALEXT_MAX_BATCH	16
+#define HALEXT_OP_PERF_LOCK	0x1
+#define HALEXT_OP_PERF_LOCK_BATCH	0x2
+#define HALEXT_OP_SHM_ATTACH	0x7
+
+struct rqbalance_halext_hdr {
+	uint32_t magic;
+	uint32_t reqid;
+	uint16_t op;
+	uint16_t count;
+};
+
+struct rqbalance_halext_batch_msg {
+	struct rqbalance_halext_hdr hdr;
+	struct rqbalance_halext_params params[HALEXT_MAX_BATCH];
+};
+
+struct rqbalance_halext_reply {
+	struct rqbalance_halext_hdr hdr;
+	int32_t reply[HALEXT_MAX_BATCH];
+};
+
+#define HALEXT_SHM_MAGIC	0x52514253	/* "RQBS" */
+#define HALEXT_SHM_SLOTS	32
+#define HALEXT_SHM_FDS		3
+
+#define HALEXT_SLOT_FREE	0
+#define HALEXT_SLOT_BUSY	1
+#define HALEXT_SLOT_REQUEST	2
+#define HALEXT_SLOT_RUNNING	3
+#define HALEXT_SLOT_DONE	4
+
+struct rqbalance_halext_slot {
+	uint32_t state;
+	int32_t reply;
+	struct rqbalance_halext_params params;
+};
+
+struct rqbalance_halext_ring {
+	uint32_t magic;
+	uint32_t num_slots;
+	struct rqbalance_halext_slot slots[HALEXT_SHM_SLOTS];
+};
+
+#define POWERSERVER_TIMEOUT_MS	1000
+#define POWERSERVER_SHM_SPIN	100	/* Yields before sleeping */
+#define POWERSERVER_CONNECT_RETRY_US	5000
+
+/*
+ * The connection to the PowerServer is opened once and then shared
+ * by all the threads of the process: every request is tagged with a
+ * request id, so more than one request can be in flight at a time.
+ * One of the waiting threads at a time reads the replies from the
+ * socket and hands each of them to the thread waiting for that id.
+ */
+struct ps_waiter {
+	uint32_t reqid;
+	int32_t *replies;
+	int count;
+	int *fds;		/* Passed descriptors, if expected */
+	int error;
+	bool done;
+	struct ps_waiter *next;
+};
+
+static int ps_sock = -1;
+static uint32_t ps_sock_gen = 0;	/* Bumped on every connection */
+static uint32_t ps_next_reqid = 1;
+static bool ps_receiving = false;
+static struct ps_waiter *ps_waiters = NULL;
+static pthread_mutex_t ps_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ps_cond;
+static pthread_once_t ps_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Processes calling perf_lock_shm_attach() get a ring shared with
+ * the PowerServer instead: requests are written to a free slot
+ * and the server is woken up with an eventfd, with no round trip
+ * on the socket. Replies get spun on for a little while, then
+ * waited for on the completion eventfd, which gets polled by one
+ * thread at a time, as the socket is.
+ * The ring lives as long as the connection: when that drops, or
+ * when a request on the ring times out, the ring is dropped and
+ * the next request attaches a new one, which replaces the old one
+ * on the server side too. Requests go through the socket while
+ * that happens, or for good if attaching fails.
+ */
+static struct rqbalance_halext_ring *ps_ring = NULL;
+static int ps_ring_reqfd = -1;
+static int ps_ring_donefd = -1;
+static bool ps_ring_wanted = false;
+static bool ps_ring_lost = false;
+static bool ps_ring_polling = false;
+static pthread_rwlock_t ps_ring_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void powerserver_once_init(void)
 {
-	register int sock, recvsock;
-	int ret, len = sizeof(struct sockaddr_un);
-	int32_t halext_reply;
-	fd_set receivefd;
+	pthread_condattr_t attr;
+
+	/* Timeouts are computed on CLOCK_MONOTONIC */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ps_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/*
+ * deadline_ms - Get the time left until a deadline
+ *
+ * \param deadline - Absolute CLOCK_MONOTONIC timeout
+ * \return Returns milliseconds left, zero if already past
+ */
+static int deadline_ms(const struct timespec *deadline)
+{
+	struct timespec now;
+	int tmo;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	tmo = (deadline->tv_sec - now.tv_sec) * 1000 +
+	      (deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+	return tmo < 0 ? 0 : tmo;
+}
+
+/*
+ * powerserver_connect - Open the shared PowerServer connection
+ *
+ * The socket is non-blocking, as it always was: a PowerServer that
+ * is too busy to accept gets retried until the deadline only.
+ *
+ * Note: Has to be called with ps_lock held.
+ *
+ * \param deadline - Absolute CLOCK_MONOTONIC timeout
+ * \return Returns success (0) or negative errno.
+ */
+static int powerserver_connect(struct timespec *deadline)
+{
+	int ret, err, len = sizeof(struct sockaddr_un);
+	socklen_t errlen = sizeof(err);
 	struct sockaddr_un server_address;
-	struct timeval timeout;
+	struct pollfd pfd;
 
 	/* Get socket in the UNIX domain */
-	sock = socket(PF_UNIX, SOCK_SEQPACKET, 0);
-	if (sock < 0) {
+	ps_sock = socket(PF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC |
+			 SOCK_NONBLOCK, 0);
+	if (ps_sock < 0) {
 		ALOGE("Could not get the PowerServer from client");
 		return -EPROTO;
 	}
@@ -62,54 +209,625 @@ static int send_powerserver_data(struct rqbalance_halext_params params)
 	server_address.sun_family = AF_UNIX;
 	strcpy(server_address.sun_path, POWERSERVER_SOCKET);
 
-	/* Set nonblocking I/O for socket to avoid stall */
-	fcntl(sock, F_SETFL, O_NONBLOCK);
+	for (;;) {
+		ret = connect(ps_sock, (struct sockaddr*)&server_address, len);
+		if (ret == 0 || (errno != EAGAIN && errno != EINPROGRESS))
+			break;
+
+		if (errno == EINPROGRESS) {
+			pfd.fd = ps_sock;
+			pfd.events = POLLOUT;
+			ret = poll(&pfd, 1, deadline_ms(deadline));
+			if (ret == 0) {
+				errno = ETIMEDOUT;
+				ret = -1;
+			} else if (ret > 0) {
+				err = 0;
+				getsockopt(ps_sock, SOL_SOCKET, SO_ERROR,
+					   &err, &errlen);
+				errno = err;
+				ret = err ? -1 : 0;
+			}
+			break;
+		}
+
+		/* Listen backlog full: retry until the deadline */
+		if (deadline_ms(deadline) == 0) {
+			errno = ETIMEDOUT;
+			break;
+		}
+		usleep(POWERSERVER_CONNECT_RETRY_US);
+	}
 
-	ret = connect(sock, (struct sockaddr*)&server_address, len);
 	if (ret < 0) {
-		ALOGE("Cannot connect to PowerServer socket");
-		goto end;
+		ALOGE("Cannot connect to PowerServer socket: %d", errno);
+		ret = (errno == ETIMEDOUT) ? -ETIMEDOUT : -ECONNREFUSED;
+		close(ps_sock);
+		ps_sock = -1;
+		return ret;
+	}
+
+	ps_sock_gen++;
+
+	return 0;
+}
+
+/*
+ * powerserver_send - Send a message on the shared connection
+ *
+ * Waits for room in the socket buffer until the deadline only, so
+ * that a stalled PowerServer cannot block the callers forever.
+ *
+ * Note: Has to be called with ps_lock held.
+ *
+ * \param msg - Message to send
+ * \param len - Length of the message
+ * \param deadline - Absolute CLOCK_MONOTONIC timeout
+ * \return Returns success (0) or -1 with errno set.
+ */
+static int powerserver_send(void *msg, size_t len, struct timespec *deadline)
+{
+	struct pollfd pfd;
+	int ret;
+
+	for (;;) {
+		ret = send(ps_sock, msg, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret >= 0)
+			return 0;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return -1;
+
+		pfd.fd = ps_sock;
+		pfd.events = POLLOUT;
+		ret = poll(&pfd, 1, deadline_ms(deadline));
+		if (ret == 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if (ret < 0 && errno != EINTR)
+			return -1;
+	}
+}
+
+/*
+ * powerserver_disconnect - Drop the shared PowerServer connection
+ *                          and fail all the requests in flight
+ *
+ * Note: Has to be called with ps_lock held.
+ *
+ * \param err - Error to report to the waiters (negative errno)
+ */
+static void powerserver_disconnect(int err)
+{
+	struct ps_waiter *w;
+
+	if (ps_sock >= 0) {
+		close(ps_sock);
+		ps_sock = -1;
+	}
+
+	/* The server drops the ring together with the connection */
+	__atomic_store_n(&ps_ring_lost, true, __ATOMIC_RELEASE);
+
+	for (w = ps_waiters; w != NULL; w = w->next) {
+		if (!w->done) {
+			w->error = err;
+			w->done = true;
+		}
+	}
+
+	pthread_cond_broadcast(&ps_cond);
+}
+
+/*
+ * powerserver_receive - Read one reply and hand it to its waiter
+ *
+ * Note: Has to be called with ps_lock held, it gets dropped
+ *       while waiting for data on the socket.
+ *
+ * \param deadline - Absolute CLOCK_MONOTONIC timeout
+ * \return Returns success (0) or negative errno.
+ */
+static int powerserver_receive(struct timespec *deadline)
+{
+	struct rqbalance_halext_reply reply;
+	char cbuf[CMSG_SPACE(HALEXT_SHM_FDS * sizeof(int))];
+	struct iovec iov = { .iov_base = &reply, .iov_len = sizeof(reply) };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct ps_waiter *w;
+	struct pollfd pfd;
+	size_t hdrsz = sizeof(struct rqbalance_halext_hdr);
+	int sock = ps_sock, tmo, ret, i, nfds = 0;
+	uint32_t gen = ps_sock_gen;
+	int fds[HALEXT_SHM_FDS];
+
+	tmo = deadline_ms(deadline);
+
+	ps_receiving = true;
+	pthread_mutex_unlock(&ps_lock);
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	ret = poll(&pfd, 1, tmo);
+	if (ret > 0) {
+		ret = recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+		for (cmsg = ret < 0 ? NULL : CMSG_FIRSTHDR(&msg); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET ||
+			    cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			if (nfds > HALEXT_SHM_FDS)
+				nfds = HALEXT_SHM_FDS;
+			memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+		}
+
+		if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+			ret = -EAGAIN;
+		else if (ret < (int)hdrsz ||
+			 reply.hdr.magic != HALEXT_MSG_MAGIC ||
+			 reply.hdr.count > HALEXT_MAX_BATCH ||
+			 ret != (int)(hdrsz + reply.hdr.count * sizeof(int32_t)))
+			ret = -EPIPE;
+	} else if (ret == 0) {
+		ret = -ETIMEDOUT;
+	} else {
+		ret = (errno == EINTR) ? -EAGAIN : -EPIPE;
+	}
+
+	pthread_mutex_lock(&ps_lock);
+	ps_receiving = false;
+
+	if (ret == -EPIPE) {
+		ALOGE("Cannot receive reply from PowerServer");
+		for (i = 0; i < nfds; i++)
+			close(fds[i]);
+
+		/*
+		 * Somebody else may have dropped the connection we were
+		 * reading from and opened a new one meanwhile, maybe with
+		 * the same descriptor number: leave that one alone.
+		 */
+		if (gen == ps_sock_gen)
+			powerserver_disconnect(-EPIPE);
+		else
+			pthread_cond_broadcast(&ps_cond);
+		return ret;
+	}
+
+	if (ret >= 0) {
+		for (w = ps_waiters; w != NULL; w = w->next) {
+			if (w->reqid != reply.hdr.reqid)
+				continue;
+
+			if (w->fds != NULL && nfds == HALEXT_SHM_FDS) {
+				memcpy(w->fds, fds, sizeof(fds));
+				nfds = 0;
+			}
+
+			/* A short reply means the request was refused */
+			for (i = 0; i < w->count; i++) {
+				if (i < reply.hdr.count)
+					w->replies[i] = reply.reply[i];
+				else
+					w->replies[i] = reply.reply[0];
+			}
+			w->error = 0;
+			w->done = true;
+			break;
+		}
+		ret = 0;
+	}
+
+	/* Nobody is waiting for these */
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+
+	pthread_cond_broadcast(&ps_cond);
+
+	return ret;
+}
+
+/*
+ * powerserver_transact - Send a message to the PowerServer on the
+ *                        shared connection and wait for its reply
+ *
+ * \param msg - Message to send. The header gets filled in here.
+ * \param len - Length of the message
+ * \param replies - Array receiving the PowerServer replies
+ * \param count - Number of expected replies
+ * \param fds - Array receiving HALEXT_SHM_FDS passed descriptors,
+ *              NULL if none are expected
+ * \return Returns success (0) or negative errno.
+ */
+static int powerserver_transact(struct rqbalance_halext_batch_msg *msg,
+				size_t len, int32_t *replies, int count,
+				int *fds)
+{
+	struct ps_waiter w, **pw;
+	struct timespec deadline;
+	bool retried = false;
+	int ret;
+
+	/* Connecting, sending and waiting for the reply all count */
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += POWERSERVER_TIMEOUT_MS / 1000;
+
+	pthread_once(&ps_once, powerserver_once_init);
+	pthread_mutex_lock(&ps_lock);
+
+	w.reqid = ps_next_reqid++;
+	if (!w.reqid)
+		w.reqid = ps_next_reqid++;
+	w.replies = replies;
+	w.count = count;
+	w.fds = fds;
+	w.error = -EINVAL;
+	w.done = false;
+
+	msg->hdr.magic = HALEXT_MSG_MAGIC;
+	msg->hdr.reqid = w.reqid;
+
+resend:
+	if (ps_sock < 0) {
+		ret = powerserver_connect(&deadline);
+		if (ret < 0)
+			goto end;
 	}
 
 	/* Send the filled struct */
-	ret = send(sock, &params, sizeof(struct rqbalance_halext_params), 0);
+	ret = powerserver_send(msg, len, &deadline);
 	if (ret < 0) {
-		ALOGE("Cannot send data to PowerServer");
+		/* The PowerServer may have been restarted: reconnect once */
+		if (!retried && (errno == EPIPE || errno == ECONNRESET ||
+				 errno == ENOTCONN)) {
+			retried = true;
+			powerserver_disconnect(-EPIPE);
+			goto resend;
+		}
+		ALOGE("Cannot send data to PowerServer: %d", errno);
+		ret = (errno == ETIMEDOUT) ? -ETIMEDOUT : -EPROTO;
 		goto end;
 	}
 
-	/* Setup for receiving server reply (handle) */
-	/* Initialize and set a new FD for receive operation */
-	FD_ZERO(&receivefd);
-	FD_SET(sock, &receivefd);
+	w.next = ps_waiters;
+	ps_waiters = &w;
 
-	/* Set a one second timeout for select operation */
-	timeout.tv_sec = 1;
-	timeout.tv_usec = 0;
+	while (!w.done) {
+		if (ps_receiving) {
+			/* Somebody else is reading: wait for a hand-off */
+			ret = pthread_cond_timedwait(&ps_cond, &ps_lock,
+						     &deadline);
+		} else {
+			ret = powerserver_receive(&deadline);
+		}
 
-	/* Wait until the socket is ready for receive operation */
-	ret = select(sock+1, &receivefd, NULL, NULL, &timeout);
-	if (ret < 0) {
-		ALOGE("Socket error. Cannot continue.");
-		if (ret == -1) {
+		if (ret == ETIMEDOUT || ret == -ETIMEDOUT) {
+			if (w.done)
+				break;
 			ALOGE("Socket not ready: timed out");
-			ret = -ETIMEDOUT;
+			w.error = -ETIMEDOUT;
+			break;
 		}
-		goto end;
 	}
+	ret = w.error;
 
-	/* New FD is set and the socket is ready to receive data */
-	ret = recv(sock, &halext_reply, sizeof(int32_t), 0);
-	if (ret == -1) {
-		ALOGE("Cannot receive reply from PowerServer");
-		ret = halext_reply = -EINVAL;
-	} else ret = halext_reply;
+	for (pw = &ps_waiters; *pw != NULL; pw = &(*pw)->next) {
+		if (*pw == &w) {
+			*pw = w.next;
+			break;
+		}
+	}
 end:
-	if (sock)
-		close(sock);
+	pthread_mutex_unlock(&ps_lock);
 	return ret;
 }
 
+/*
+ * ring_unmap - Drop the shared memory ring, if any
+ *
+ * Note: Has to be called with ps_ring_lock held for writing.
+ */
+static void ring_unmap(void)
+{
+	if (ps_ring != NULL) {
+		munmap(ps_ring, sizeof(*ps_ring));
+		close(ps_ring_reqfd);
+		close(ps_ring_donefd);
+		ps_ring = NULL;
+		ps_ring_reqfd = ps_ring_donefd = -1;
+	}
+}
+
+/*
+ * ring_attach - Ask the PowerServer for a shared memory ring
+ *
+ * The PowerServer replaces the ring of the connection, if it
+ * still has one for us.
+ *
+ * Note: Has to be called with ps_ring_lock held for writing.
+ *
+ * \return Returns success (0) or negative errno.
+ */
+static int ring_attach(void)
+{
+	struct rqbalance_halext_batch_msg msg;
+	struct rqbalance_halext_ring *ring;
+	int fds[HALEXT_SHM_FDS] = { -1, -1, -1 };
+	int32_t reply;
+	void *mem;
+	int i, ret;
+
+	memset(&msg.hdr, 0, sizeof(msg.hdr));
+	msg.hdr.op = HALEXT_OP_SHM_ATTACH;
+
+	ret = powerserver_transact(&msg, sizeof(msg.hdr), &reply, 1, fds);
+	if (ret == 0 && reply < 0)
+		ret = reply;
+	if (ret == 0 && fds[0] < 0)
+		ret = -EPROTO;
+	if (ret < 0)
+		goto err;
+
+	mem = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fds[0], 0);
+	close(fds[0]);
+	fds[0] = -1;
+	if (mem == MAP_FAILED) {
+		ret = -errno;
+		goto err;
+	}
+
+	ring = mem;
+	if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != HALEXT_SHM_MAGIC ||
+	    ring->num_slots != HALEXT_SHM_SLOTS) {
+		munmap(mem, sizeof(*ring));
+		ret = -EPROTO;
+		goto err;
+	}
+
+	ps_ring = ring;
+	ps_ring_reqfd = fds[1];
+	ps_ring_donefd = fds[2];
+
+	return 0;
+
+err:
+	for (i = 0; i < HALEXT_SHM_FDS; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+	if (ret < 0)
+		ALOGE("Cannot attach shared memory ring: %d", ret);
+	return ret;
+}
+
+/*
+ * ring_reattach - Replace a ring that got lost
+ *
+ * The check, the detach and the attach all happen under the
+ * write lock: only the first of the threads finding the ring lost
+ * replaces it, the others find the new one.
+ */
+static void ring_reattach(void)
+{
+	pthread_rwlock_wrlock(&ps_ring_lock);
+
+	if (__atomic_load_n(&ps_ring_lost, __ATOMIC_ACQUIRE)) {
+		ring_unmap();
+
+		/* Cleared first: a disconnection from now on counts */
+		__atomic_store_n(&ps_ring_lost, false, __ATOMIC_RELEASE);
+
+		/* Only once: if it fails, stick to the socket */
+		if (__atomic_load_n(&ps_ring_wanted, __ATOMIC_ACQUIRE) &&
+		    ring_attach() < 0)
+			__atomic_store_n(&ps_ring_wanted, false,
+					 __ATOMIC_RELEASE);
+	}
+
+	pthread_rwlock_unlock(&ps_ring_lock);
+}
+
+/*
+ * ring_wait - Wait for the completion of a ring slot
+ *
+ * \param slot - Ring slot holding our request
+ * \param deadline - Absolute CLOCK_MONOTONIC timeout
+ * \return Returns success (0) or negative errno.
+ */
+static int ring_wait(struct rqbalance_halext_slot *slot,
+		     struct timespec *deadline)
+{
+	struct pollfd pfd;
+	uint64_t count;
+	int tmo, ret = 0;
+
+	pthread_mutex_lock(&ps_lock);
+
+	while (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) !=
+	       HALEXT_SLOT_DONE) {
+		if (ps_ring_polling) {
+			/* Somebody else is polling: wait for a hand-off */
+			if (pthread_cond_timedwait(&ps_cond, &ps_lock,
+						   deadline) == ETIMEDOUT)
+				ret = -ETIMEDOUT;
+			else
+				continue;
+		} else {
+			tmo = deadline_ms(deadline);
+
+			ps_ring_polling = true;
+			pthread_mutex_unlock(&ps_lock);
+
+			pfd.fd = ps_ring_donefd;
+			pfd.events = POLLIN;
+			ret = poll(&pfd, 1, tmo);
+			if (ret > 0 && read(pfd.fd, &count, sizeof(count)) < 0)
+				ret = 1;
+
+			pthread_mutex_lock(&ps_lock);
+			ps_ring_polling = false;
+			pthread_cond_broadcast(&ps_cond);
+
+			if (ret != 0) {
+				ret = 0;
+				continue;
+			}
+			ret = -ETIMEDOUT;
+		}
+
+		if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) ==
+		    HALEXT_SLOT_DONE)
+			ret = 0;
+		break;
+	}
+
+	pthread_mutex_unlock(&ps_lock);
+
+	return ret;
+}
+
+/*
+ * ring_transact - Run a lock request through the shared memory ring
+ *
+ * \param params - Request parameters
+ * \param reply - Receives the PowerServer reply
+ * \return Returns true if the request went through the ring, false
+ *         if it has to go through the socket instead
+ */
+static bool ring_transact(struct rqbalance_halext_params *params,
+			  int32_t *reply)
+{
+	struct rqbalance_halext_slot *slot = NULL;
+	struct timespec deadline;
+	uint32_t state;
+	uint64_t one = 1;
+	int i;
+
+	if (__atomic_load_n(&ps_ring_lost, __ATOMIC_ACQUIRE))
+		ring_reattach();
+
+	/* The ring is being replaced: don't wait, use the socket */
+	if (pthread_rwlock_tryrdlock(&ps_ring_lock) != 0)
+		return false;
+	if (ps_ring == NULL)
+		goto fallback;
+
+	for (i = 0; i < HALEXT_SHM_SLOTS && slot == NULL; i++) {
+		state = HALEXT_SLOT_FREE;
+		if (__atomic_compare_exchange_n(&ps_ring->slots[i].state,
+						&state, HALEXT_SLOT_BUSY, false,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			slot = &ps_ring->slots[i];
+	}
+
+	/* All the slots are in flight */
+	if (slot == NULL)
+		goto fallback;
+
+	memcpy(&slot->params, params, sizeof(*params));
+	__atomic_store_n(&slot->state, HALEXT_SLOT_REQUEST, __ATOMIC_RELEASE);
+
+	if (write(ps_ring_reqfd, &one, sizeof(one)) != sizeof(one)) {
+		state = HALEXT_SLOT_REQUEST;
+		if (__atomic_compare_exchange_n(&slot->state, &state,
+						HALEXT_SLOT_FREE, false,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+			goto fallback;
+	}
+
+	for (i = 0; i < POWERSERVER_SHM_SPIN; i++) {
+		if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) ==
+		    HALEXT_SLOT_DONE)
+			goto done;
+		sched_yield();
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += POWERSERVER_TIMEOUT_MS / 1000;
+
+	if (ring_wait(slot, &deadline) < 0) {
+		ALOGE("Ring not ready: timed out");
+
+		/* Take the request back, unless it is being run */
+		state = HALEXT_SLOT_REQUEST;
+		__atomic_compare_exchange_n(&slot->state, &state,
+					    HALEXT_SLOT_FREE, false,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+		/* The server is gone or stuck: drop the ring */
+		__atomic_store_n(&ps_ring_lost, true, __ATOMIC_RELEASE);
+		pthread_rwlock_unlock(&ps_ring_lock);
+
+		*reply = -ETIMEDOUT;
+		return true;
+	}
+
+done:
+	*reply = slot->reply;
+	__atomic_store_n(&slot->state, HALEXT_SLOT_FREE, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&ps_ring_lock);
+	return true;
+
+fallback:
+	pthread_rwlock_unlock(&ps_ring_lock);
+	return false;
+}
+
+static int send_powerserver_data(struct rqbalance_halext_params params)
+{
+	struct rqbalance_halext_batch_msg msg;
+	int32_t halext_reply;
+	int ret;
+
+	if (ring_transact(&params, &halext_reply))
+		return halext_reply;
+
+	memset(&msg.hdr, 0, sizeof(msg.hdr));
+	msg.hdr.op = HALEXT_OP_PERF_LOCK;
+	msg.hdr.count = 1;
+	msg.params[0] = params;
+
+	ret = powerserver_transact(&msg, sizeof(msg.hdr) + sizeof(params),
+				   &halext_reply, 1, NULL);
+	if (ret < 0)
+		return ret;
+
+	return halext_reply;
+}
+
+/*
+ * send_powerserver_batch - Send a set of lock requests in one message
+ *
+ * \param msg - Batch message with count requests filled in
+ * \param count - Number of requests
+ * \param replies - Array receiving one reply per request
+ * \return Returns success (0) or negative errno.
+ */
+static int send_powerserver_batch(struct rqbalance_halext_batch_msg *msg,
+				  int count, int32_t *replies)
+{
+	memset(&msg->hdr, 0, sizeof(msg->hdr));
+	msg->hdr.op = HALEXT_OP_PERF_LOCK_BATCH;
+	msg->hdr.count = count;
+
+	return powerserver_transact(msg, sizeof(msg->hdr) +
+			(count * sizeof(struct rqbalance_halext_params)),
+			replies, count, NULL);
+}
+
 /*
  * perf_lock_acq - Sends an extended type power hint to the RQBalance
  *                 based PowerHAL to acquire performance lock.
@@ -119,19 +837,22 @@ end:
 int perf_lock_acq(int id, int time, int argument[], int arraysz)
 {
 	struct rqbalance_halext_params params;
-	uint32_t i;
+	int i;
 
+	if (arraysz < 0)
+		return -EINVAL;
+	if (arraysz > MAX_ARGUMENTS) {
+		ALOGE("Maximum number of arguments exceeded!!");
+		arraysz = MAX_ARGUMENTS;
+	}
+
+	memset(&params, 0, sizeof(params));
 	params.acquire = 1;
 	params.id = id;
 	params.time = time;
 	params.arraysz = arraysz;
 
-	if (MAX_ARGUMENTS < arraysz) {
-		ALOGE("Maximum number of arguments exceeded!!");
-		params.arraysz = MAX_ARGUMENTS;
-	}
-
-	for (i = 0; i <= params.arraysz; i++)
+	for (i = 0; argument && i < arraysz; i++)
 		params.argument[i] = argument[i];
 
 	return send_powerserver_data(params);
@@ -147,8 +868,121 @@ int perf_lock_rel(int id)
 {
 	struct rqbalance_halext_params params;
 
+	memset(&params, 0, sizeof(params));
 	params.acquire = 0;
 	params.id = id;
 
 	return send_powerserver_data(params);
 }
+
+/*
+ * perf_lock_acq_batch - Acquires a set of performance locks with a
+ *                       single request to the RQBalance based PowerHAL.
+ *
+ * \param reqs - Array of lock requests, each with arraysz arguments
+ * \param count - Number of requests (max HALEXT_MAX_BATCH)
+ * \param handles - Array receiving one handle (or negative errno)
+ *                  per request, in the same order
+ * \return Returns success (0) or negative errno.
+ */
+int perf_lock_acq_batch(struct perf_lock_request reqs[], int count,
+			int handles[])
+{
+	struct rqbalance_halext_batch_msg msg;
+	int32_t replies[HALEXT_MAX_BATCH];
+	int i, j, arraysz, ret;
+
+	if (count <= 0 || count > HALEXT_MAX_BATCH)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		arraysz = reqs[i].arraysz;
+		if (arraysz < 0)
+			return -EINVAL;
+		if (arraysz > MAX_ARGUMENTS) {
+			ALOGE("Maximum number of arguments exceeded!!");
+			arraysz = MAX_ARGUMENTS;
+		}
+
+		memset(&msg.params[i], 0, sizeof(msg.params[i]));
+		msg.params[i].acquire = 1;
+		msg.params[i].id = reqs[i].id;
+		msg.params[i].time = reqs[i].time;
+		msg.params[i].arraysz = arraysz;
+		for (j = 0; reqs[i].argument && j < arraysz; j++)
+			msg.params[i].argument[j] = reqs[i].argument[j];
+	}
+
+	ret = send_powerserver_batch(&msg, count, replies);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < count; i++)
+		handles[i] = replies[i];
+
+	return 0;
+}
+
+/*
+ * perf_lock_rel_batch - Releases a set of performance locks with a
+ *                       single request to the RQBalance based PowerHAL.
+ *
+ * \param handles - Array of lock handles
+ * \param count - Number of handles (max HALEXT_MAX_BATCH)
+ * \return Returns success (0) or the first negative errno.
+ */
+int perf_lock_rel_batch(int handles[], int count)
+{
+	struct rqbalance_halext_batch_msg msg;
+	int32_t replies[HALEXT_MAX_BATCH];
+	int i, ret;
+
+	if (count <= 0 || count > HALEXT_MAX_BATCH)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		memset(&msg.params[i], 0, sizeof(msg.params[i]));
+		msg.params[i].acquire = 0;
+		msg.params[i].id = handles[i];
+	}
+
+	ret = send_powerserver_batch(&msg, count, replies);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < count; i++) {
+		if (replies[i] < 0)
+			return replies[i];
+	}
+
+	return 0;
+}
+
+/*
+ * perf_lock_shm_attach - Makes perf_lock_acq() and perf_lock_rel()
+ *                        go through a ring shared with the RQBalance
+ *                        based PowerHAL instead of its socket.
+ *
+ * Only for trusted system processes, hinting on every frame.
+ * Batches keep going through the socket.
+ *
+ * \return Returns success (0) or negative errno.
+ */
+int perf_lock_shm_attach(void)
+{
+	int ret = 0;
+
+	pthread_rwlock_wrlock(&ps_ring_lock);
+
+	if (ps_ring == NULL ||
+	    __atomic_load_n(&ps_ring_lost, __ATOMIC_ACQUIRE)) {
+		ring_unmap();
+		__atomic_store_n(&ps_ring_lost, false, __ATOMIC_RELEASE);
+		ret = ring_attach();
+	}
+	__atomic_store_n(&ps_ring_wanted, ret == 0, __ATOMIC_RELEASE);
+
+	pthread_rwlock_unlock(&ps_ring_lock);
+
+	return ret;
+}
@@ -28,7 +28,12 @@ endif
 
 LOCAL_C_INCLUDES := external/expat/lib
 
-LOCAL_SRC_FILES := power.c rqbalance_halext.c expatparser.c
+LOCAL_SRC_FILES := power.c rqbalance_halext.c expatparser.c sysfs_cache.c \
+                   powerserver.c arbiter.c timerwheel.c profile_cache.c \
+                   profiles.c cpu_topology.c boost.c cluster_ctl.c \
+                   launch_predict.c interaction.c metrics.c \
+                   intent_queue.c thermal.c sysfs_journal.c \
+                   halext_shm.c
 LOCAL_SHARED_LIBRARIES := liblog libcutils
 LOCAL_STATIC_LIBRARIES := libexpat_static
 LOCAL_MODULE := power.$(LOCAL_TARGET_DEVICE)
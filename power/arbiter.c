@@ -0,0 +1,635 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RQBalance-PowerHAL-Arbiter"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/Log.h>
+
+#include "power.h"
+#include "profiles.h"
+#include "arbiter.h"
+#include "cpu_topology.h"
+
+/*
+ * The arbiter keeps track of every profile that is currently
+ * requested: the base mode, coming from the Android power hints,
+ * plus one vote for each active performance lock.
+ * Releasing a lock only removes its vote, so that the profile of
+ * any other lock that is still held doesn't get dropped, and the
+ * effective profile is always resolved out of all the requests.
+ *
+ * Votes can be pinned to some clusters only: those don't take part
+ * in resolving the parameters that are global to the whole SoC, and
+ * every cluster gets its own winner out of the unpinned votes plus
+ * the ones pinned to that cluster.
+ *
+ * Whatever gets resolved, the thermal budget comes last and clamps
+ * it: performance requests never fight the thermal mitigation.
+ *
+ * While the screen is off the arbiter is suspended: only the base
+ * mode counts, requests are kept but take effect on resume only.
+ */
+
+#define MAX_THRESHOLDS		16
+
+static arbiter_policy_t policy = ARBITER_PRIORITY;
+static int base_mode = POWER_MODE_BALANCED;
+static int votes[MAX_PROFILES];
+static int cluster_votes[MAX_PROFILES][TOPOLOGY_MAX_CLUSTERS];
+static int cpus_floor = 0;
+static unsigned int freq_floor = 0;
+static int boost_level = 0;
+static struct rqb_thermal_level thermal;	/* All zero: no clamp */
+static bool suspended = false;
+
+/*
+ * arbiter_set_policy - Select the profile resolution policy
+ *
+ * \param newpolicy - Policy (from enum arbiter_policy_t)
+ */
+void arbiter_set_policy(arbiter_policy_t newpolicy)
+{
+	policy = newpolicy;
+}
+
+/*
+ * arbiter_set_base - Set the mode requested by the Android power hints
+ *
+ * \param mode - Profile index
+ */
+void arbiter_set_base(int mode)
+{
+	if (mode >= 0 && mode < MAX_PROFILES)
+		base_mode = mode;
+}
+
+/*
+ * update_vote - Add or remove one vote
+ *
+ * \param vote - Vote counter
+ * \param mode - Profile index, for logging
+ * \param enable - true: add request, false: remove request
+ */
+static void update_vote(int *vote, int mode, bool enable)
+{
+	if (enable) {
+		(*vote)++;
+	} else if (*vote > 0) {
+		(*vote)--;
+	} else {
+		ALOGE("WTF: Unbalanced vote removal for mode %d", mode);
+	}
+}
+
+/*
+ * arbiter_vote - Add or remove a request for a profile
+ *
+ * \param mode - Profile index
+ * \param clusters - Bitmask of the clusters the request is pinned
+ *                   to, 0 for a request on the whole SoC
+ * \param enable - true: add request, false: remove request
+ */
+void arbiter_vote(int mode, unsigned int clusters, bool enable)
+{
+	int i;
+
+	if (mode < 0 || mode >= MAX_PROFILES)
+		return;
+
+	if (!clusters) {
+		update_vote(&votes[mode], mode, enable);
+		return;
+	}
+
+	for (i = 0; i < TOPOLOGY_MAX_CLUSTERS; i++) {
+		if (clusters & (1 << i))
+			update_vote(&cluster_votes[mode][i], mode, enable);
+	}
+}
+
+/*
+ * arbiter_set_cpus_floor - Set the minimum number of online cores,
+ *                          overriding any profile that asks for less
+ *
+ * \param ncpus - Minimum number of online cores, 0 for no floor
+ */
+void arbiter_set_cpus_floor(int ncpus)
+{
+	cpus_floor = ncpus > 0 ? ncpus : 0;
+}
+
+/*
+ * arbiter_set_freq_floor - Set the clusters that have to run at
+ *                          their maximum frequency
+ *
+ * \param clusters - Bitmask of the clusters, 0 for no floor
+ */
+void arbiter_set_freq_floor(unsigned int clusters)
+{
+	freq_floor = clusters;
+}
+
+/*
+ * apply_freq_floor - Raise the minimum frequency of the clusters
+ *                    in the frequency floor to their maximum one
+ *
+ * \param clusters - Effective per-cluster parameters
+ */
+static void apply_freq_floor(struct rqb_cluster_params *clusters)
+{
+	const struct cpu_cluster *cl;
+	int i;
+
+	for (i = 0; i < topology_num_clusters(); i++) {
+		cl = topology_cluster(i);
+		if (!(freq_floor & (1 << i)) || cl == NULL || !cl->max_freq)
+			continue;
+
+		clusters[i].min_freq = cl->max_freq;
+		if (clusters[i].max_freq && clusters[i].max_freq < cl->max_freq)
+			clusters[i].max_freq = cl->max_freq;
+	}
+}
+
+/*
+ * arbiter_set_boost_level - Set the interaction boost level
+ *
+ * \param level - Boost level, from 0 (no boost) to ARBITER_BOOST_LEVELS
+ */
+void arbiter_set_boost_level(int level)
+{
+	if (level < 0)
+		level = 0;
+	else if (level > ARBITER_BOOST_LEVELS)
+		level = ARBITER_BOOST_LEVELS;
+
+	boost_level = level;
+}
+
+/*
+ * arbiter_set_suspended - Suspend or resume the requests
+ *
+ * \param suspend - true: only the base mode counts, false: resume
+ */
+void arbiter_set_suspended(bool suspend)
+{
+	suspended = suspend;
+}
+
+/*
+ * arbiter_set_thermal - Set the thermal budget
+ *
+ * \param level - Thermal level to clamp to, NULL for no clamp
+ */
+void arbiter_set_thermal(const struct rqb_thermal_level *level)
+{
+	if (level)
+		memcpy(&thermal, level, sizeof(thermal));
+	else
+		memset(&thermal, 0, sizeof(thermal));
+}
+
+/*
+ * format_cpus - Write a core count value
+ *
+ * Core counts never go over TOPOLOGY_MAX_CPUS, which always fits
+ * the core count buffers of the profiles.
+ *
+ * \param dst - Value
+ * \param len - Size of the value buffer
+ * \param ncpus - Core count
+ */
+static void format_cpus(char *dst, size_t len, int ncpus)
+{
+	if (ncpus < 0)
+		ncpus = 0;
+	if (ncpus > TOPOLOGY_MAX_CPUS)
+		ncpus = TOPOLOGY_MAX_CPUS;
+
+	if (snprintf(dst, len, "%d", ncpus) >= (int)len)
+		ALOGE("Core count %d doesn't fit", ncpus);
+}
+
+/*
+ * clamp_cpus - Clamp a core count value
+ *
+ * \param dst - Value
+ * \param len - Size of the value buffer
+ * \param max - Maximum
+ */
+static void clamp_cpus(char *dst, size_t len, unsigned int max)
+{
+	if (atoi(dst) > (int)max)
+		format_cpus(dst, len, max);
+}
+
+/*
+ * apply_thermal - Clamp the effective parameters to the thermal budget
+ *
+ * \param out - Effective parameters
+ * \param clusters - Effective per-cluster parameters
+ */
+static void apply_thermal(struct rqbalance_params *out,
+			  struct rqb_cluster_params *clusters)
+{
+	struct rqb_cluster_params *cl;
+	uint32_t max;
+	int i;
+
+	if (thermal.max_cpus) {
+		/* No limit at all is over any limit */
+		if (!atoi(out->max_cpus))
+			format_cpus(out->max_cpus, sizeof(out->max_cpus),
+				    thermal.max_cpus);
+		else
+			clamp_cpus(out->max_cpus, sizeof(out->max_cpus),
+				   thermal.max_cpus);
+		clamp_cpus(out->min_cpus, sizeof(out->min_cpus),
+			   thermal.max_cpus);
+	}
+
+	for (i = 0; i < TOPOLOGY_MAX_CLUSTERS; i++) {
+		max = thermal.max_freq[i];
+		if (!max)
+			continue;
+
+		cl = &clusters[i];
+		if (!cl->max_freq || cl->max_freq > max)
+			cl->max_freq = max;
+		if (cl->min_freq > max)
+			cl->min_freq = max;
+	}
+}
+
+/*
+ * apply_cpus_floor - Raise the core counts to the online cores floor
+ *
+ * \param out - Effective parameters
+ */
+static void apply_cpus_floor(struct rqbalance_params *out)
+{
+	if (!cpus_floor)
+		return;
+
+	if (atoi(out->min_cpus) < cpus_floor)
+		format_cpus(out->min_cpus, sizeof(out->min_cpus), cpus_floor);
+	if (atoi(out->max_cpus) && atoi(out->max_cpus) < cpus_floor)
+		format_cpus(out->max_cpus, sizeof(out->max_cpus), cpus_floor);
+}
+
+/*
+ * is_requested - Check if a profile is currently requested
+ *
+ * \param mode - Profile index
+ * \return Returns true if requested by base or by any lock
+ */
+static bool is_requested(int mode)
+{
+	return (mode == base_mode) || (votes[mode] > 0);
+}
+
+/*
+ * is_requested_on - Check if a profile is currently requested
+ *                   on a cluster
+ *
+ * \param mode - Profile index
+ * \param cluster - Cluster index
+ * \return Returns true if requested globally or pinned to cluster
+ */
+static bool is_requested_on(int mode, int cluster)
+{
+	return is_requested(mode) || (cluster_votes[mode][cluster] > 0);
+}
+
+/*
+ * merge_thresholds - Merge two thresholds lists, element by element,
+ *                    keeping the lowest (most performant) value
+ *
+ * \param dst - Destination list, also first input
+ * \param src - Second input list
+ * \param len - Size of the destination buffer
+ */
+static void merge_thresholds(char *dst, const char *src, size_t len)
+{
+	long a[MAX_THRESHOLDS], b[MAX_THRESHOLDS];
+	int na = 0, nb = 0, i, n;
+	const char *p;
+	char *end;
+	size_t off = 0;
+
+	for (p = dst; na < MAX_THRESHOLDS; p = end) {
+		a[na] = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		na++;
+	}
+
+	for (p = src; nb < MAX_THRESHOLDS; p = end) {
+		b[nb] = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		nb++;
+	}
+
+	n = (na > nb) ? na : nb;
+	for (i = 0; i < n && off < len; i++) {
+		if (i >= na)
+			a[i] = b[i];
+		else if (i < nb && b[i] < a[i])
+			a[i] = b[i];
+
+		off += snprintf(dst + off, len - off, "%s%ld",
+				i ? " " : "", a[i]);
+	}
+}
+
+/*
+ * merge_cpus - Merge two core count values keeping the highest one
+ *
+ * \param dst - Destination value, also first input
+ * \param src - Second input value
+ */
+static void merge_cpus(char *dst, const char *src)
+{
+	if (atoi(src) > atoi(dst))
+		strcpy(dst, src);
+}
+
+/*
+ * merge_max_cpus - Merge two core count limits keeping the highest
+ *                  one, zero (or unset) meaning "no limit"
+ *
+ * \param dst - Destination value, also first input
+ * \param src - Second input value
+ */
+static void merge_max_cpus(char *dst, const char *src)
+{
+	if (atoi(dst) == 0)
+		return;
+
+	if (atoi(src) == 0 || atoi(src) > atoi(dst))
+		strcpy(dst, src);
+}
+
+/*
+ * blend_value - Move a value towards a more performant one
+ *
+ * Only ever moves in the direction of more performance: if the
+ * target is not more performant, the value is kept as-is.
+ *
+ * \param val - Current value
+ * \param target - Target value, at full boost level
+ * \param higher - true if higher values are more performant
+ * \return Returns the value for the current boost level
+ */
+static long blend_value(long val, long target, bool higher)
+{
+	long delta = target - val;
+
+	if ((higher && delta <= 0) || (!higher && delta >= 0))
+		return val;
+
+	/* Round away from val: any boost level changes something */
+	if (delta > 0)
+		delta = (delta * boost_level + ARBITER_BOOST_LEVELS - 1) /
+			ARBITER_BOOST_LEVELS;
+	else
+		delta = -((-delta * boost_level + ARBITER_BOOST_LEVELS - 1) /
+			  ARBITER_BOOST_LEVELS);
+
+	return val + delta;
+}
+
+/*
+ * blend_thresholds - Move a thresholds list towards a lower one,
+ *                    element by element
+ *
+ * \param dst - Destination list, also first input
+ * \param src - Target list, at full boost level
+ * \param len - Size of the destination buffer
+ */
+static void blend_thresholds(char *dst, const char *src, size_t len)
+{
+	long a[MAX_THRESHOLDS], b[MAX_THRESHOLDS];
+	int na = 0, nb = 0, i;
+	const char *p;
+	char *end;
+	size_t off = 0;
+
+	for (p = dst; na < MAX_THRESHOLDS; p = end) {
+		a[na] = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		na++;
+	}
+
+	for (p = src; nb < MAX_THRESHOLDS; p = end) {
+		b[nb] = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		nb++;
+	}
+
+	for (i = 0; i < na && off < len; i++) {
+		if (i < nb)
+			a[i] = blend_value(a[i], b[i], false);
+
+		off += snprintf(dst + off, len - off, "%s%ld",
+				i ? " " : "", a[i]);
+	}
+}
+
+/*
+ * blend_cpus - Move a core count towards a higher one
+ *
+ * \param dst - Destination value, also first input
+ * \param src - Target value, at full boost level
+ * \param len - Size of the destination buffer
+ */
+static void blend_cpus(char *dst, const char *src, size_t len)
+{
+	snprintf(dst, len, "%ld", blend_value(atol(dst), atol(src), true));
+}
+
+/*
+ * apply_boost - Move the effective parameters towards the interaction
+ *               boost profile, proportionally to the boost level
+ *
+ * \param conf - Configuration, holding all the profiles
+ * \param out - Effective parameters
+ */
+static void apply_boost(struct rqb_config *conf, struct rqbalance_params *out)
+{
+	struct rqbalance_params *target;
+	int i;
+
+	if (!boost_level)
+		return;
+
+	/* Configurations without a boost profile boost to performance */
+	for (i = 0; i < conf->num_profiles; i++) {
+		if (strcmp(conf->profiles[i].name, ARBITER_BOOST_PROFILE) == 0)
+			break;
+	}
+	if (i == conf->num_profiles)
+		i = POWER_MODE_PERFORMANCE;
+
+	target = &conf->profiles[i].params;
+
+	blend_cpus(out->min_cpus, target->min_cpus, sizeof(out->min_cpus));
+	blend_thresholds(out->up_thresholds, target->up_thresholds,
+			 sizeof(out->up_thresholds));
+	blend_thresholds(out->down_thresholds, target->down_thresholds,
+			 sizeof(out->down_thresholds));
+
+	/* Never ask for less than the minimum, unless there's no limit */
+	if (atoi(out->max_cpus))
+		merge_cpus(out->max_cpus, out->min_cpus);
+}
+
+/*
+ * merge_value - Merge two per-cluster values keeping the highest
+ *               one, zero meaning "untouched"
+ *
+ * \param dst - Destination value, also first input
+ * \param src - Second input value
+ */
+static void merge_value(uint32_t *dst, uint32_t src)
+{
+	if (src > *dst)
+		*dst = src;
+}
+
+/*
+ * merge_max_value - Merge two per-cluster limits keeping the highest
+ *                   one: zero leaves the limit untouched, which is
+ *                   no limit at all, so it always wins
+ *
+ * \param dst - Destination value, also first input
+ * \param src - Second input value
+ */
+static void merge_max_value(uint32_t *dst, uint32_t src)
+{
+	if (*dst && (!src || src > *dst))
+		*dst = src;
+}
+
+/*
+ * resolve_cluster - Resolve the effective parameters of a cluster
+ *
+ * \param conf - Configuration, holding all the profiles
+ * \param cluster - Cluster index
+ * \param winner - Profile dominating the whole SoC
+ * \param out - Effective cluster parameters
+ */
+static void resolve_cluster(struct rqb_config *conf, int cluster, int winner,
+			    struct rqb_cluster_params *out)
+{
+	struct rqb_profile *prof = conf->profiles;
+	struct rqb_cluster_params *src;
+	int i;
+
+	for (i = 0; i < conf->num_profiles; i++) {
+		if (cluster_votes[i][cluster] > 0 &&
+		    prof[i].priority > prof[winner].priority)
+			winner = i;
+	}
+
+	memcpy(out, &prof[winner].clusters[cluster], sizeof(*out));
+
+	if (policy != ARBITER_MERGE)
+		return;
+
+	for (i = 0; i < conf->num_profiles; i++) {
+		if (i == winner || !is_requested_on(i, cluster))
+			continue;
+
+		src = &prof[i].clusters[cluster];
+		merge_value(&out->min_cpus, src->min_cpus);
+		merge_max_value(&out->max_cpus, src->max_cpus);
+		merge_value(&out->min_freq, src->min_freq);
+		merge_max_value(&out->max_freq, src->max_freq);
+	}
+}
+
+/*
+ * arbiter_resolve - Resolve the effective profile
+ *
+ * \param conf - Configuration, holding all the profiles
+ * \param out - Effective parameters to apply
+ * \param clusters - Effective per-cluster parameters to apply,
+ *                   TOPOLOGY_MAX_CLUSTERS entries
+ * \return Returns the dominating profile index
+ */
+int arbiter_resolve(struct rqb_config *conf, struct rqbalance_params *out,
+		    struct rqb_cluster_params *clusters)
+{
+	struct rqb_profile *prof = conf->profiles;
+	int winner = base_mode;
+	int i;
+
+	if (winner >= conf->num_profiles)
+		winner = POWER_MODE_BALANCED;
+
+	/* Suspended: the base mode only, with no boost nor floor */
+	if (suspended) {
+		memcpy(out, &prof[winner].params,
+		       sizeof(struct rqbalance_params));
+		memcpy(clusters, prof[winner].clusters,
+		       sizeof(prof[winner].clusters));
+		goto suspended;
+	}
+
+	for (i = 0; i < conf->num_profiles; i++) {
+		if (is_requested(i) && prof[i].priority > prof[winner].priority)
+			winner = i;
+	}
+
+	memcpy(out, &prof[winner].params, sizeof(struct rqbalance_params));
+
+	if (policy != ARBITER_MERGE)
+		goto end;
+
+	for (i = 0; i < conf->num_profiles; i++) {
+		if (i == winner || !is_requested(i))
+			continue;
+
+		merge_cpus(out->min_cpus, prof[i].params.min_cpus);
+		merge_max_cpus(out->max_cpus, prof[i].params.max_cpus);
+		merge_thresholds(out->up_thresholds,
+				 prof[i].params.up_thresholds,
+				 sizeof(out->up_thresholds));
+		merge_thresholds(out->down_thresholds,
+				 prof[i].params.down_thresholds,
+				 sizeof(out->down_thresholds));
+	}
+
+end:
+	for (i = 0; i < TOPOLOGY_MAX_CLUSTERS; i++)
+		resolve_cluster(conf, i, winner, &clusters[i]);
+
+	apply_boost(conf, out);
+	apply_cpus_floor(out);
+	apply_freq_floor(clusters);
+suspended:
+	apply_thermal(out, clusters);
+	return winner;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ARBITER_H__
+#define __ARBITER_H__
+
+#include <stdbool.h>
+
+#include "power.h"
+#include "profiles.h"
+#include "cluster_ctl.h"
+
+/*
+ * enum arbiter_policy_t
+ * How to resolve the effective profile out of the requested ones
+ *
+ * ARBITER_PRIORITY: The requested profile with the highest priority
+ *                   wins and gets applied as-is.
+ * ARBITER_MERGE:    Every parameter is merged across all of the
+ *                   requested profiles, always picking the most
+ *                   performant value.
+ */
+typedef enum {
+	ARBITER_PRIORITY,
+	ARBITER_MERGE,
+} arbiter_policy_t;
+
+/*
+ * Interaction boost: every level moves the core counts and the
+ * thresholds one step closer to the boost profile, or to the
+ * performance one if the configuration doesn't define it.
+ */
+#define ARBITER_BOOST_LEVELS	3
+#define ARBITER_BOOST_PROFILE	"interaction"
+
+/* Exported functions */
+void arbiter_set_policy(arbiter_policy_t policy);
+void arbiter_set_base(int mode);
+void arbiter_vote(int mode, unsigned int clusters, bool enable);
+void arbiter_set_cpus_floor(int ncpus);
+void arbiter_set_freq_floor(unsigned int clusters);
+void arbiter_set_boost_level(int level);
+void arbiter_set_thermal(const struct rqb_thermal_level *level);
+void arbiter_set_suspended(bool suspend);
+int arbiter_resolve(struct rqb_config *conf, struct rqbalance_params *out,
+		    struct rqb_cluster_params *clusters);
+
+#endif
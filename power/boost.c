@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RQBalance-PowerHAL-Boost"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utils/Log.h>
+
+#include "power.h"
+#include "boost.h"
+#include "cpu_topology.h"
+#include "sysfs_cache.h"
+#include "rqbalance_halext.h"
+
+/*
+ * Performance lock arguments (LOCKPARAM) are resources that get
+ * held for as long as the lock is held: every resource is
+ * reference counted, the first holder saves the current value of
+ * the node and the last one writes it back exactly as it was.
+ *
+ * The online cores and frequency floors don't touch sysfs directly,
+ * as the same nodes are owned by the power profiles: they get
+ * resolved together with them instead.
+ */
+
+#define FREQ_STR_MAX		16
+
+static int freq_floor_refs[TOPOLOGY_MAX_CLUSTERS];
+static unsigned int freq_floor_mask = 0;
+
+static int collapse_refs = 0;
+static int collapse_node = -1;
+static char collapse_saved[FREQ_STR_MAX];
+static bool collapse_suspended = false;
+
+static int cpus_floor_votes[TOPOLOGY_MAX_CPUS + 1];
+
+/*
+ * boost_init - Discover the CPU topology and prepare the nodes
+ *
+ * \return Returns success (0) or failure (negative errno)
+ */
+int boost_init(void)
+{
+	int ret;
+
+	ret = topology_init();
+	if (ret < 0) {
+		ALOGE("Cannot discover CPU topology: %d", ret);
+		return ret;
+	}
+
+	collapse_node = sysfs_cache_add(SYS_LPM_SLEEP_DISABLED, true);
+
+	return 0;
+}
+
+/*
+ * boost_is_arg - Check if a lock argument is a resource request
+ *
+ * \param arg - Lock argument
+ * \return Returns true for a LOCKPARAM resource
+ */
+bool boost_is_arg(int arg)
+{
+	switch (arg) {
+		case ALL_CPUS_PWR_CLPS_DIS:
+		case CPU0_MIN_FREQ_TURBO_MAX:
+		case CPU4_MIN_FREQ_TURBO_MAX:
+		case ALL_CORES_ONLINE:
+			return true;
+		default:
+			break;
+	}
+
+	return (arg & ~0xff) == MINCORES;
+}
+
+/*
+ * boost_parse_arg - Add the resource requested by a lock argument
+ *
+ * \param set - Set of resources
+ * \param arg - Lock argument
+ * \return Returns success (0) or failure (negative errno)
+ */
+int boost_parse_arg(struct boost_set *set, int arg)
+{
+	int cluster, ncpus;
+
+	switch (arg) {
+		case ALL_CPUS_PWR_CLPS_DIS:
+			set->no_collapse = true;
+			return 0;
+		case CPU0_MIN_FREQ_TURBO_MAX:
+		case CPU4_MIN_FREQ_TURBO_MAX:
+			cluster = topology_cluster_of_cpu(
+					arg == CPU0_MIN_FREQ_TURBO_MAX ? 0 : 4);
+			if (cluster < 0) {
+				ALOGD("No cluster for parameter 0x%x", arg);
+				return -ENODEV;
+			}
+			set->freq_clusters |= (1 << cluster);
+			return 0;
+		case ALL_CORES_ONLINE:
+			ncpus = topology_num_cpus();
+			break;
+		default:
+			if ((arg & ~0xff) != MINCORES) {
+				ALOGD("Parameter not implemented: 0x%x", arg);
+				return -EINVAL;
+			}
+			ncpus = arg & 0xff;
+			break;
+	}
+
+	if (ncpus > topology_num_cpus())
+		ncpus = topology_num_cpus();
+	if (ncpus > set->min_cpus)
+		set->min_cpus = ncpus;
+
+	return 0;
+}
+
+/*
+ * boost_merge - Add all the resources of a set to another one
+ *
+ * \param dst - Destination set
+ * \param src - Set to add
+ */
+void boost_merge(struct boost_set *dst, const struct boost_set *src)
+{
+	dst->freq_clusters |= src->freq_clusters;
+	dst->no_collapse |= src->no_collapse;
+	if (src->min_cpus > dst->min_cpus)
+		dst->min_cpus = src->min_cpus;
+}
+
+/*
+ * save_node - Save the current value of a node
+ *
+ * \param node - Cached node
+ * \param buf - Buffer receiving the value
+ * \return Returns success (true) or failure (false)
+ */
+static bool save_node(int node, char *buf)
+{
+	return node >= 0 && sysfs_cache_read(node, buf, FREQ_STR_MAX) > 0;
+}
+
+/*
+ * freq_floor_set - Raise or restore the minimum frequency of a cluster
+ *
+ * \param idx - Cluster index
+ * \param enable - true: raise to max, false: restore
+ */
+static void freq_floor_set(int idx, bool enable)
+{
+	if (enable) {
+		if (freq_floor_refs[idx]++ > 0)
+			return;
+		freq_floor_mask |= (1 << idx);
+	} else {
+		if (freq_floor_refs[idx] == 0 || --freq_floor_refs[idx] > 0)
+			return;
+		freq_floor_mask &= ~(1 << idx);
+	}
+
+	lock_freq_floor(freq_floor_mask);
+}
+
+/*
+ * collapse_set - Disable or restore CPU power collapse
+ *
+ * \param enable - true: disable power collapse, false: restore
+ */
+static void collapse_set(bool enable)
+{
+	if (enable) {
+		if (collapse_refs++ > 0)
+			return;
+
+		if (!save_node(collapse_node, collapse_saved))
+			snprintf(collapse_saved, sizeof(collapse_saved), "N");
+
+		/* Taking effect on resume */
+		if (!collapse_suspended)
+			sysfs_cache_write(collapse_node, "Y");
+	} else {
+		if (collapse_refs == 0 || --collapse_refs > 0)
+			return;
+
+		if (!collapse_suspended)
+			sysfs_cache_write(collapse_node, collapse_saved);
+	}
+}
+
+/*
+ * boost_set_suspended - Drop or restore the boosts on screen changes
+ *
+ * Power collapse doesn't go through the arbiter: it has to be
+ * allowed again by hand while the screen is off, as the locks
+ * disabling it are kept until resume.
+ *
+ * \param suspend - true: screen off, false: screen on
+ */
+void boost_set_suspended(bool suspend)
+{
+	if (suspend == collapse_suspended)
+		return;
+
+	collapse_suspended = suspend;
+	if (collapse_refs > 0)
+		sysfs_cache_write(collapse_node, suspend ? collapse_saved : "Y");
+}
+
+/*
+ * cpus_floor_set - Add or remove a vote for an online cores floor
+ *
+ * \param ncpus - Minimum number of online cores
+ * \param enable - true: add vote, false: remove vote
+ */
+static void cpus_floor_set(int ncpus, bool enable)
+{
+	int floor;
+
+	if (ncpus <= 0 || ncpus > TOPOLOGY_MAX_CPUS)
+		return;
+
+	if (enable)
+		cpus_floor_votes[ncpus]++;
+	else if (cpus_floor_votes[ncpus] > 0)
+		cpus_floor_votes[ncpus]--;
+
+	for (floor = TOPOLOGY_MAX_CPUS; floor > 0; floor--) {
+		if (cpus_floor_votes[floor] > 0)
+			break;
+	}
+
+	lock_cpus_floor(floor);
+}
+
+/*
+ * boost_apply - Acquire or release a set of resources
+ *
+ * \param set - Set of resources
+ * \param enable - true: acquire, false: release
+ */
+void boost_apply(const struct boost_set *set, bool enable)
+{
+	int i;
+
+	for (i = 0; i < topology_num_clusters(); i++) {
+		if (set->freq_clusters & (1 << i))
+			freq_floor_set(i, enable);
+	}
+
+	if (set->no_collapse)
+		collapse_set(enable);
+
+	if (set->min_cpus)
+		cpus_floor_set(set->min_cpus, enable);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BOOST_H__
+#define __BOOST_H__
+
+#include <stdbool.h>
+
+#define SYS_LPM_SLEEP_DISABLED	"/sys/module/lpm_levels/parameters/sleep_disabled"
+
+/*
+ * struct boost_set
+ * Set of resources held by one performance lock
+ */
+struct boost_set {
+	unsigned int freq_clusters;	/* Clusters at max minimum freq */
+	int min_cpus;			/* Online CPUs floor, 0 for none */
+	bool no_collapse;		/* Power collapse disabled */
+};
+
+/* Exported functions */
+int boost_init(void);
+bool boost_is_arg(int arg);
+int boost_parse_arg(struct boost_set *set, int arg);
+void boost_merge(struct boost_set *dst, const struct boost_set *src);
+void boost_apply(const struct boost_set *set, bool enable);
+void boost_set_suspended(bool suspend);
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RQBalance-PowerHAL-Cluster"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <utils/Log.h>
+
+#include "cluster_ctl.h"
+#include "sysfs_cache.h"
+
+/*
+ * Every per-cluster parameter is backed by one node per CPU of
+ * the cluster (cpufreq nodes disappear with offline CPUs, while
+ * the policy is shared by the whole cluster), or by the core_ctl
+ * node of the first CPU of the cluster.
+ *
+ * cpufreq nodes of offline CPUs are left alone rather than failing
+ * to open them on every write.
+ *
+ * The first time that a parameter gets changed, its original
+ * value is saved: when no profile asks for it anymore, it gets
+ * written back exactly as it was.
+ */
+
+#define CLUSTER_STR_MAX		16
+
+typedef enum {
+	CLUSTER_PARAM_MIN_CPUS,
+	CLUSTER_PARAM_MAX_CPUS,
+	CLUSTER_PARAM_MIN_FREQ,
+	CLUSTER_PARAM_MAX_FREQ,
+	/* Do not use this entry */
+	CLUSTER_PARAM_MAX,
+} cluster_param_t;
+
+struct cluster_param {
+	int nodes[TOPOLOGY_MAX_CPUS];
+	unsigned int cpumasks[TOPOLOGY_MAX_CPUS];	/* 0: always there */
+	int num_nodes;
+	bool saved_valid;
+	char saved[CLUSTER_STR_MAX];
+};
+
+static const char *param_nodes[CLUSTER_PARAM_MAX] = {
+	[CLUSTER_PARAM_MIN_CPUS]	= "core_ctl/min_cpus",
+	[CLUSTER_PARAM_MAX_CPUS]	= "core_ctl/max_cpus",
+	[CLUSTER_PARAM_MIN_FREQ]	= "cpufreq/scaling_min_freq",
+	[CLUSTER_PARAM_MAX_FREQ]	= "cpufreq/scaling_max_freq",
+};
+
+static struct cluster_param params[TOPOLOGY_MAX_CLUSTERS][CLUSTER_PARAM_MAX];
+
+/*
+ * cluster_ctl_init - Prepare the nodes of every cluster
+ *
+ * \return Returns success (0) or failure (negative errno)
+ */
+int cluster_ctl_init(void)
+{
+	const struct cpu_cluster *cl;
+	struct cluster_param *cp;
+	char path[80];
+	int i, p, cpu, ret;
+
+	for (i = 0; i < topology_num_clusters(); i++) {
+		cl = topology_cluster(i);
+
+		for (p = 0; p < CLUSTER_PARAM_MAX; p++) {
+			cp = &params[i][p];
+
+			for (cpu = 0; cpu < topology_num_cpus(); cpu++) {
+				if (!(cl->cpumask & (1 << cpu)))
+					continue;
+
+				snprintf(path, sizeof(path),
+					 SYS_CPU_PATH "cpu%d/%s",
+					 cpu, param_nodes[p]);
+				ret = sysfs_cache_add(path, true);
+				if (ret < 0)
+					return ret;
+				cp->nodes[cp->num_nodes] = ret;
+
+				/* core_ctl is per-cluster */
+				if (p <= CLUSTER_PARAM_MAX_CPUS) {
+					cp->num_nodes++;
+					break;
+				}
+				cp->cpumasks[cp->num_nodes++] = 1 << cpu;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * node_present - Check if a node of a parameter exists
+ *
+ * \param cp - Cluster parameter
+ * \param i - Node index
+ * \param online - Mask of the online CPUs, read on first use if 0
+ * \return Returns true if the node can be accessed
+ */
+static bool node_present(struct cluster_param *cp, int i,
+			 unsigned int *online)
+{
+	if (!cp->cpumasks[i])
+		return true;
+
+	if (!*online)
+		*online = topology_online_cpus();
+
+	return cp->cpumasks[i] & *online;
+}
+
+/*
+ * param_write - Write a value to all the nodes of a parameter
+ *
+ * \param cp - Cluster parameter
+ * \param s - String to write
+ * \param online - Mask of the online CPUs, read on first use if 0
+ * \return Returns number of skipped (unchanged) writes
+ */
+static int param_write(struct cluster_param *cp, char *s,
+		       unsigned int *online)
+{
+	int i, ret, written = 0, skipped = 0;
+
+	for (i = 0; i < cp->num_nodes; i++) {
+		if (!node_present(cp, i, online))
+			continue;
+
+		ret = sysfs_cache_update(cp->nodes[i], s);
+		if (ret == 0)
+			skipped++;
+		if (ret >= 0)
+			written++;
+	}
+
+	if (!written)
+		ALOGD("Cannot write %s to any cluster node", s);
+
+	return skipped;
+}
+
+/*
+ * param_set - Set a parameter, or restore it when value is zero
+ *
+ * \param cp - Cluster parameter
+ * \param value - Value to set, 0 to restore
+ * \param online - Mask of the online CPUs, read on first use if 0
+ * \return Returns number of skipped (unchanged) writes
+ */
+static int param_set(struct cluster_param *cp, uint32_t value,
+		     unsigned int *online)
+{
+	char buf[CLUSTER_STR_MAX];
+	int i;
+
+	if (value == 0) {
+		if (!cp->saved_valid)
+			return 0;
+
+		cp->saved_valid = false;
+		return param_write(cp, cp->saved, online);
+	}
+
+	/* Any online CPU of the cluster holds the current value */
+	for (i = 0; !cp->saved_valid && i < cp->num_nodes; i++) {
+		if (node_present(cp, i, online) &&
+		    sysfs_cache_read(cp->nodes[i], cp->saved,
+				     sizeof(cp->saved)) > 0)
+			cp->saved_valid = true;
+	}
+
+	snprintf(buf, sizeof(buf), "%u", value);
+	return param_write(cp, buf, online);
+}
+
+/*
+ * cluster_ctl_apply - Write the per-cluster parameters
+ *
+ * The frequency range gets written in an order that never makes
+ * the minimum exceed the maximum: maximum first when the minimum
+ * goes up, minimum first otherwise.
+ *
+ * \param clusters - Parameters of each cluster
+ * \return Returns number of skipped (unchanged) writes
+ */
+int cluster_ctl_apply(struct rqb_cluster_params *clusters)
+{
+	static uint32_t last_min_freq[TOPOLOGY_MAX_CLUSTERS];
+	struct cluster_param *cp;
+	struct rqb_cluster_params *cl;
+	unsigned int online = 0;
+	int i, skipped = 0;
+
+	for (i = 0; i < topology_num_clusters(); i++) {
+		cp = params[i];
+		cl = &clusters[i];
+
+		skipped += param_set(&cp[CLUSTER_PARAM_MAX_CPUS], cl->max_cpus,
+				     &online);
+		skipped += param_set(&cp[CLUSTER_PARAM_MIN_CPUS], cl->min_cpus,
+				     &online);
+
+		if (cl->min_freq > last_min_freq[i]) {
+			skipped += param_set(&cp[CLUSTER_PARAM_MAX_FREQ],
+					     cl->max_freq, &online);
+			skipped += param_set(&cp[CLUSTER_PARAM_MIN_FREQ],
+					     cl->min_freq, &online);
+		} else {
+			skipped += param_set(&cp[CLUSTER_PARAM_MIN_FREQ],
+					     cl->min_freq, &online);
+			skipped += param_set(&cp[CLUSTER_PARAM_MAX_FREQ],
+					     cl->max_freq, &online);
+		}
+
+		last_min_freq[i] = cl->min_freq;
+	}
+
+	return skipped;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CLUSTER_CTL_H__
+#define __CLUSTER_CTL_H__
+
+#include <stdint.h>
+
+#include "cpu_topology.h"
+
+/*
+ * struct rqb_cluster_params
+ * Per-cluster parameters of a power profile
+ *
+ * A zero value leaves the parameter untouched: it keeps (or gets
+ * back to) the value it had before the PowerHAL changed it.
+ * Online cores limits need the core_ctl driver.
+ */
+struct rqb_cluster_params {
+	uint32_t min_cpus;
+	uint32_t max_cpus;
+	uint32_t min_freq;	/* KHz */
+	uint32_t max_freq;	/* KHz */
+};
+
+/* Exported functions */
+int cluster_ctl_init(void);
+int cluster_ctl_apply(struct rqb_cluster_params *clusters);
+
+#endif
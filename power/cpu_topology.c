@@ -0,0 +1,383 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RQBalance-PowerHAL-Topology"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <utils/Log.h>
+
+#include "cpu_topology.h"
+#include "sysfs_cache.h"
+
+/*
+ * CPU clusters get discovered once, at init, from the frequency
+ * domains: offline CPUs have no topology nor cpufreq nodes, but
+ * the related_cpus of any online CPU of a cluster lists all of the
+ * CPUs of that cluster, offline ones included, which is typical
+ * on cpuquiet and RQBalance devices at HAL init.
+ * CPUs that no frequency domain lists (kernels without cpufreq,
+ * or whole clusters offline) fall back to their physical package,
+ * a CPU whose package cannot be read being assumed to belong to
+ * the same cluster of the previous one.
+ */
+
+static struct cpu_cluster clusters[TOPOLOGY_MAX_CLUSTERS];
+static int cpu_cluster[TOPOLOGY_MAX_CPUS];
+static int num_clusters = 0;
+static int num_cpus = 0;
+static int online_node = -1;
+
+ssize_t sysfs_read(const char *path, char *s, int num_bytes)
+{
+    char buf[80], rpath[SYSFS_PATH_MAX];
+    ssize_t count;
+    int fd = open(sysfs_path(path, rpath, sizeof(rpath)), O_RDONLY);
+    if (fd < 0) {
+        strerror_r(errno, buf, sizeof(buf));
+        ALOGE("Error reading from %s: %s\n", path, buf);
+        return -1;
+    }
+    if ((count = read(fd, s, (num_bytes - 1))) < 0) {
+        strerror_r(errno, buf, sizeof(buf));
+        ALOGE("Error reading from  %s: %s\n", path, buf);
+    } else {
+        if ((count >= 1) && (s[count-1] == '\n')) {
+            s[count-1] = '\0';
+        } else {
+            s[count] = '\0';
+        }
+    }
+    close(fd);
+    ALOGV("read '%s' from %s", s, path);
+    return count;
+}
+
+/*
+ * read_cpu_value - Read an integer out of a per-CPU sysfs node
+ *
+ * \param cpu - CPU number
+ * \param node - Node path, relative to the CPU directory
+ * \return Returns the value or failure (negative errno)
+ */
+static long read_cpu_value(int cpu, const char *node)
+{
+	char path[80], buf[16];
+
+	snprintf(path, sizeof(path), SYS_CPU_PATH "cpu%d/%s", cpu, node);
+	if (sysfs_read(path, buf, sizeof(buf)) <= 0)
+		return -ENOENT;
+
+	return strtol(buf, NULL, 10);
+}
+
+/*
+ * parse_cpu_list - Parse a list of CPUs
+ *
+ * Accepts the "0 1 2 3", the "0-3" and the "0-1,3" list formats.
+ *
+ * \param buf - CPU list
+ * \return Returns the mask of the CPUs
+ */
+static unsigned int parse_cpu_list(char *buf)
+{
+	char *p, *end;
+	unsigned int mask = 0;
+	long first, last;
+
+	for (p = buf; *p; p = end) {
+		first = strtol(p, &end, 10);
+		if (end == p) {
+			end = p + 1;
+			continue;
+		}
+
+		last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+
+		for (; first <= last; first++) {
+			if (first >= 0 && first < num_cpus)
+				mask |= (1 << first);
+		}
+	}
+
+	return mask;
+}
+
+/*
+ * read_related_cpus - Read the CPUs sharing the frequency domain
+ *                     of a CPU
+ *
+ * \param cpu - CPU number
+ * \return Returns the mask of the CPUs, or 0 if unknown
+ */
+static unsigned int read_related_cpus(int cpu)
+{
+	char path[80], buf[64];
+	unsigned int mask;
+
+	snprintf(path, sizeof(path), SYS_CPU_PATH "cpu%d/cpufreq/related_cpus",
+		 cpu);
+	if (sysfs_read(path, buf, sizeof(buf)) <= 0)
+		return 0;
+
+	mask = parse_cpu_list(buf);
+
+	/* A CPU is always in its own domain */
+	if (!(mask & (1 << cpu)))
+		return 0;
+
+	return mask;
+}
+
+/*
+ * get_possible_cores - Read configured cores from sysfs
+ *
+ * \return Returns number of cores or failure (negative errno)
+ */
+static int get_possible_cores(void)
+{
+	char buf[10];
+	int mincore, maxcore;
+
+	if (sysfs_read(SYS_CPUPOSS_PATH, buf, 10) < 0) {
+		ALOGE("Cannot get number of cores in the system!!!");
+		return -ENXIO;
+	}
+
+	switch (sscanf(buf, "%d-%d", &mincore, &maxcore)) {
+		case 1:
+			maxcore = mincore;
+			break;
+		case 2:
+			break;
+		default:
+			ALOGE("Error while scanning cores!!");
+			return -ENXIO;
+	}
+
+	return maxcore + 1;
+}
+
+/*
+ * add_cpus - Put CPUs in a cluster
+ *
+ * \param cl - Cluster
+ * \param idx - Cluster index
+ * \param mask - CPUs to add
+ */
+static void add_cpus(struct cpu_cluster *cl, int idx, unsigned int mask)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < num_cpus; cpu++) {
+		if (!(mask & (1 << cpu)))
+			continue;
+
+		cl->num_cpus++;
+		cl->cpumask |= (1 << cpu);
+		cpu_cluster[cpu] = idx;
+	}
+}
+
+/*
+ * read_freqs - Read the frequency range of a cluster, if unknown
+ *
+ * \param cl - Cluster
+ * \param cpu - Online CPU of the cluster
+ */
+static void read_freqs(struct cpu_cluster *cl, int cpu)
+{
+	long freq;
+
+	if (cl->max_freq != 0)
+		return;
+
+	freq = read_cpu_value(cpu, "cpufreq/cpuinfo_max_freq");
+	if (freq > 0)
+		cl->max_freq = freq;
+	freq = read_cpu_value(cpu, "cpufreq/cpuinfo_min_freq");
+	if (freq > 0)
+		cl->min_freq = freq;
+}
+
+/*
+ * topology_init - Discover the CPU clusters
+ *
+ * \return Returns number of clusters or failure (negative errno)
+ */
+int topology_init(void)
+{
+	struct cpu_cluster *cl;
+	long id, prev_id = 0;
+	unsigned int related, assigned = 0;
+	int cpu, i;
+
+	if (num_clusters > 0)
+		return num_clusters;
+
+	num_cpus = get_possible_cores();
+	if (num_cpus < 0)
+		return num_cpus;
+	if (num_cpus > TOPOLOGY_MAX_CPUS)
+		num_cpus = TOPOLOGY_MAX_CPUS;
+
+	/* Whole frequency domains first, offline CPUs included */
+	for (cpu = 0; cpu < num_cpus; cpu++) {
+		if (assigned & (1 << cpu))
+			continue;
+
+		related = read_related_cpus(cpu);
+		if (!related)
+			continue;
+
+		if (num_clusters == TOPOLOGY_MAX_CLUSTERS) {
+			i = num_clusters - 1;
+			related = 1 << cpu;
+		} else {
+			i = num_clusters++;
+		}
+
+		cl = &clusters[i];
+		if (cl->num_cpus == 0) {
+			id = read_cpu_value(cpu, "topology/physical_package_id");
+			cl->id = id < 0 ? i : id;
+			cl->first_cpu = cpu;
+		}
+
+		add_cpus(cl, i, related & ~assigned);
+		assigned |= related;
+		read_freqs(cl, cpu);
+	}
+
+	/* Then whatever no domain listed, by physical package */
+	for (cpu = 0; cpu < num_cpus; cpu++) {
+		if (assigned & (1 << cpu)) {
+			prev_id = clusters[cpu_cluster[cpu]].id;
+			continue;
+		}
+
+		id = read_cpu_value(cpu, "topology/physical_package_id");
+		if (id < 0)
+			id = prev_id;
+		prev_id = id;
+
+		for (i = 0; i < num_clusters; i++) {
+			if (clusters[i].id == id)
+				break;
+		}
+
+		if (i == num_clusters) {
+			if (num_clusters == TOPOLOGY_MAX_CLUSTERS)
+				i = num_clusters - 1;
+			else
+				num_clusters++;
+
+			cl = &clusters[i];
+			if (cl->num_cpus == 0) {
+				cl->id = id;
+				cl->first_cpu = cpu;
+			}
+		}
+
+		cl = &clusters[i];
+		add_cpus(cl, i, 1 << cpu);
+		assigned |= (1 << cpu);
+		read_freqs(cl, cpu);
+	}
+
+	for (i = 0; i < num_clusters; i++)
+		ALOGI("Cluster %d: CPUs 0x%x, %u-%u KHz", i,
+		      clusters[i].cpumask, clusters[i].min_freq,
+		      clusters[i].max_freq);
+
+	return num_clusters;
+}
+
+/*
+ * topology_num_cpus - Get the number of possible CPUs
+ *
+ * \return Returns number of CPUs
+ */
+int topology_num_cpus(void)
+{
+	return num_cpus;
+}
+
+/*
+ * topology_num_clusters - Get the number of CPU clusters
+ *
+ * \return Returns number of clusters
+ */
+int topology_num_clusters(void)
+{
+	return num_clusters;
+}
+
+/*
+ * topology_cluster - Get a CPU cluster
+ *
+ * \param idx - Cluster index
+ * \return Returns the cluster, or NULL if there is no such cluster
+ */
+const struct cpu_cluster *topology_cluster(int idx)
+{
+	if (idx < 0 || idx >= num_clusters)
+		return NULL;
+
+	return &clusters[idx];
+}
+
+/*
+ * topology_online_cpus - Get the CPUs that are currently online
+ *
+ * \return Returns the mask of the online CPUs, or of all of them
+ *         if unknown
+ */
+unsigned int topology_online_cpus(void)
+{
+	char buf[64];
+	unsigned int all = (1U << num_cpus) - 1, mask;
+
+	if (online_node < 0)
+		online_node = sysfs_cache_add(SYS_CPUONLINE_PATH, true);
+
+	if (sysfs_cache_read(online_node, buf, sizeof(buf)) <= 0)
+		return all;
+
+	mask = parse_cpu_list(buf);
+	return mask ? mask : all;
+}
+
+/*
+ * topology_cluster_of_cpu - Get the cluster of a CPU
+ *
+ * \param cpu - CPU number
+ * \return Returns cluster index or failure (negative errno)
+ */
+int topology_cluster_of_cpu(int cpu)
+{
+	if (cpu < 0 || cpu >= num_cpus)
+		return -ENODEV;
+
+	return cpu_cluster[cpu];
+}
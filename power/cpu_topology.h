@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CPU_TOPOLOGY_H__
+#define __CPU_TOPOLOGY_H__
+
+#include <sys/types.h>
+
+#define SYS_CPU_PATH		"/sys/devices/system/cpu/"
+#define SYS_CPUPOSS_PATH	SYS_CPU_PATH "possible"
+#define SYS_CPUONLINE_PATH	SYS_CPU_PATH "online"
+
+#define TOPOLOGY_MAX_CPUS	16
+#define TOPOLOGY_MAX_CLUSTERS	4
+
+/*
+ * struct cpu_cluster
+ * One cluster of CPUs sharing the same frequency domain
+ */
+struct cpu_cluster {
+	int id;				/* Physical package ID */
+	int first_cpu;
+	int num_cpus;
+	unsigned int cpumask;
+	unsigned int max_freq;		/* cpuinfo_max_freq, 0 if unknown */
+	unsigned int min_freq;		/* cpuinfo_min_freq, 0 if unknown */
+};
+
+/* Exported functions */
+int topology_init(void);
+int topology_num_cpus(void);
+int topology_num_clusters(void);
+const struct cpu_cluster *topology_cluster(int idx);
+int topology_cluster_of_cpu(int cpu);
+unsigned int topology_online_cpus(void);
+ssize_t sysfs_read(const char *path, char *s, int num_bytes);
+
+#endif
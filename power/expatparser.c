@@ -15,13 +15,16 @@
  */
 
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <expat.h>
 #include "power.h"
+#include "profiles.h"
 
 #include <cutils/properties.h>
 #include <utils/Log.h>
@@ -30,122 +33,427 @@
 
 #define LOG_TAG "RQBalance-PowerHAL-XML"
 
+/*
+ * All the profiles get parsed in one single pass: every element
+ * right under the root one selects which profile is being filled
+ * until the element gets closed, while <locktype> elements map
+ * lock types to profiles, which may be defined later in the file.
+ */
+#define MAX_LOCKTYPE_MAPS	64
+
+struct locktype_map {
+    int type;
+    unsigned int clusters;
+    char profile[PROFILE_NAME_MAX];
+};
+
 static short xml_depth = 0;
 static short parse = -1;
-static char* main_node;
+static int cur_profile = -1;
+static bool parse_thermal = false;
+static struct rqb_thermal_level *cur_level;
+static unsigned int found_profiles;
+static struct rqb_config *xml_conf;
+static struct locktype_map locktype_maps[MAX_LOCKTYPE_MAPS];
+static int num_locktype_maps;
 
-struct rqbalance_params trqb;
+static void copy_attr(char *dst, size_t len, const char *src)
+{
+    snprintf(dst, len, "%s", src);
+}
 
-void parseElm(const char *elm, const char **attr)
+void parseElm(struct rqbalance_params *trqb, const char *elm,
+              const char **attr)
 {
     int i;
 
     if (strcmp("cpuquiet", elm) == 0) {
         for (i = 0; attr[i]; i += 2) {
             if (strcmp("min_cpus", attr[i]) == 0)
-                strcpy(trqb.min_cpus, attr[i+1]);
+                copy_attr(trqb->min_cpus, sizeof(trqb->min_cpus),
+                          attr[i+1]);
             else if (strcmp("max_cpus", attr[i]) == 0)
-                strcpy(trqb.max_cpus, attr[i+1]);
+                copy_attr(trqb->max_cpus, sizeof(trqb->max_cpus),
+                          attr[i+1]);
         }
     } else if (strcmp("rqbalance", elm) == 0) {
         for (i = 0; attr[i]; i +=2) {
             if (strcmp("balance_level", attr[i]) == 0)
-                strcpy(trqb.balance_level, attr[i+1]);
+                copy_attr(trqb->balance_level,
+                          sizeof(trqb->balance_level), attr[i+1]);
             else if (strcmp("up_thresholds", attr[i]) == 0)
-                strcpy(trqb.up_thresholds, attr[i+1]);
+                copy_attr(trqb->up_thresholds,
+                          sizeof(trqb->up_thresholds), attr[i+1]);
             else if (strcmp("down_thresholds", attr[i]) == 0)
-                strcpy(trqb.down_thresholds, attr[i+1]);
+                copy_attr(trqb->down_thresholds,
+                          sizeof(trqb->down_thresholds), attr[i+1]);
         }
     }
+}
 
-end:
-    return;
+static const char *get_attr(const char **attr, const char *name)
+{
+    int i;
+
+    for (i = 0; attr[i]; i += 2) {
+        if (strcmp(name, attr[i]) == 0)
+            return attr[i+1];
+    }
+
+    return NULL;
+}
+
+/*
+ * parseClusterId - Parse a cluster identifier
+ *
+ * Clusters are numbered in CPU order, "little" and "big" being
+ * aliases for the first and the second one.
+ *
+ * \param id - Cluster identifier
+ * \return Returns cluster index or failure (negative errno)
+ */
+static int parseClusterId(const char *id)
+{
+    char *end;
+    long idx;
+
+    if (strcmp("little", id) == 0)
+        return 0;
+    if (strcmp("big", id) == 0)
+        return 1;
+
+    idx = strtol(id, &end, 0);
+    if (end == id || *end != '\0' ||
+        idx < 0 || idx >= TOPOLOGY_MAX_CLUSTERS)
+        return -EINVAL;
+
+    return idx;
+}
+
+/*
+ * parseClusterMask - Parse a list of clusters
+ *
+ * \param list - Comma separated cluster identifiers
+ * \return Returns clusters bitmask, 0 on failure
+ */
+static unsigned int parseClusterMask(const char *list)
+{
+    char buf[64], *tok, *save;
+    unsigned int mask = 0;
+    int idx;
+
+    copy_attr(buf, sizeof(buf), list);
+
+    for (tok = strtok_r(buf, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        idx = parseClusterId(tok);
+        if (idx < 0) {
+            ALOGE("Invalid cluster %s", tok);
+            return 0;
+        }
+        mask |= (1 << idx);
+    }
+
+    return mask;
+}
+
+void parseCluster(struct rqb_cluster_params *clusters, const char **attr)
+{
+    struct rqb_cluster_params *cl;
+    const char *id = get_attr(attr, "id");
+    int idx, i;
+
+    idx = id ? parseClusterId(id) : -EINVAL;
+    if (idx < 0) {
+        ALOGE("Invalid cluster definition");
+        return;
+    }
+
+    cl = &clusters[idx];
+    for (i = 0; attr[i]; i += 2) {
+        if (strcmp("min_cpus", attr[i]) == 0)
+            cl->min_cpus = strtoul(attr[i+1], NULL, 10);
+        else if (strcmp("max_cpus", attr[i]) == 0)
+            cl->max_cpus = strtoul(attr[i+1], NULL, 10);
+        else if (strcmp("min_freq", attr[i]) == 0)
+            cl->min_freq = strtoul(attr[i+1], NULL, 10);
+        else if (strcmp("max_freq", attr[i]) == 0)
+            cl->max_freq = strtoul(attr[i+1], NULL, 10);
+    }
+}
+
+void parseLocktype(const char **attr)
+{
+    struct locktype_map *map;
+    const char *id = get_attr(attr, "id");
+    const char *profile = get_attr(attr, "profile");
+    const char *cluster = get_attr(attr, "cluster");
+
+    if (!id || !profile) {
+        ALOGE("Incomplete locktype definition");
+        return;
+    }
+
+    if (num_locktype_maps >= MAX_LOCKTYPE_MAPS) {
+        ALOGE("Too many locktype definitions");
+        return;
+    }
+
+    map = &locktype_maps[num_locktype_maps++];
+    map->type = strtol(id, NULL, 0);
+    map->clusters = cluster ? parseClusterMask(cluster) : 0;
+    copy_attr(map->profile, sizeof(map->profile), profile);
+}
+
+void parseThermal(const char **attr)
+{
+    struct rqb_thermal *th = &xml_conf->thermal;
+    const char *val;
+
+    val = get_attr(attr, "zone");
+    if (!val) {
+        ALOGE("Thermal zone not specified, ignoring thermal budget");
+        return;
+    }
+    copy_attr(th->zone, sizeof(th->zone), val);
+
+    val = get_attr(attr, "poll_ms");
+    th->poll_ms = val ? strtoul(val, NULL, 10) : THERMAL_DEFAULT_POLL_MS;
+
+    val = get_attr(attr, "hysteresis");
+    th->hysteresis = val ? atoi(val) : THERMAL_DEFAULT_HYSTERESIS;
+
+    th->num_levels = 0;
+    parse_thermal = true;
+}
+
+void parseThermalLevel(const char *elm, const char **attr)
+{
+    struct rqb_thermal *th = &xml_conf->thermal;
+    struct rqb_cluster_params cl[TOPOLOGY_MAX_CLUSTERS];
+    const char *val;
+    int i;
+
+    if (xml_depth == 4 && cur_level && strcmp("cluster", elm) == 0) {
+        memset(cl, 0, sizeof(cl));
+        parseCluster(cl, attr);
+        for (i = 0; i < TOPOLOGY_MAX_CLUSTERS; i++) {
+            if (cl[i].max_freq)
+                cur_level->max_freq[i] = cl[i].max_freq;
+        }
+        return;
+    }
+
+    if (xml_depth != 3 || strcmp("level", elm) != 0)
+        return;
+
+    cur_level = NULL;
+
+    val = get_attr(attr, "temp");
+    if (!val) {
+        ALOGE("Thermal level without temperature, ignoring");
+        return;
+    }
+
+    if (th->num_levels >= THERMAL_MAX_LEVELS) {
+        ALOGE("Too many thermal levels");
+        return;
+    }
+
+    cur_level = &th->levels[th->num_levels++];
+    cur_level->temp = atoi(val);
+
+    val = get_attr(attr, "max_cpus");
+    if (val) {
+        cur_level->max_cpus = strtoul(val, NULL, 10);
+        if (cur_level->max_cpus > TOPOLOGY_MAX_CPUS) {
+            ALOGW("Thermal cores limit %s out of range, ignoring", val);
+            cur_level->max_cpus = 0;
+        }
+    }
+}
+
+void parseProfile(const char *elm, const char **attr)
+{
+    const char *name = elm;
+    const char *prio;
+
+    if (strcmp("profile", elm) == 0) {
+        name = get_attr(attr, "name");
+        if (!name) {
+            ALOGE("Unnamed profile, ignoring");
+            return;
+        }
+    }
+
+    cur_profile = profiles_add(xml_conf, name);
+    if (cur_profile < 0)
+        return;
+
+    parse = xml_depth;
+    found_profiles |= (1U << cur_profile);
+
+    prio = get_attr(attr, "priority");
+    if (prio)
+        xml_conf->profiles[cur_profile].priority = atoi(prio);
 }
 
 void startElm(void *data UNUSED, const char *elm, const char **attr)
 {
     xml_depth++;
 
-    if (strncmp(main_node, elm, strlen(main_node)) == 0)
-        parse = xml_depth;
+    if (xml_depth == 2) {
+        if (strcmp("locktype", elm) == 0)
+            parseLocktype(attr);
+        else if (strcmp("thermal", elm) == 0)
+            parseThermal(attr);
+        else
+            parseProfile(elm, attr);
+        return;
+    }
 
-    if (parse > 0)
-        parseElm(elm, attr);
+    if (parse_thermal) {
+        parseThermalLevel(elm, attr);
+        return;
+    }
+
+    if (parse <= 0)
+        return;
+
+    if (strcmp("cluster", elm) == 0)
+        parseCluster(xml_conf->profiles[cur_profile].clusters, attr);
+    else
+        parseElm(&xml_conf->profiles[cur_profile].params, elm, attr);
 }
 
 void endElm(void *data UNUSED, const char *elm UNUSED)
 {
-    if ((parse > 0) && (parse == xml_depth))
+    if (parse_thermal && xml_depth == 2) {
+        parse_thermal = false;
+        cur_level = NULL;
+    }
+
+    if ((parse > 0) && (parse == xml_depth)) {
         parse = -1;
+        cur_profile = -1;
+    }
 
     xml_depth--;
 }
 
-void str_handler(void *data, const char *str, int len)
+/*
+ * resolve_locktypes - Map the lock types to the profiles indexes
+ */
+static void resolve_locktypes(void)
 {
-    char *buf = malloc(len+1);
+    struct locktype_map *map;
+    int i, j;
 
-    strncpy(buf, str, len);
-    buf[len+1] = '\0';
+    for (i = 0; i < num_locktype_maps; i++) {
+        map = &locktype_maps[i];
+
+        for (j = 0; j < xml_conf->num_profiles; j++) {
+            if (strcmp(xml_conf->profiles[j].name, map->profile) == 0)
+                break;
+        }
+
+        if (j == xml_conf->num_profiles) {
+            ALOGE("Unknown profile %s for locktype 0x%x",
+                  map->profile, map->type);
+            continue;
+        }
 
-    data = (void*)buf;
+        if (map->type < 0 || map->type >= PROFILE_MAX_LOCKTYPES) {
+            ALOGE("Invalid locktype 0x%x", map->type);
+            continue;
+        }
+
+        xml_conf->locktype_profile[map->type] = j;
+        xml_conf->locktype_clusters[map->type] = map->clusters;
+    }
 }
 
-int parse_xml_data(char* filepath,
-            char* node, struct rqbalance_params *therqb)
+/*
+ * parse_xml_data - Parse all the profiles of the configuration
+ *
+ * \param filepath - Path to the XML configuration file
+ * \param conf - Configuration to fill, with the built-in profiles
+ * \param found - Bitmask receiving the profiles found in the file
+ * \return Returns success (0) or failure (negative errno)
+ */
+int parse_xml_data(char* filepath, struct rqb_config *conf,
+            unsigned int *found)
 {
-    int ret, fd, count, sz;
+    int ret, fd, sz;
+    ssize_t len;
     char *buf;
     struct stat st;
     XML_Parser pa;
 
-    fd = open(filepath, O_RDONLY);
+    fd = open(filepath, O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
         ALOGE("Cannot open configuration file!!!");
         return -ENOENT;
     }
 
-    pa = XML_ParserCreate(NULL);
-
-    stat(filepath, &st);
+    if (fstat(fd, &st) < 0) {
+        ret = -EIO;
+        goto secfail;
+    }
     sz = st.st_size;
 
     /* Security check: do NOT parse too big files */
     if (sz > 51200) {
         ALOGE("File is huge. Preventing parse as a security measure.");
-	ret = -E2BIG;
+        ret = -E2BIG;
         goto secfail;
     }
 
-    buf = malloc(sizeof(char)*sz);
+    buf = malloc(sz + 1);
+    if (buf == NULL) {
+        ret = -ENOMEM;
+        goto secfail;
+    }
 
-    memset(buf, 0, sz);
-    count = read(fd, buf, (sz - 1));
-    if (count < 0) {
+    len = read(fd, buf, sz);
+    if (len < 0) {
         ALOGE("Cannot read configuration file!!!");
         ret = -EIO;
         goto end;
     }
+    buf[len] = '\0';
+
+    pa = XML_ParserCreate(NULL);
+    if (pa == NULL) {
+        ret = -ENOMEM;
+        goto end;
+    }
 
     XML_SetElementHandler(pa, startElm, endElm);
-    XML_SetCharacterDataHandler(pa, str_handler);
 
-    main_node = node;
+    xml_depth = 0;
+    parse = -1;
+    cur_profile = -1;
+    parse_thermal = false;
+    cur_level = NULL;
+    found_profiles = 0;
+    xml_conf = conf;
+    num_locktype_maps = 0;
 
-    if (XML_Parse(pa, buf, strlen(buf), XML_TRUE) == XML_STATUS_ERROR) {
+    if (XML_Parse(pa, buf, len, XML_TRUE) == XML_STATUS_ERROR) {
         ALOGE("XML Parse error: %s\n", XML_ErrorString(XML_GetErrorCode(pa)));
-        return -EINVAL;
+        ret = -EINVAL;
+    } else {
+        resolve_locktypes();
+        *found = found_profiles;
+        ret = 0;
     }
-    ret = 0;
-
-    /* All ok, copy the struct */
-    memcpy(therqb, &trqb, sizeof(struct rqbalance_params));
 
+    XML_ParserFree(pa);
 end:
     free(buf);
 secfail:
     close(fd);
-    XML_ParserFree(pa);
 
     return ret;
 }
@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-PowerHAL-SHM"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <cutils/ashmem.h>
+#include <private/android_filesystem_config.h>
+#include <utils/Log.h>
+
+#include "power.h"
+#include "halext_shm.h"
+#include "rqbalance_halext.h"
+
+/*
+ * Shared memory rings for the performance lock requests of the
+ * trusted clients, which are the ones hinting on every frame.
+ *
+ * Each ring belongs to one client connection and goes away with
+ * it. The request doorbell is watched by the PowerServer loop:
+ * when it rings, every pending slot gets run in a single batch and
+ * the completion doorbell is rung once for all of them.
+ *
+ * Clients are trusted not to be hostile, not to be bug free:
+ * requests are copied out of the ring and checked as if they came
+ * from the socket, and slots are only ever moved out of the states
+ * owned by the server.
+ */
+
+struct halext_shm {
+	int client;		/* Client socket, -1 if unused */
+	int memfd;
+	int reqfd;		/* Request doorbell */
+	int donefd;		/* Completion doorbell */
+	struct rqbalance_halext_ring *ring;
+};
+
+static struct halext_shm rings[HALEXT_SHM_MAX_RINGS] = {
+	[0 ... HALEXT_SHM_MAX_RINGS - 1] = { -1, -1, -1, -1, NULL },
+};
+
+/*
+ * shm_trusted - Check if the peer of a connection may get a ring
+ *
+ * \param client - Client socket
+ * \return Returns true if the client runs as a trusted user
+ */
+static bool shm_trusted(int client)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return false;
+
+	switch (cred.uid) {
+		case AID_ROOT:
+		case AID_SYSTEM:
+		case AID_MEDIA:
+		case AID_MEDIA_CODEC:
+		case AID_CAMERASERVER:
+			return true;
+		default:
+			break;
+	}
+
+	ALOGW("Refusing shared memory ring to uid %u", cred.uid);
+	return false;
+}
+
+/*
+ * shm_release - Free all the resources of a ring
+ *
+ * \param shm - Ring
+ * \param epfd - PowerServer event loop
+ */
+static void shm_release(struct halext_shm *shm, int epfd)
+{
+	if (shm->reqfd >= 0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, shm->reqfd, NULL);
+		close(shm->reqfd);
+	}
+	if (shm->donefd >= 0)
+		close(shm->donefd);
+	if (shm->memfd >= 0)
+		close(shm->memfd);
+	if (shm->ring != NULL)
+		munmap(shm->ring, sizeof(*shm->ring));
+
+	shm->client = shm->memfd = shm->reqfd = shm->donefd = -1;
+	shm->ring = NULL;
+}
+
+/*
+ * halext_shm_attach - Create a ring for a client connection
+ *
+ * A client asking again gets a new ring, replacing the old one:
+ * that is how a client which gave up on a stuck ring gets back on
+ * the fast path without dropping its connection.
+ *
+ * \param client - Client socket
+ * \param epfd - PowerServer event loop
+ * \param fds - Returns the descriptors to pass to the client
+ * \return Returns success (0) or failure (negative errno)
+ */
+int halext_shm_attach(int client, int epfd, int fds[HALEXT_SHM_FDS])
+{
+	struct halext_shm *shm = NULL;
+	struct epoll_event ev;
+	void *mem;
+	int i, ret;
+
+	if (!shm_trusted(client))
+		return -EPERM;
+
+	for (i = 0; i < HALEXT_SHM_MAX_RINGS; i++) {
+		if (rings[i].client == client) {
+			shm_release(&rings[i], epfd);
+			shm = &rings[i];
+			break;
+		}
+		if (shm == NULL && rings[i].client < 0)
+			shm = &rings[i];
+	}
+
+	if (shm == NULL)
+		return -ENOSPC;
+
+	shm->memfd = ashmem_create_region("rqb-halext-ring",
+					  sizeof(*shm->ring));
+	shm->reqfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	shm->donefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (shm->memfd < 0 || shm->reqfd < 0 || shm->donefd < 0) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	mem = mmap(NULL, sizeof(*shm->ring), PROT_READ | PROT_WRITE,
+		   MAP_SHARED, shm->memfd, 0);
+	if (mem == MAP_FAILED) {
+		ret = -errno;
+		goto err;
+	}
+
+	shm->ring = mem;
+	memset(shm->ring, 0, sizeof(*shm->ring));
+	shm->ring->num_slots = HALEXT_SHM_SLOTS;
+	__atomic_store_n(&shm->ring->magic, HALEXT_SHM_MAGIC,
+			 __ATOMIC_RELEASE);
+
+	ev.events = EPOLLIN;
+	ev.data.fd = shm->reqfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, shm->reqfd, &ev) < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	shm->client = client;
+
+	fds[0] = shm->memfd;
+	fds[1] = shm->reqfd;
+	fds[2] = shm->donefd;
+
+	return 0;
+
+err:
+	ALOGE("Cannot create shared memory ring: %d", ret);
+	shm_release(shm, epfd);
+	return ret;
+}
+
+/*
+ * halext_shm_detach - Destroy the ring of a client connection, if any
+ *
+ * Locks acquired through the ring are left alone, as the ones
+ * acquired through the socket are.
+ *
+ * \param client - Client socket
+ * \param epfd - PowerServer event loop
+ */
+void halext_shm_detach(int client, int epfd)
+{
+	int i;
+
+	for (i = 0; i < HALEXT_SHM_MAX_RINGS; i++) {
+		if (rings[i].client == client) {
+			shm_release(&rings[i], epfd);
+			return;
+		}
+	}
+}
+
+/*
+ * shm_find - Get the ring of a request doorbell
+ *
+ * \param fd - Request doorbell
+ * \return Returns the ring, NULL if fd is not a doorbell
+ */
+static struct halext_shm *shm_find(int fd)
+{
+	int i;
+
+	if (fd < 0)
+		return NULL;
+
+	for (i = 0; i < HALEXT_SHM_MAX_RINGS; i++) {
+		if (rings[i].client >= 0 && rings[i].reqfd == fd)
+			return &rings[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * halext_shm_is_doorbell - Check if a descriptor is a request doorbell
+ *
+ * \param fd - File descriptor
+ * \return Returns true if fd belongs to a ring
+ */
+bool halext_shm_is_doorbell(int fd)
+{
+	return shm_find(fd) != NULL;
+}
+
+/*
+ * shm_run_slot - Run the request of one slot, if it holds one
+ *
+ * The slot is left RUNNING, with its reply: it gets completed once
+ * the batch has been applied.
+ *
+ * \param slot - Ring slot
+ * \return Returns true if a request was run
+ */
+static bool shm_run_slot(struct rqbalance_halext_slot *slot)
+{
+	struct rqbalance_halext_params params;
+	uint32_t state = HALEXT_SLOT_REQUEST;
+
+	if (!__atomic_compare_exchange_n(&slot->state, &state,
+					 HALEXT_SLOT_RUNNING, false,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return false;
+
+	/* Checked by the acquire, as for the socket requests */
+	memcpy(&params, &slot->params, sizeof(params));
+
+	if (params.acquire)
+		slot->reply = halext_perf_lock_acquire(&params);
+	else
+		slot->reply = halext_perf_lock_release(params.id);
+
+	return true;
+}
+
+/*
+ * halext_shm_event - Run all the pending requests of a ring
+ *
+ * All the requests get applied as one batch, with a single profile
+ * re-evaluation, then the client is woken up once.
+ *
+ * Note: Has to be called with the applier lock held.
+ *
+ * \param fd - Request doorbell
+ */
+void halext_shm_event(int fd)
+{
+	struct halext_shm *shm = shm_find(fd);
+	uint32_t done = 0;
+	uint64_t count;
+	int i;
+
+	if (shm == NULL)
+		return;
+
+	/* Ack first: requests coming in from now on ring again */
+	while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR)
+		;
+
+	power_batch_begin();
+	for (i = 0; i < HALEXT_SHM_SLOTS; i++) {
+		if (shm_run_slot(&shm->ring->slots[i]))
+			done |= 1U << i;
+	}
+	power_batch_end();
+
+	/* Replies only go out once the new profile has been written */
+	for (i = 0; i < HALEXT_SHM_SLOTS; i++) {
+		if (done & (1U << i))
+			__atomic_store_n(&shm->ring->slots[i].state,
+					 HALEXT_SLOT_DONE, __ATOMIC_RELEASE);
+	}
+
+	count = 1;
+	if (done && write(shm->donefd, &count, sizeof(count)) != sizeof(count))
+		ALOGE("Cannot ring completion doorbell: %d", errno);
+}
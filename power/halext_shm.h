@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __HALEXT_SHM_H__
+#define __HALEXT_SHM_H__
+
+#include <stdbool.h>
+
+#include "rqbalance_halext.h"
+
+#define HALEXT_SHM_MAX_RINGS	4	/* Clients with a ring at a time */
+
+/* Exported functions */
+int halext_shm_attach(int client, int epfd, int fds[HALEXT_SHM_FDS]);
+void halext_shm_detach(int client, int epfd);
+bool halext_shm_is_doorbell(int fd);
+void halext_shm_event(int fd);
+
+#endif
@@ -0,0 +1,515 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-Host"
+
+/* The fake clock stands in for the real one, not for itself */
+#undef clock_gettime
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/properties.h>
+#include <hardware/power.h>
+#include <utils/Log.h>
+
+#include "power.h"
+#include "host.h"
+
+/*
+ * Host environment of the PowerHAL tools.
+ *
+ * The Android services the HAL relies on get replaced by plain
+ * process-local versions: properties live in a table, ashmem
+ * regions are memfd files and logs go to stderr.
+ *
+ * All the sysfs accesses of the HAL go to a fake tree through the
+ * powerhal.sysfs_root redirection, like on a debuggable device.
+ * The tree mirrors an eight cores big.LITTLE SoC with a thermal
+ * zone; its nodes are regular files, which don't get truncated
+ * by the HAL writes as sysfs nodes don't need to be: only the
+ * sysfs journal tells what got written.
+ *
+ * The sources of the HAL get built with clock_gettime() renamed
+ * to host_clock_gettime(): once a tool starts the fake clock,
+ * CLOCK_MONOTONIC only moves when the tool says so, which lets
+ * timestamped traces run as fast as the host can go.
+ */
+
+#define HOST_MAX_PROPS		32
+#define HOST_NUM_CPUS		8
+#define HOST_CPUS_PER_CLUSTER	4
+
+struct host_prop {
+	char key[PROPERTY_KEY_MAX];
+	char value[PROPERTY_VALUE_MAX];
+};
+
+struct host_node {
+	const char *path;
+	const char *value;
+};
+
+extern struct power_module HAL_MODULE_INFO_SYM;
+
+int host_log_level = HOST_LOG_WARN;
+
+static struct host_prop props[HOST_MAX_PROPS];
+static int num_props;
+static pthread_mutex_t props_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool fake_clock;
+static uint64_t fake_ns;
+
+static const struct host_node sysfs_nodes[] = {
+	{ "/sys/devices/system/cpu/possible",			"0-7" },
+	{ "/sys/devices/system/cpu/online",			"0-7" },
+	{ CPUQUIET_NODE "nr_min_cpus",				"1" },
+	{ CPUQUIET_NODE "nr_power_max_cpus",			"8" },
+	{ CPUQUIET_NODE "nr_thermal_max_cpus",			"8" },
+	{ RQBALANCE_NODE "balance_level",			"40" },
+	{ RQBALANCE_NODE "nr_run_thresholds",
+	  "100 200 300 400 500 600 700 4294967295" },
+	{ RQBALANCE_NODE "nr_down_run_thresholds",
+	  "0 80 180 280 380 480 580 680" },
+	{ "/sys/module/lpm_levels/parameters/sleep_disabled",	"N" },
+	{ "/sys/class/thermal/thermal_zone0/type",		"tsens_tz_sensor5" },
+	{ HOST_THERMAL_TEMP,					"35000" },
+};
+
+/* One entry per cluster: package id, cpuinfo min and max frequency */
+static const unsigned int cluster_info[][3] = {
+	{ 0, 384000, 1555200 },
+	{ 1, 384000, 1958400 },
+};
+
+/* Logging */
+
+void host_log(int level, const char *tag, const char *fmt, ...)
+{
+	static const char prio[] = "EWIDV";
+	char buf[1024];
+	va_list ap;
+	size_t len;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	len = strlen(buf);
+	while (len > 0 && buf[len - 1] == '\n')
+		buf[--len] = '\0';
+
+	fprintf(stderr, "%c/%s: %s\n", prio[level], tag, buf);
+}
+
+/* Properties */
+
+static struct host_prop *prop_find(const char *key)
+{
+	int i;
+
+	for (i = 0; i < num_props; i++) {
+		if (strcmp(props[i].key, key) == 0)
+			return &props[i];
+	}
+
+	return NULL;
+}
+
+int property_get(const char *key, char *value, const char *default_value)
+{
+	struct host_prop *p;
+
+	pthread_mutex_lock(&props_lock);
+
+	p = prop_find(key);
+	if (p)
+		snprintf(value, PROPERTY_VALUE_MAX, "%s", p->value);
+	else
+		snprintf(value, PROPERTY_VALUE_MAX, "%s",
+			 default_value ? default_value : "");
+
+	pthread_mutex_unlock(&props_lock);
+
+	return strlen(value);
+}
+
+int property_set(const char *key, const char *value)
+{
+	struct host_prop *p;
+	int ret = 0;
+
+	if (strlen(key) >= PROPERTY_KEY_MAX ||
+	    strlen(value) >= PROPERTY_VALUE_MAX)
+		return -EINVAL;
+
+	pthread_mutex_lock(&props_lock);
+
+	p = prop_find(key);
+	if (p == NULL) {
+		if (num_props == HOST_MAX_PROPS) {
+			ret = -ENOSPC;
+			goto end;
+		}
+		p = &props[num_props++];
+		strcpy(p->key, key);
+	}
+	strcpy(p->value, value);
+
+end:
+	pthread_mutex_unlock(&props_lock);
+	return ret;
+}
+
+/*
+ * host_set_prop - Set a property given as "key=value"
+ *
+ * \param keyval - Property assignment
+ * \return Returns success (0) or failure (negative errno)
+ */
+int host_set_prop(const char *keyval)
+{
+	char key[PROPERTY_KEY_MAX];
+	const char *eq = strchr(keyval, '=');
+
+	if (eq == NULL || eq == keyval || eq - keyval >= PROPERTY_KEY_MAX)
+		return -EINVAL;
+
+	memcpy(key, keyval, eq - keyval);
+	key[eq - keyval] = '\0';
+
+	return property_set(key, eq + 1);
+}
+
+/* ashmem */
+
+int ashmem_create_region(const char *name, size_t size)
+{
+	int fd = memfd_create(name ? name : "ashmem", MFD_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int ashmem_set_prot_region(int fd __attribute__((unused)),
+			   int prot __attribute__((unused)))
+{
+	return 0;
+}
+
+/* Clock */
+
+/*
+ * host_clock_gettime - clock_gettime() of the HAL sources
+ *
+ * \param clk - Clock
+ * \param ts - Receives the time
+ * \return Returns success (0) or failure (-1, errno set)
+ */
+int host_clock_gettime(clockid_t clk, struct timespec *ts)
+{
+	uint64_t ns;
+
+	if (!fake_clock || clk != CLOCK_MONOTONIC)
+		return clock_gettime(clk, ts);
+
+	ns = __atomic_load_n(&fake_ns, __ATOMIC_ACQUIRE);
+	ts->tv_sec = ns / NSEC_PER_SEC;
+	ts->tv_nsec = ns % NSEC_PER_SEC;
+
+	return 0;
+}
+
+/*
+ * host_clock_start - Switch CLOCK_MONOTONIC to the fake clock
+ *
+ * \param ns - Starting time
+ */
+void host_clock_start(uint64_t ns)
+{
+	__atomic_store_n(&fake_ns, ns, __ATOMIC_RELEASE);
+	fake_clock = true;
+}
+
+/*
+ * host_clock_advance - Move the fake clock forward
+ *
+ * \param ns - Elapsed time
+ */
+void host_clock_advance(uint64_t ns)
+{
+	__atomic_add_fetch(&fake_ns, ns, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * host_clock_ns - Get the CLOCK_MONOTONIC time seen by the HAL
+ *
+ * \return Returns the time in nanoseconds
+ */
+uint64_t host_clock_ns(void)
+{
+	struct timespec ts;
+
+	host_clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * NSEC_PER_SEC) + ts.tv_nsec;
+}
+
+/* Fake sysfs tree */
+
+static int mkdir_p(const char *dir)
+{
+	char path[PATH_MAX];
+	char *p;
+
+	snprintf(path, sizeof(path), "%s", dir);
+
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(path, 0755) < 0 && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+
+	if (mkdir(path, 0755) < 0 && errno != EEXIST)
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * host_sysfs_write - Set the contents of a node of the fake tree
+ *
+ * Missing directories get created.
+ *
+ * \param root - Root of the fake tree
+ * \param path - Path to the sysfs node
+ * \param s - Contents, without trailing newline
+ * \return Returns success (0) or failure (negative errno)
+ */
+int host_sysfs_write(const char *root, const char *path, const char *s)
+{
+	char rpath[PATH_MAX];
+	char *slash;
+	int fd, ret;
+
+	snprintf(rpath, sizeof(rpath), "%s%s", root, path);
+
+	slash = strrchr(rpath, '/');
+	*slash = '\0';
+	ret = mkdir_p(rpath);
+	*slash = '/';
+	if (ret < 0)
+		return ret;
+
+	fd = open(rpath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	ret = dprintf(fd, "%s\n", s) < 0 ? -EIO : 0;
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * host_sysfs_create - Create a fake sysfs tree
+ *
+ * \param root - Receives the root of the tree
+ * \param len - Size of root
+ * \return Returns success (0) or failure (negative errno)
+ */
+int host_sysfs_create(char *root, size_t len)
+{
+	char path[80], val[16], related[8];
+	const unsigned int *cl;
+	size_t i;
+	int cpu, first, ret;
+
+	if (len < sizeof(HOST_SYSFS_TEMPLATE))
+		return -EINVAL;
+
+	strcpy(root, HOST_SYSFS_TEMPLATE);
+	if (mkdtemp(root) == NULL)
+		return -errno;
+
+	for (i = 0; i < sizeof(sysfs_nodes) / sizeof(sysfs_nodes[0]); i++) {
+		ret = host_sysfs_write(root, sysfs_nodes[i].path,
+				       sysfs_nodes[i].value);
+		if (ret < 0)
+			goto err;
+	}
+
+	for (cpu = 0; cpu < HOST_NUM_CPUS; cpu++) {
+		cl = cluster_info[cpu / HOST_CPUS_PER_CLUSTER];
+		first = cpu - (cpu % HOST_CPUS_PER_CLUSTER);
+		snprintf(related, sizeof(related), "%d-%d", first,
+			 first + HOST_CPUS_PER_CLUSTER - 1);
+
+#define CPU_NODE(node, fmt, v)						\
+	do {								\
+		snprintf(path, sizeof(path),				\
+			 "/sys/devices/system/cpu/cpu%d/" node, cpu);	\
+		snprintf(val, sizeof(val), fmt, v);			\
+		ret = host_sysfs_write(root, path, val);		\
+		if (ret < 0)						\
+			goto err;					\
+	} while (0)
+
+		CPU_NODE("topology/physical_package_id", "%u", cl[0]);
+		CPU_NODE("cpufreq/cpuinfo_min_freq", "%u", cl[1]);
+		CPU_NODE("cpufreq/cpuinfo_max_freq", "%u", cl[2]);
+		CPU_NODE("cpufreq/scaling_min_freq", "%u", cl[1]);
+		CPU_NODE("cpufreq/scaling_max_freq", "%u", cl[2]);
+		CPU_NODE("cpufreq/related_cpus", "%s", related);
+
+		/* core_ctl only lives in the first CPU of the cluster */
+		if (cpu % HOST_CPUS_PER_CLUSTER == 0) {
+			CPU_NODE("core_ctl/min_cpus", "%d", 0);
+			CPU_NODE("core_ctl/max_cpus", "%d",
+				 HOST_CPUS_PER_CLUSTER);
+		}
+
+#undef CPU_NODE
+	}
+
+	return 0;
+
+err:
+	host_sysfs_remove(root);
+	return ret;
+}
+
+static int remove_entry(const char *path,
+			const struct stat *st __attribute__((unused)),
+			int flag __attribute__((unused)),
+			struct FTW *ftw __attribute__((unused)))
+{
+	return remove(path);
+}
+
+/*
+ * host_sysfs_remove - Delete a fake sysfs tree
+ *
+ * \param root - Root of the tree
+ */
+void host_sysfs_remove(const char *root)
+{
+	nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/* Environment */
+
+static int copy_file(const char *src, const char *dst)
+{
+	char buf[4096];
+	ssize_t len;
+	int in, out, ret = 0;
+
+	in = open(src, O_RDONLY | O_CLOEXEC);
+	if (in < 0)
+		return -errno;
+
+	out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out < 0) {
+		ret = -errno;
+		close(in);
+		return ret;
+	}
+
+	while ((len = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, len) != len) {
+			ret = -EIO;
+			break;
+		}
+	}
+	if (len < 0)
+		ret = -errno;
+
+	close(out);
+	close(in);
+
+	return ret;
+}
+
+/*
+ * host_setup - Prepare the environment of the HAL
+ *
+ * Properties set by the tool beforehand are kept: the compiled
+ * profiles are not used unless powerhal.profile_cache says so.
+ *
+ * \param sysfs_root - Root of the fake sysfs tree
+ * \param config - XML configuration to use, NULL for the default one
+ * \return Returns success (0) or failure (negative errno)
+ */
+int host_setup(const char *sysfs_root, const char *config)
+{
+	char propval[PROPERTY_VALUE_MAX];
+	int ret;
+
+	if (strlen(sysfs_root) >= HOST_SYSFS_ROOT_MAX)
+		return -ENAMETOOLONG;
+
+	property_set(PROP_DEBUGGABLE, "1");
+	property_set(PROP_SYSFS_ROOT, sysfs_root);
+	if (property_get(PROP_PROFILE_CACHE, propval, "") == 0)
+		property_set(PROP_PROFILE_CACHE, "0");
+
+	ret = mkdir_p(POWERSERVER_DIR);
+	if (ret == 0)
+		ret = mkdir_p(RQBHAL_CONF_DIR);
+	if (ret < 0)
+		return ret;
+
+	ret = copy_file(config ? config : HOST_DEFAULT_CONFIG,
+			RQBHAL_CONF_FILE);
+	if (ret < 0)
+		ALOGE("Cannot install configuration file: %d", ret);
+
+	return ret;
+}
+
+/*
+ * host_hal_init - Initialize the HAL through its module entry point
+ */
+void host_hal_init(void)
+{
+	HAL_MODULE_INFO_SYM.init(&HAL_MODULE_INFO_SYM);
+}
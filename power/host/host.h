@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __HOST_H__
+#define __HOST_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define HOST_SYSFS_TEMPLATE	"/tmp/rqbsysfs.XXXXXX"
+#define HOST_SYSFS_ROOT_MAX	64	/* Redirected paths must fit */
+#define HOST_THERMAL_TEMP	"/sys/class/thermal/thermal_zone0/temp"
+
+#define NSEC_PER_MSEC		1000000ULL
+#define NSEC_PER_SEC		1000000000ULL
+
+/* Exported functions */
+int host_clock_gettime(clockid_t clk, struct timespec *ts);
+void host_clock_start(uint64_t ns);
+void host_clock_advance(uint64_t ns);
+uint64_t host_clock_ns(void);
+
+int host_sysfs_create(char *root, size_t len);
+void host_sysfs_remove(const char *root);
+int host_sysfs_write(const char *root, const char *path, const char *s);
+
+int host_set_prop(const char *keyval);
+int host_setup(const char *sysfs_root, const char *config);
+void host_hal_init(void);
+
+#endif
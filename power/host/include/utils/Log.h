@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Host build shim: Android logging, on stderr.
+ * Messages above host_log_level are dropped.
+ */
+
+#ifndef __HOST_UTILS_LOG_H__
+#define __HOST_UTILS_LOG_H__
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+typedef enum {
+	HOST_LOG_ERROR,
+	HOST_LOG_WARN,
+	HOST_LOG_INFO,
+	HOST_LOG_DEBUG,
+	HOST_LOG_VERBOSE,
+} host_log_level_t;
+
+extern int host_log_level;
+
+void host_log(int level, const char *tag, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+#define HOST_LOG(level, ...)						\
+	do {								\
+		if ((level) <= host_log_level)				\
+			host_log(level, LOG_TAG, __VA_ARGS__);		\
+	} while (0)
+
+#define ALOGE(...)	HOST_LOG(HOST_LOG_ERROR, __VA_ARGS__)
+#define ALOGW(...)	HOST_LOG(HOST_LOG_WARN, __VA_ARGS__)
+#define ALOGI(...)	HOST_LOG(HOST_LOG_INFO, __VA_ARGS__)
+#define ALOGD(...)	HOST_LOG(HOST_LOG_DEBUG, __VA_ARGS__)
+#define ALOGV(...)	HOST_LOG(HOST_LOG_VERBOSE, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-LoadGen"
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <utils/Log.h>
+
+#include "power.h"
+#include "powerserver.h"
+#include "rqbalance_halext.h"
+#include "rqbalance_ctl.h"
+#include "host.h"
+
+/*
+ * Load generator for the PowerServer.
+ *
+ * The HAL runs with its real PowerServer thread, listening on its
+ * socket under the host root, and client processes hammer it with
+ * perf lock requests through librqbalance, as the media and display
+ * services do: every iteration acquires a lock (or a batch of them)
+ * and releases it. Each client records the latency of every call,
+ * from the request being sent to the reply being back; the totals
+ * give the requests per second the PowerServer went through.
+ *
+ * Clients get forked before the HAL starts its threads, then wait:
+ * once the PowerServer listens, each of them connects (and attaches
+ * its ring, with -s) with one request that isn't measured, and all
+ * of them start together.
+ *
+ * The lock argument defaults to a display layer lock, which votes
+ * for no profile: the numbers are the cost of the socket (or ring)
+ * round trips and of the locks table, not of sysfs writes.
+ */
+
+#define LOADGEN_CLIENTS		4
+#define LOADGEN_ITERATIONS	10000
+#define LOADGEN_LOCK_ARG	((DISPLAY_LAYER << 8) | STATE_ENABLE)
+
+enum loadgen_op {
+	OP_ACQUIRE = 0,
+	OP_RELEASE,
+	OP_MAX,
+};
+
+static const char *op_names[OP_MAX] = {
+	[OP_ACQUIRE]	= "acquire",
+	[OP_RELEASE]	= "release",
+};
+
+static int num_clients = LOADGEN_CLIENTS;
+static int iterations = LOADGEN_ITERATIONS;
+static int batch = 1;
+static bool use_shm = false;
+static int lock_arg = LOADGEN_LOCK_ARG;
+
+/* Shared with the clients: latencies and errors of each of them */
+static uint64_t *latencies;
+static unsigned long *errors;
+
+static int start_pipe[2], ready_pipe[2], go_pipe[2];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * NSEC_PER_SEC) + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t *client_lat(int client, enum loadgen_op op)
+{
+	return &latencies[((size_t)client * OP_MAX + op) * iterations];
+}
+
+/*
+ * client_iteration - Acquire and release one lock or one batch
+ *
+ * \param handles - Room for batch handles
+ * \param lat - Receives the latency of each call
+ * \return Returns the number of failed locks
+ */
+static unsigned long client_iteration(int *handles, uint64_t lat[OP_MAX])
+{
+	struct perf_lock_request reqs[HALEXT_MAX_BATCH];
+	int args[1] = { lock_arg };
+	unsigned long failed = 0;
+	uint64_t start;
+	int i, n, ret;
+
+	start = now_ns();
+	if (batch == 1) {
+		handles[0] = perf_lock_acq(0, 0, args, 1);
+		ret = 0;
+	} else {
+		for (i = 0; i < batch; i++) {
+			reqs[i].id = 0;
+			reqs[i].time = 0;
+			reqs[i].argument = args;
+			reqs[i].arraysz = 1;
+		}
+		ret = perf_lock_acq_batch(reqs, batch, handles);
+	}
+	lat[OP_ACQUIRE] = now_ns() - start;
+
+	if (ret < 0)
+		return batch;
+
+	/* Only release what got acquired */
+	for (i = 0, n = 0; i < batch; i++) {
+		if (handles[i] > 0)
+			handles[n++] = handles[i];
+		else
+			failed++;
+	}
+
+	start = now_ns();
+	if (n == 0)
+		ret = 0;
+	else if (batch == 1)
+		ret = perf_lock_rel(handles[0]);
+	else
+		ret = perf_lock_rel_batch(handles, n);
+	lat[OP_RELEASE] = now_ns() - start;
+
+	if (ret < 0)
+		failed += n;
+
+	return failed;
+}
+
+/*
+ * client_run - Body of one client process
+ *
+ * \param client - Client number
+ */
+static void __attribute__((noreturn)) client_run(int client)
+{
+	int handles[HALEXT_MAX_BATCH];
+	uint64_t lat[OP_MAX];
+	unsigned long failed = 0;
+	char c;
+	int i, ret;
+
+	/* Wait for the PowerServer, then connect */
+	if (read(start_pipe[0], &c, 1) != 1)
+		_exit(1);
+
+	if (use_shm) {
+		ret = perf_lock_shm_attach();
+		if (ret < 0)
+			ALOGW("Client %d cannot attach a ring: %d", client, ret);
+	}
+	client_iteration(handles, lat);
+
+	if (write(ready_pipe[1], &c, 1) != 1 ||
+	    read(go_pipe[0], &c, 1) != 1)
+		_exit(1);
+
+	for (i = 0; i < iterations; i++) {
+		failed += client_iteration(handles, lat);
+		client_lat(client, OP_ACQUIRE)[i] = lat[OP_ACQUIRE];
+		client_lat(client, OP_RELEASE)[i] = lat[OP_RELEASE];
+	}
+
+	errors[client] = failed;
+	_exit(0);
+}
+
+/*
+ * report - Print the throughput and the latencies of every call
+ *
+ * \param wall_ns - Time all the clients took
+ */
+static void report(uint64_t wall_ns)
+{
+	size_t n = (size_t)num_clients * iterations;
+	unsigned long long requests = n * OP_MAX;
+	unsigned long failed = 0;
+	uint64_t *lat, total;
+	size_t i;
+	int c, op;
+
+	for (c = 0; c < num_clients; c++)
+		failed += errors[c];
+
+	printf("# %d clients, %d iterations, %d lock%s per request, %s\n",
+	       num_clients, iterations, batch, batch > 1 ? "s" : "",
+	       use_shm ? "shared ring" : "socket");
+	printf("# %llu requests in %llu ms: %.0f requests/s, %.0f locks/s, "
+	       "%lu failed locks\n", requests,
+	       (unsigned long long)(wall_ns / NSEC_PER_MSEC),
+	       requests * (double)NSEC_PER_SEC / wall_ns,
+	       requests * batch * (double)NSEC_PER_SEC / wall_ns, failed);
+	printf("# latencies in ns\n");
+	printf("%-10s %9s %9s %9s %9s\n", "request", "mean", "p50", "p99",
+	       "max");
+
+	lat = malloc(n * sizeof(*lat));
+	if (lat == NULL)
+		return;
+
+	for (op = 0; op < OP_MAX; op++) {
+		for (c = 0; c < num_clients; c++)
+			memcpy(&lat[(size_t)c * iterations], client_lat(c, op),
+			       iterations * sizeof(*lat));
+
+		for (i = 0, total = 0; i < n; i++)
+			total += lat[i];
+
+		qsort(lat, n, sizeof(*lat), cmp_u64);
+
+		printf("%-10s %9llu %9llu %9llu %9llu\n", op_names[op],
+		       (unsigned long long)(total / n),
+		       (unsigned long long)lat[n / 2],
+		       (unsigned long long)lat[(n * 99ULL) / 100],
+		       (unsigned long long)lat[n - 1]);
+	}
+
+	free(lat);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -n <count>      Iterations per client (default %d)\n"
+		"  -j <clients>    Client processes (default %d)\n"
+		"  -b <count>      Locks per request, up to %d (default 1)\n"
+		"  -a <arg>        Lock argument (default 0x%x)\n"
+		"  -s              Go through the shared ring, not the socket\n"
+		"  -c <file>       XML configuration (default: the host one)\n"
+		"  -p <key=value>  Set a property, can be repeated\n"
+		"  -v              More logs, can be repeated\n",
+		prog, LOADGEN_ITERATIONS, LOADGEN_CLIENTS, HALEXT_MAX_BATCH,
+		LOADGEN_LOCK_ARG);
+}
+
+int main(int argc, char **argv)
+{
+	char sysfs_root[HOST_SYSFS_ROOT_MAX];
+	const char *config = NULL;
+	size_t lat_size;
+	uint64_t start;
+	pid_t *pids;
+	int opt, c, status, ret = 1;
+	char buf = 0;
+
+	while ((opt = getopt(argc, argv, "n:j:b:a:sc:p:v")) != -1) {
+		switch (opt) {
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'j':
+				num_clients = atoi(optarg);
+				break;
+			case 'b':
+				batch = atoi(optarg);
+				break;
+			case 'a':
+				lock_arg = strtol(optarg, NULL, 0);
+				break;
+			case 's':
+				use_shm = true;
+				break;
+			case 'c':
+				config = optarg;
+				break;
+			case 'p':
+				if (host_set_prop(optarg) < 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'v':
+				host_log_level++;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (iterations <= 0 || num_clients <= 0 ||
+	    num_clients > POWERSERVER_MAXCLIENTS ||
+	    batch <= 0 || batch > HALEXT_MAX_BATCH) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	lat_size = (size_t)num_clients * OP_MAX * iterations *
+		   sizeof(*latencies);
+	latencies = mmap(NULL, lat_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	errors = mmap(NULL, num_clients * sizeof(*errors),
+		      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		      -1, 0);
+	pids = calloc(num_clients, sizeof(*pids));
+	if (latencies == MAP_FAILED || errors == MAP_FAILED || pids == NULL) {
+		fprintf(stderr, "Cannot allocate the results\n");
+		return 1;
+	}
+
+	if (pipe(start_pipe) < 0 || pipe(ready_pipe) < 0 ||
+	    pipe(go_pipe) < 0) {
+		fprintf(stderr, "Cannot create the pipes: %d\n", errno);
+		return 1;
+	}
+
+	if (host_sysfs_create(sysfs_root, sizeof(sysfs_root)) < 0) {
+		fprintf(stderr, "Cannot create the fake sysfs tree\n");
+		return 1;
+	}
+
+	if (host_setup(sysfs_root, config) < 0)
+		goto end;
+
+	/* No threads yet: the clients get a clean copy of the process */
+	for (c = 0; c < num_clients; c++) {
+		pids[c] = fork();
+		if (pids[c] == 0)
+			client_run(c);
+		if (pids[c] < 0) {
+			fprintf(stderr, "Cannot fork client %d\n", c);
+			num_clients = c;
+			goto kill;
+		}
+	}
+
+	host_hal_init();
+	if (!powerserver_running()) {
+		fprintf(stderr, "PowerServer not running\n");
+		goto kill;
+	}
+
+	/* Let the clients connect, then start them all at once */
+	for (c = 0; c < num_clients; c++) {
+		if (write(start_pipe[1], &buf, 1) != 1)
+			goto kill;
+	}
+	for (c = 0; c < num_clients; c++) {
+		if (read(ready_pipe[0], &buf, 1) != 1)
+			goto kill;
+	}
+
+	start = now_ns();
+	for (c = 0; c < num_clients; c++) {
+		if (write(go_pipe[1], &buf, 1) != 1)
+			goto kill;
+	}
+
+	ret = 0;
+	for (c = 0; c < num_clients; c++) {
+		if (waitpid(pids[c], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "Client %d failed\n", c);
+			ret = 1;
+		}
+	}
+
+	if (ret == 0)
+		report(now_ns() - start);
+
+	manage_powerserver(false);
+	goto end;
+
+kill:
+	for (c = 0; c < num_clients; c++) {
+		kill(pids[c], SIGKILL);
+		waitpid(pids[c], NULL, 0);
+	}
+	manage_powerserver(false);
+
+end:
+	host_sysfs_remove(sysfs_root);
+	free(pids);
+
+	return ret;
+}
@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-LockStress"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/Log.h>
+
+#include "power.h"
+#include "rqbalance_halext.h"
+#include "host.h"
+
+/*
+ * Stress test of the perf locks table.
+ *
+ * Locks get taken and dropped at random, up to STRESS_MAX_LIVE at
+ * once, with a mix of lock types (some voting for a profile, some
+ * not) and of timed locks, and every step checks that:
+ *
+ * - every handle is positive and finds its own slot
+ * - the lock type list starts with the newest lock of that type
+ * - a released handle is refused, by the lookup and by a release
+ * - handles released earlier (the last STRESS_STALE ones) stay
+ *   refused as their slots get reused, and live ones stay valid
+ *
+ * Then the table gets filled up to MAX_PERMITTED_LOCKS, and one
+ * slot gets reused through more than a whole generation cycle:
+ * handles must never be 0 nor negative, and must not repeat for
+ * LOCK_GEN_MASK reuses of the same slot.
+ */
+
+#define STRESS_CYCLES		100000
+#define STRESS_MAX_LIVE		256
+#define STRESS_STALE		4096
+#define STRESS_CHECK_EVERY	1000
+
+/* Not exported by a header: the PowerServer goes through halext */
+int new_lock_init(unsigned int time, unsigned short type, int state);
+void remove_lock(int entryno);
+int get_locktype_by_id(unsigned int id);
+int get_locktype_by_type(unsigned short type);
+
+struct live_lock {
+	int handle;
+	unsigned short type;
+};
+
+static const unsigned short lock_types[] = {
+	OMX_DECODER, DISPLAY_LAYER, OMX_ENCODER, RQB_POWERHAL, 0x47,
+};
+
+static struct live_lock live[STRESS_MAX_LIVE];
+static int num_live;
+static int stale[STRESS_STALE];
+static unsigned int num_stale;
+static unsigned long failures;
+static uint32_t rng_state = 0x2545f491;
+
+static void fail(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static void fail(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (failures++ < 20) {
+		va_start(ap, fmt);
+		fprintf(stderr, "FAIL: ");
+		vfprintf(stderr, fmt, ap);
+		fprintf(stderr, "\n");
+		va_end(ap);
+	}
+}
+
+static uint32_t rng(void)
+{
+	/* xorshift32: same sequence on every host for the same seed */
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return rng_state;
+}
+
+static int acquire(unsigned int time, unsigned short type)
+{
+	int handle, slot;
+
+	power_lock();
+	handle = new_lock_init(time, type, STATE_ENABLE);
+	power_unlock();
+
+	if (handle <= 0) {
+		fail("acquire of type 0x%x returned %d", type, handle);
+		return handle;
+	}
+
+	slot = get_locktype_by_id(handle);
+	if (slot != (handle & LOCK_SLOT_MASK))
+		fail("handle 0x%x found slot %d", handle, slot);
+	else if (get_locktype_by_type(type) != slot)
+		fail("type 0x%x list doesn't start with handle 0x%x",
+		     type, handle);
+
+	return handle;
+}
+
+static void release(int handle)
+{
+	int slot = get_locktype_by_id(handle);
+
+	if (slot < 0) {
+		fail("live handle 0x%x not found: %d", handle, slot);
+		return;
+	}
+
+	power_lock();
+	remove_lock(slot);
+	power_unlock();
+
+	if (get_locktype_by_id(handle) != -EINVAL)
+		fail("released handle 0x%x still found", handle);
+	if (halext_perf_lock_release(handle) != -ENXIO)
+		fail("released handle 0x%x released again", handle);
+
+	stale[num_stale++ % STRESS_STALE] = handle;
+}
+
+static void check_all(void)
+{
+	unsigned int i, n = num_stale < STRESS_STALE ? num_stale :
+			    STRESS_STALE;
+	int j;
+
+	for (j = 0; j < num_live; j++) {
+		if (get_locktype_by_id(live[j].handle) < 0)
+			fail("live handle 0x%x lost", live[j].handle);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (get_locktype_by_id(stale[i]) >= 0)
+			fail("stale handle 0x%x accepted", stale[i]);
+	}
+}
+
+/*
+ * stress_cycles - Take and drop locks at random
+ *
+ * \param cycles - Number of acquire or release steps
+ */
+static void stress_cycles(unsigned long cycles)
+{
+	unsigned long c;
+	unsigned short type;
+	unsigned int time;
+	int handle, idx;
+
+	for (c = 0; c < cycles; c++) {
+		if (num_live == 0 ||
+		    (num_live < STRESS_MAX_LIVE && (rng() & 1))) {
+			type = lock_types[rng() % (sizeof(lock_types) /
+						   sizeof(lock_types[0]))];
+			/* Timed locks never expire here: dropped pending */
+			time = (rng() & 3) == 0 ? 60000 : 0;
+
+			handle = acquire(time, type);
+			if (handle > 0) {
+				live[num_live].handle = handle;
+				live[num_live++].type = type;
+			}
+		} else {
+			idx = rng() % num_live;
+			release(live[idx].handle);
+			live[idx] = live[--num_live];
+		}
+
+		if (c % STRESS_CHECK_EVERY == 0)
+			check_all();
+	}
+
+	while (num_live > 0)
+		release(live[--num_live].handle);
+
+	check_all();
+}
+
+/*
+ * stress_full - Fill the whole table, then empty it
+ */
+static void stress_full(void)
+{
+	static int handles[MAX_PERMITTED_LOCKS];
+	int i, ret;
+
+	for (i = 0; i < MAX_PERMITTED_LOCKS; i++) {
+		handles[i] = acquire(0, DISPLAY_LAYER);
+		if (handles[i] <= 0)
+			break;
+	}
+
+	power_lock();
+	ret = new_lock_init(0, DISPLAY_LAYER, STATE_ENABLE);
+	power_unlock();
+	if (ret != -ENOSPC)
+		fail("full table gave %d instead of -ENOSPC", ret);
+
+	while (--i >= 0)
+		release(handles[i]);
+
+	check_all();
+}
+
+/*
+ * stress_wrap - Reuse one slot through a whole generation cycle
+ *
+ * \return Returns the number of generation wraps seen
+ */
+static unsigned int stress_wrap(void)
+{
+	unsigned long i;
+	unsigned int gen, prev_gen = 0, wraps = 0;
+	int first, handle;
+
+	first = acquire(0, DISPLAY_LAYER);
+	if (first <= 0)
+		return 0;
+	release(first);
+
+	for (i = 1; i <= LOCK_GEN_MASK + 1UL; i++) {
+		handle = acquire(0, DISPLAY_LAYER);
+		if (handle <= 0)
+			return wraps;
+
+		gen = (unsigned int)handle >> LOCK_SLOT_BITS;
+		if ((handle & LOCK_SLOT_MASK) != (first & LOCK_SLOT_MASK))
+			fail("slot 0x%x not reused", first & LOCK_SLOT_MASK);
+		if (gen == 0)
+			fail("handle 0x%x has generation 0", handle);
+		if (prev_gen && gen < prev_gen) {
+			wraps++;
+			if (prev_gen != LOCK_GEN_MASK || gen != 1)
+				fail("generation wrapped from %u to %u",
+				     prev_gen, gen);
+		}
+		if (handle == first && i != LOCK_GEN_MASK)
+			fail("handle 0x%x repeated after %lu reuses",
+			     handle, i);
+		if (i == LOCK_GEN_MASK && handle != first)
+			fail("generations don't cycle: 0x%x after %lu reuses",
+			     handle, i);
+
+		prev_gen = gen;
+		release(handle);
+	}
+
+	return wraps;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -n <count>      Random acquire/release cycles (default %d)\n"
+		"  -s <seed>       Random seed\n"
+		"  -v              More logs, can be repeated\n",
+		prog, STRESS_CYCLES);
+}
+
+int main(int argc, char **argv)
+{
+	char sysfs_root[HOST_SYSFS_ROOT_MAX];
+	unsigned long cycles = STRESS_CYCLES;
+	unsigned int wraps;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "n:s:v")) != -1) {
+		switch (opt) {
+			case 'n':
+				cycles = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				rng_state = strtoul(optarg, NULL, 0);
+				if (!rng_state)
+					rng_state = 1;
+				break;
+			case 'v':
+				host_log_level++;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (host_sysfs_create(sysfs_root, sizeof(sysfs_root)) < 0) {
+		fprintf(stderr, "Cannot create the fake sysfs tree\n");
+		return 1;
+	}
+
+	if (host_setup(sysfs_root, NULL) < 0)
+		goto end;
+
+	host_hal_init();
+
+	stress_cycles(cycles);
+	stress_full();
+	wraps = stress_wrap();
+	if (wraps == 0)
+		fail("generation never wrapped");
+
+	printf("%lu cycles, %u locks released, %u generation "
+	       "wraps: %lu failures\n", cycles, num_stale, wraps, failures);
+
+	ret = failures ? 1 : 0;
+
+end:
+	host_sysfs_remove(sysfs_root);
+	return ret;
+}
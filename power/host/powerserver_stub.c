@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-Host"
+
+#include <stdbool.h>
+
+#include <utils/Log.h>
+
+#include "powerserver.h"
+
+/*
+ * The host tools stand in for the PowerServer thread: nothing
+ * gets started and the PowerServer never runs, so that power
+ * hints get applied right away on the calling thread, and the
+ * tools run the timer wheel and the perf lock requests on their
+ * own, in the same order as the event loop would.
+ */
+
+int manage_powerserver(bool start)
+{
+	ALOGD("PowerServer %s (host stub)", start ? "start" : "stop");
+
+	return 0;
+}
+
+bool powerserver_running(void)
+{
+	return false;
+}
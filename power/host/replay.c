@@ -0,0 +1,658 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-Replay"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/power.h>
+#include <utils/Log.h>
+
+#include "power.h"
+#include "metrics.h"
+#include "profiles.h"
+#include "rqbalance_halext.h"
+#include "sysfs_journal.h"
+#include "timerwheel.h"
+#include "host.h"
+
+/*
+ * PowerHAL trace replay.
+ *
+ * Runs the HAL against a fake sysfs tree on the fake clock and
+ * feeds it a trace of timestamped requests, one per line ('#'
+ * starts a comment), times being milliseconds from the start:
+ *
+ *   <ms> hint <name|number> [value]
+ *   <ms> interactive <0|1>
+ *   <ms> perf_lock_acq <tag> <duration_ms> <arg> [<arg>...]
+ *   <ms> perf_lock_rel <tag>
+ *   <ms> temp <millidegrees>
+ *
+ * Hint values are passed as a pointer to an int for interaction
+ * hints; for the other hints any non zero value means a non NULL
+ * data pointer. Perf locks are named by a tag of the trace: taking
+ * a lock with the tag of a held one adds resources to that lock.
+ * Temperatures get written to the thermal zone of the fake tree.
+ *
+ * The replay takes the place of the PowerServer: hints get applied
+ * right away, perf lock requests run with the applier lock held
+ * and the timer wheel runs every step (1ms by default) of the fake
+ * clock up to the next request, then for a while after the last
+ * one, for timed locks and launch boosts to expire.
+ *
+ * Every sysfs write and profile switch gets recorded in place of
+ * the sysfs journal, which only keeps the last events, and the
+ * report has the write counters of every node, the time spent in
+ * each profile and the timeline of the profile switches (and of
+ * every write, with -w), so that two configurations can be told
+ * apart on the same trace.
+ */
+
+#define REPLAY_START_NS		NSEC_PER_SEC	/* Fake clock origin */
+#define REPLAY_STEP_MS		1
+#define REPLAY_TAIL_MS		5000
+#define REPLAY_MAX_NODES	128
+#define REPLAY_MAX_TAGS		256
+#define REPLAY_TAG_MAX		32
+#define REPLAY_MAX_ARGS		16
+
+struct replay_node {
+	const char *path;
+	unsigned int writes;
+	unsigned int skipped;
+	unsigned int errors;
+};
+
+struct replay_event {
+	uint64_t ns;
+	int node;		/* -1 for profile switches */
+	int mode;
+	bool ok;
+	char value[PROP_VALUE_MAX];
+};
+
+struct replay_tag {
+	char name[REPLAY_TAG_MAX];
+	int32_t id;
+};
+
+static const struct {
+	const char *name;
+	power_hint_t hint;
+} hint_names[] = {
+	{ "vsync",			POWER_HINT_VSYNC },
+	{ "interaction",		POWER_HINT_INTERACTION },
+	{ "video_encode",		POWER_HINT_VIDEO_ENCODE },
+	{ "video_decode",		POWER_HINT_VIDEO_DECODE },
+	{ "low_power",			POWER_HINT_LOW_POWER },
+	{ "sustained_performance",	POWER_HINT_SUSTAINED_PERFORMANCE },
+	{ "vr_mode",			POWER_HINT_VR_MODE },
+	{ "launch",			POWER_HINT_LAUNCH },
+	{ "disable_touch",		POWER_HINT_DISABLE_TOUCH },
+};
+
+extern struct power_module HAL_MODULE_INFO_SYM;
+
+static struct replay_node nodes[REPLAY_MAX_NODES];
+static int num_nodes;
+static struct replay_event *events;
+static size_t num_events, max_events;
+static int cur_mode = -1;
+
+static struct replay_tag tags[REPLAY_MAX_TAGS];
+static int num_tags;
+
+static char sysfs_root[HOST_SYSFS_ROOT_MAX];
+static uint64_t step_ns = REPLAY_STEP_MS * NSEC_PER_MSEC;
+static unsigned long lineno;
+
+/* Sysfs journal, recording everything */
+
+static int node_index(const char *path)
+{
+	int i;
+
+	for (i = 0; i < num_nodes; i++) {
+		if (nodes[i].path == path || strcmp(nodes[i].path, path) == 0)
+			return i;
+	}
+
+	if (num_nodes == REPLAY_MAX_NODES)
+		return -1;
+
+	/* Paths of the HAL are never freed */
+	nodes[num_nodes].path = path;
+	return num_nodes++;
+}
+
+static struct replay_event *event_add(void)
+{
+	struct replay_event *e;
+
+	if (num_events == max_events) {
+		max_events = max_events ? max_events * 2 : 1024;
+		events = realloc(events, max_events * sizeof(*events));
+		if (events == NULL) {
+			ALOGE("Out of memory recording the journal");
+			exit(1);
+		}
+	}
+
+	e = &events[num_events++];
+	memset(e, 0, sizeof(*e));
+	e->ns = host_clock_ns();
+	e->node = -1;
+	e->mode = -1;
+
+	return e;
+}
+
+void sysfs_journal_write(const char *path, const char *s, bool ok)
+{
+	struct replay_event *e;
+	int node = node_index(path);
+
+	if (node >= 0) {
+		nodes[node].writes++;
+		if (!ok)
+			nodes[node].errors++;
+	}
+
+	e = event_add();
+	e->node = node;
+	e->ok = ok;
+	snprintf(e->value, sizeof(e->value), "%s", s);
+}
+
+void sysfs_journal_skip(const char *path)
+{
+	int node = node_index(path);
+
+	if (node >= 0)
+		nodes[node].skipped++;
+}
+
+void sysfs_journal_mode(int mode)
+{
+	if (mode == cur_mode)
+		return;
+
+	cur_mode = mode;
+	event_add()->mode = mode;
+}
+
+int sysfs_journal_dump(char *buf, size_t len)
+{
+	if (len)
+		buf[0] = '\0';
+
+	return 0;
+}
+
+/* Replay */
+
+/*
+ * run_timers - Run the timer wheel, like the PowerServer does
+ */
+static void run_timers(void)
+{
+	int expired;
+
+	power_lock();
+	power_batch_begin();
+	expired = timerwheel_run();
+	power_batch_end();
+	power_unlock();
+
+	metrics_timers(expired);
+}
+
+/*
+ * advance_to - Move the fake clock forward, one step at a time
+ *
+ * \param ns - Target time
+ */
+static void advance_to(uint64_t ns)
+{
+	uint64_t now = host_clock_ns();
+	uint64_t step;
+
+	while (now < ns) {
+		step = ns - now < step_ns ? ns - now : step_ns;
+		host_clock_advance(step);
+		now += step;
+		run_timers();
+	}
+}
+
+static struct replay_tag *tag_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_tags; i++) {
+		if (strcmp(tags[i].name, name) == 0)
+			return &tags[i];
+	}
+
+	return NULL;
+}
+
+static int parse_int(const char *s, long *val)
+{
+	char *end;
+
+	if (s == NULL)
+		return -EINVAL;
+
+	errno = 0;
+	*val = strtol(s, &end, 0);
+	if (errno || *end != '\0' || end == s)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int do_hint(char **args)
+{
+	struct power_module *module = &HAL_MODULE_INFO_SYM;
+	unsigned int i;
+	long hint = -1, val = 0;
+	int data;
+	bool has_val = args[1] != NULL;
+
+	for (i = 0; i < sizeof(hint_names) / sizeof(hint_names[0]); i++) {
+		if (args[0] && strcmp(args[0], hint_names[i].name) == 0)
+			hint = hint_names[i].hint;
+	}
+
+	if ((hint < 0 && parse_int(args[0], &hint) < 0) ||
+	    (has_val && parse_int(args[1], &val) < 0))
+		return -EINVAL;
+
+	data = val;
+	if (hint == POWER_HINT_INTERACTION)
+		module->powerHint(module, hint, has_val ? &data : NULL);
+	else
+		module->powerHint(module, hint, val ? &data : NULL);
+
+	return 0;
+}
+
+static int do_interactive(char **args)
+{
+	struct power_module *module = &HAL_MODULE_INFO_SYM;
+	long on;
+
+	if (parse_int(args[0], &on) < 0)
+		return -EINVAL;
+
+	module->setInteractive(module, on != 0);
+
+	return 0;
+}
+
+static int do_perf_lock_acq(char **args)
+{
+	struct rqbalance_halext_params params;
+	struct replay_tag *tag;
+	long val;
+	int i, ret;
+
+	if (args[0] == NULL || strlen(args[0]) >= REPLAY_TAG_MAX ||
+	    parse_int(args[1], &val) < 0 || val < 0 || args[2] == NULL)
+		return -EINVAL;
+
+	memset(&params, 0, sizeof(params));
+	params.acquire = 1;
+	params.time = val;
+
+	for (i = 0; args[i + 2]; i++) {
+		if (i == MAX_ARGUMENTS || parse_int(args[i + 2], &val) < 0)
+			return -EINVAL;
+		params.argument[i] = val;
+	}
+	params.arraysz = i;
+
+	tag = tag_find(args[0]);
+	if (tag)
+		params.id = tag->id;
+
+	power_lock();
+	ret = halext_perf_lock_acquire(&params);
+	power_unlock();
+
+	if (ret < 0) {
+		ALOGW("line %lu: perf_lock_acq %s failed: %d",
+		      lineno, args[0], ret);
+		return 0;
+	}
+
+	if (tag == NULL) {
+		if (num_tags == REPLAY_MAX_TAGS) {
+			ALOGE("line %lu: too many perf locks held", lineno);
+			return -ENOSPC;
+		}
+		tag = &tags[num_tags++];
+		strcpy(tag->name, args[0]);
+	}
+	tag->id = ret;
+
+	return 0;
+}
+
+static int do_perf_lock_rel(char **args)
+{
+	struct replay_tag *tag;
+	int ret;
+
+	if (args[0] == NULL)
+		return -EINVAL;
+
+	tag = tag_find(args[0]);
+	if (tag == NULL) {
+		ALOGW("line %lu: perf lock %s is not held", lineno, args[0]);
+		return 0;
+	}
+
+	power_lock();
+	ret = halext_perf_lock_release(tag->id);
+	power_unlock();
+
+	/* Timed locks may have expired already */
+	if (ret < 0)
+		ALOGD("line %lu: perf_lock_rel %s: %d", lineno, args[0], ret);
+
+	*tag = tags[--num_tags];
+
+	return 0;
+}
+
+static int do_temp(char **args)
+{
+	long temp;
+
+	if (parse_int(args[0], &temp) < 0)
+		return -EINVAL;
+
+	return host_sysfs_write(sysfs_root, HOST_THERMAL_TEMP, args[0]);
+}
+
+static const struct {
+	const char *name;
+	int (*run)(char **args);
+} commands[] = {
+	{ "hint",		do_hint },
+	{ "interactive",	do_interactive },
+	{ "perf_lock_acq",	do_perf_lock_acq },
+	{ "perf_lock_rel",	do_perf_lock_rel },
+	{ "temp",		do_temp },
+};
+
+/*
+ * replay_line - Run one line of the trace
+ *
+ * \param line - Trace line, modified
+ * \param last_ns - Time of the previous request, updated
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int replay_line(char *line, uint64_t *last_ns)
+{
+	char *args[REPLAY_MAX_ARGS + 1];
+	char *save, *tok, *end;
+	unsigned int i;
+	uint64_t ns;
+	double ms;
+	int n = 0;
+
+	tok = strchr(line, '#');
+	if (tok)
+		*tok = '\0';
+
+	for (tok = strtok_r(line, " \t\r\n", &save); tok;
+	     tok = strtok_r(NULL, " \t\r\n", &save)) {
+		if (n == REPLAY_MAX_ARGS)
+			return -E2BIG;
+		args[n++] = tok;
+	}
+	args[n] = NULL;
+
+	if (n == 0)
+		return 0;
+	if (n < 2)
+		return -EINVAL;
+
+	ms = strtod(args[0], &end);
+	if (*end != '\0' || ms < 0)
+		return -EINVAL;
+
+	ns = REPLAY_START_NS + (uint64_t)(ms * NSEC_PER_MSEC);
+	if (ns < *last_ns) {
+		ALOGE("line %lu: time goes backwards", lineno);
+		return -EINVAL;
+	}
+	*last_ns = ns;
+
+	advance_to(ns);
+
+	for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+		if (strcmp(args[1], commands[i].name) == 0)
+			return commands[i].run(&args[2]);
+	}
+
+	return -EINVAL;
+}
+
+/* Report */
+
+static void print_ms(uint64_t ns)
+{
+	printf("%llu.%03llu", (unsigned long long)(ns / NSEC_PER_MSEC),
+	       (unsigned long long)(ns % NSEC_PER_MSEC) / 1000);
+}
+
+static void print_time(uint64_t ns)
+{
+	print_ms(ns - REPLAY_START_NS);
+}
+
+static void report(const char *trace, bool writes)
+{
+	uint64_t end = host_clock_ns();
+	uint64_t *mode_ns;
+	unsigned int *switches;
+	struct replay_event *e;
+	size_t i;
+	int n = profiles_count(), mode = -1;
+	uint64_t since = 0;
+
+	mode_ns = calloc(n, sizeof(*mode_ns));
+	switches = calloc(n, sizeof(*switches));
+	if (mode_ns == NULL || switches == NULL) {
+		ALOGE("Out of memory writing the report");
+		exit(1);
+	}
+
+	printf("# replay of %s: ", trace);
+	print_time(end);
+	printf(" ms, %zu events\n", num_events);
+
+	printf("# sysfs nodes\n");
+	for (i = 0; i < (size_t)num_nodes; i++)
+		printf("node %s writes=%u skipped=%u errors=%u\n",
+		       nodes[i].path, nodes[i].writes, nodes[i].skipped,
+		       nodes[i].errors);
+
+	printf("# timeline (ms)\n");
+	for (i = 0; i < num_events; i++) {
+		e = &events[i];
+		if (e->node >= 0) {
+			if (!writes)
+				continue;
+			print_time(e->ns);
+			printf(" write %s %s%s\n", nodes[e->node].path,
+			       e->value, e->ok ? "" : " failed");
+			continue;
+		}
+
+		print_time(e->ns);
+		printf(" mode %s\n", profile_name(e->mode));
+
+		if (mode >= 0 && mode < n)
+			mode_ns[mode] += e->ns - since;
+		mode = e->mode;
+		since = e->ns;
+		if (mode >= 0 && mode < n)
+			switches[mode]++;
+	}
+	if (mode >= 0 && mode < n)
+		mode_ns[mode] += end - since;
+
+	printf("# profiles\n");
+	for (i = 0; i < (size_t)n; i++) {
+		if (!switches[i])
+			continue;
+		printf("profile %s time=", profile_name(i));
+		print_ms(mode_ns[i]);
+		printf(" ms switches=%u\n", switches[i]);
+	}
+
+	free(mode_ns);
+	free(switches);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <trace|->\n"
+		"  -c <file>       XML configuration (default: the host one)\n"
+		"  -r <dir>        Existing fake sysfs tree to use\n"
+		"  -p <key=value>  Set a property, can be repeated\n"
+		"  -s <ms>         Timer wheel step (default %d)\n"
+		"  -t <ms>         Time to run after the last request"
+		" (default %d)\n"
+		"  -w              Show every sysfs write in the timeline\n"
+		"  -k              Keep the fake sysfs tree\n"
+		"  -v              More logs, can be repeated\n",
+		prog, REPLAY_STEP_MS, REPLAY_TAIL_MS);
+}
+
+int main(int argc, char **argv)
+{
+	const char *config = NULL, *root = NULL, *trace;
+	uint64_t last_ns = 0, tail_ns = REPLAY_TAIL_MS * NSEC_PER_MSEC;
+	bool writes = false, keep = false;
+	size_t len = 0;
+	char *line = NULL;
+	FILE *in;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "c:r:p:s:t:wkv")) != -1) {
+		switch (opt) {
+			case 'c':
+				config = optarg;
+				break;
+			case 'r':
+				root = optarg;
+				break;
+			case 'p':
+				if (host_set_prop(optarg) < 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 's':
+				step_ns = strtoull(optarg, NULL, 0) *
+					  NSEC_PER_MSEC;
+				if (!step_ns)
+					step_ns = NSEC_PER_MSEC;
+				break;
+			case 't':
+				tail_ns = strtoull(optarg, NULL, 0) *
+					  NSEC_PER_MSEC;
+				break;
+			case 'w':
+				writes = true;
+				break;
+			case 'k':
+				keep = true;
+				break;
+			case 'v':
+				host_log_level++;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	trace = argv[optind];
+	in = strcmp(trace, "-") == 0 ? stdin : fopen(trace, "r");
+	if (in == NULL) {
+		fprintf(stderr, "Cannot open %s: %s\n", trace, strerror(errno));
+		return 1;
+	}
+
+	if (root)
+		snprintf(sysfs_root, sizeof(sysfs_root), "%s", root);
+	else if (host_sysfs_create(sysfs_root, sizeof(sysfs_root)) < 0) {
+		fprintf(stderr, "Cannot create the fake sysfs tree\n");
+		return 1;
+	}
+
+	if (host_setup(sysfs_root, config) < 0) {
+		ret = 1;
+		goto end;
+	}
+
+	host_clock_start(REPLAY_START_NS);
+	host_hal_init();
+
+	while (getline(&line, &len, in) >= 0) {
+		lineno++;
+		if (replay_line(line, &last_ns) < 0) {
+			fprintf(stderr, "%s:%lu: invalid request\n",
+				trace, lineno);
+			ret = 1;
+			goto end;
+		}
+	}
+
+	advance_to((last_ns ? last_ns : REPLAY_START_NS) + tail_ns);
+	report(trace, writes);
+
+end:
+	free(line);
+	if (in != stdin)
+		fclose(in);
+	if (!root && keep)
+		fprintf(stderr, "Fake sysfs tree kept in %s\n", sysfs_root);
+	else if (!root)
+		host_sysfs_remove(sysfs_root);
+
+	return ret;
+}
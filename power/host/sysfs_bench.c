@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-SysfsBench"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utils/Log.h>
+
+#include "power.h"
+#include "profiles.h"
+#include "sysfs_cache.h"
+#include "host.h"
+
+/*
+ * Microbenchmark of the RQBalance parameter writes.
+ *
+ * Every profile switch writes the five RQBalance nodes: this
+ * measures one switch worth of writes done the way the HAL used
+ * to (open, write and close every node), through the cache of
+ * open nodes (pwrite on the kept descriptors), through the cache
+ * when nothing changed (all writes skipped) and as a whole mode
+ * switch, including the arbiter and the per-cluster parameters.
+ * Writes alternate between the balanced and performance values.
+ *
+ * Nodes are the regular files of the fake sysfs tree, reached
+ * through the powerhal.sysfs_root redirection: the numbers are
+ * the cost of the system calls and of the path lookups, not the
+ * one of the driver store() callbacks, which is the same for all
+ * of the ways of writing.
+ */
+
+#define BENCH_ITERATIONS	100000
+
+struct bench {
+	const char *name;
+	void (*run)(int iter);
+};
+
+static const char *node_paths[SYSFS_NODE_MAX] = {
+	[SYSFS_NODE_UPCORE_THRESH]	= SYS_UPCORE_THRESH,
+	[SYSFS_NODE_DNCORE_THRESH]	= SYS_DNCORE_THRESH,
+	[SYSFS_NODE_BALANCE_LVL]	= SYS_BALANCE_LVL,
+	[SYSFS_NODE_MAX_CPUS]		= SYS_MAX_CPUS,
+	[SYSFS_NODE_MIN_CPUS]		= SYS_MIN_CPUS,
+};
+
+static char *values[2][SYSFS_NODE_MAX];
+
+static void load_values(int idx, int mode)
+{
+	struct rqbalance_params *p = profile_params(mode);
+
+	values[idx][SYSFS_NODE_UPCORE_THRESH] = p->up_thresholds;
+	values[idx][SYSFS_NODE_DNCORE_THRESH] = p->down_thresholds;
+	values[idx][SYSFS_NODE_BALANCE_LVL] = p->balance_level;
+	values[idx][SYSFS_NODE_MAX_CPUS] = p->max_cpus;
+	values[idx][SYSFS_NODE_MIN_CPUS] = p->min_cpus;
+}
+
+static void run_open_write_close(int iter)
+{
+	char rpath[SYSFS_PATH_MAX];
+	char **v = values[iter & 1];
+	int i, fd;
+
+	for (i = 0; i < SYSFS_NODE_MAX; i++) {
+		fd = open(sysfs_path(node_paths[i], rpath, sizeof(rpath)),
+			  O_WRONLY);
+		if (fd < 0)
+			continue;
+		if (write(fd, v[i], strlen(v[i])) < 0)
+			ALOGE("Cannot write %s: %d", node_paths[i], errno);
+		close(fd);
+	}
+}
+
+static void run_cached_write(int iter)
+{
+	char **v = values[iter & 1];
+	int i;
+
+	for (i = 0; i < SYSFS_NODE_MAX; i++)
+		sysfs_cache_write(i, v[i]);
+}
+
+static void run_cached_skip(int iter __attribute__((unused)))
+{
+	int i;
+
+	for (i = 0; i < SYSFS_NODE_MAX; i++)
+		sysfs_cache_update(i, values[0][i]);
+}
+
+static void run_mode_switch(int iter)
+{
+	power_lock();
+	set_power_mode(iter & 1 ? POWER_MODE_PERFORMANCE :
+		       POWER_MODE_BALANCED);
+	power_unlock();
+}
+
+static const struct bench benches[] = {
+	{ "open_write_close",	run_open_write_close },
+	{ "cached_write",	run_cached_write },
+	{ "cached_skip",	run_cached_skip },
+	{ "mode_switch",	run_mode_switch },
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * NSEC_PER_SEC) + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * run_bench - Run one benchmark and print its line of results
+ *
+ * \param b - Benchmark
+ * \param n - Number of iterations
+ * \param lat - Room for n latencies
+ */
+static void run_bench(const struct bench *b, int n, uint64_t *lat)
+{
+	uint64_t start, total = 0;
+	int i;
+
+	/* Same starting point for everyone: balanced, shadows valid */
+	run_cached_write(0);
+
+	for (i = 0; i < n; i++) {
+		start = now_ns();
+		b->run(i);
+		lat[i] = now_ns() - start;
+		total += lat[i];
+	}
+
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+
+	printf("%-18s %10.0f %9llu %9llu %9llu %9llu\n", b->name,
+	       total ? n * (double)NSEC_PER_SEC / total : 0,
+	       (unsigned long long)(total / n),
+	       (unsigned long long)lat[n / 2],
+	       (unsigned long long)lat[(n * 99ULL) / 100],
+	       (unsigned long long)lat[n - 1]);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [benchmark...]\n"
+		"  -n <count>      Iterations (default %d)\n"
+		"  -c <file>       XML configuration (default: the host one)\n"
+		"  -r <dir>        Existing fake sysfs tree to use\n"
+		"  -p <key=value>  Set a property, can be repeated\n"
+		"  -v              More logs, can be repeated\n",
+		prog, BENCH_ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+	char sysfs_root[HOST_SYSFS_ROOT_MAX];
+	const char *config = NULL, *root = NULL;
+	unsigned int b;
+	uint64_t *lat;
+	int opt, i, n = BENCH_ITERATIONS, ret = 0;
+
+	while ((opt = getopt(argc, argv, "n:c:r:p:v")) != -1) {
+		switch (opt) {
+			case 'n':
+				n = atoi(optarg);
+				break;
+			case 'c':
+				config = optarg;
+				break;
+			case 'r':
+				root = optarg;
+				break;
+			case 'p':
+				if (host_set_prop(optarg) < 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'v':
+				host_log_level++;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (n <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	lat = malloc(n * sizeof(*lat));
+	if (lat == NULL)
+		return 1;
+
+	if (root)
+		snprintf(sysfs_root, sizeof(sysfs_root), "%s", root);
+	else if (host_sysfs_create(sysfs_root, sizeof(sysfs_root)) < 0) {
+		fprintf(stderr, "Cannot create the fake sysfs tree\n");
+		free(lat);
+		return 1;
+	}
+
+	if (host_setup(sysfs_root, config) < 0) {
+		ret = 1;
+		goto end;
+	}
+
+	host_hal_init();
+	load_values(0, POWER_MODE_BALANCED);
+	load_values(1, POWER_MODE_PERFORMANCE);
+
+	printf("# %d iterations, %d nodes per iteration, times in ns\n",
+	       n, SYSFS_NODE_MAX);
+	printf("%-18s %10s %9s %9s %9s %9s\n", "benchmark", "ops/s",
+	       "mean", "p50", "p99", "max");
+
+	for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+		for (i = optind; i < argc; i++) {
+			if (strcmp(argv[i], benches[b].name) == 0)
+				break;
+		}
+		if (optind == argc || i < argc)
+			run_bench(&benches[b], n, lat);
+	}
+
+end:
+	if (!root)
+		host_sysfs_remove(sysfs_root);
+	free(lat);
+
+	return ret;
+}
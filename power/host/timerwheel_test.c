@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Built in: the test looks at the tick the wheel gets armed for */
+#include "timerwheel.c"
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host.h"
+
+/*
+ * Test of the timer wheel expiries.
+ *
+ * The fake clock only moves to the tick the timerfd would be armed
+ * for, as if the PowerServer slept until the timerfd fired, or to
+ * somewhere before it, as if something else woke the loop up: every
+ * timer has to run on its own expiry tick, never before and never
+ * after, whichever level of the wheel it went through.
+ *
+ * The first test has timers on two levels, with the one on the
+ * upper level due first; then timers get added at random, with
+ * expiries on all of the levels, while the wheel runs.
+ */
+
+#define TEST_TIMERS		2000
+#define TEST_MAX_MS		(1 << 20)
+#define TEST_SLACK_MS		1
+
+struct test_timer {
+	struct tw_timer timer;
+	const char *name;
+	uint64_t due;		/* Tick it has to run on */
+	uint64_t fired;		/* Tick it ran on, 0 if it didn't */
+};
+
+static unsigned long failures;
+static unsigned long fired;
+static uint32_t rng_state = 0x9e3779b9;
+
+static void fail(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static void fail(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (failures++ < 20) {
+		va_start(ap, fmt);
+		fprintf(stderr, "FAIL: ");
+		vfprintf(stderr, fmt, ap);
+		fprintf(stderr, "\n");
+		va_end(ap);
+	}
+}
+
+static uint32_t rng(void)
+{
+	/* xorshift32: same sequence on every host for the same seed */
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return rng_state;
+}
+
+static uint64_t current_tick(void)
+{
+	return (host_clock_ns() - origin_ns) / tick_ns;
+}
+
+static void clock_to_tick(uint64_t tick)
+{
+	uint64_t ns = origin_ns + (tick * tick_ns);
+
+	if (ns > host_clock_ns())
+		host_clock_advance(ns - host_clock_ns());
+}
+
+static void timer_fn(struct tw_timer *timer)
+{
+	struct test_timer *t = (struct test_timer *)timer;
+
+	t->fired = current_tick();
+	fired++;
+
+	if (t->fired != t->due)
+		fail("%s due on tick %llu ran on tick %llu", t->name,
+		     (unsigned long long)t->due,
+		     (unsigned long long)t->fired);
+}
+
+/*
+ * add_timer - Arm a timer and work out the tick it's due on
+ *
+ * \param t - Timer
+ * \param ms - Time to expiry in milliseconds
+ */
+static void add_timer(struct test_timer *t, unsigned int ms)
+{
+	timerwheel_add(&t->timer, ms);
+
+	/* Expiries on ticks already processed run on the next one */
+	pthread_mutex_lock(&wheel_lock);
+	t->due = t->timer.expires < wheel_ticks ? wheel_ticks :
+		 t->timer.expires;
+	pthread_mutex_unlock(&wheel_lock);
+}
+
+/*
+ * run_to_armed - Run the wheel up to the tick it's armed for
+ *
+ * \return Returns false if the wheel isn't armed
+ */
+static bool run_to_armed(void)
+{
+	uint64_t tick;
+
+	pthread_mutex_lock(&wheel_lock);
+	tick = armed_tick;
+	pthread_mutex_unlock(&wheel_lock);
+
+	if (!tick)
+		return false;
+
+	clock_to_tick(tick);
+	timerwheel_run();
+
+	return true;
+}
+
+/*
+ * test_two_levels - Upper level cascade due before a lower level one
+ *
+ * A is armed from tick 1 for 16500 ms and goes to the second upper
+ * level, to be cascaded on tick 16384; with the wheel on tick 16002,
+ * B is armed for 14000 ms and goes to the first upper level, to be
+ * cascaded on tick 29952. The cascade of A comes first.
+ */
+static void test_two_levels(void)
+{
+	struct test_timer a = { .name = "A" }, b = { .name = "B" };
+	uint64_t next;
+
+	timerwheel_setup(&a.timer, timer_fn, 0);
+	timerwheel_setup(&b.timer, timer_fn, 0);
+
+	add_timer(&a, 16500);
+
+	clock_to_tick(16001);
+	timerwheel_run();
+
+	add_timer(&b, 14000);
+
+	pthread_mutex_lock(&wheel_lock);
+	next = armed_tick;
+	pthread_mutex_unlock(&wheel_lock);
+
+	if (next != 16384)
+		fail("armed for tick %llu instead of the cascade on 16384",
+		     (unsigned long long)next);
+
+	while (run_to_armed())
+		;
+
+	if (a.fired != 16501 || b.fired != 30001)
+		fail("A ran on tick %llu (due 16501), B on %llu (due 30001)",
+		     (unsigned long long)a.fired,
+		     (unsigned long long)b.fired);
+}
+
+/*
+ * test_random - Timers on every level, added while the wheel runs
+ *
+ * \param count - Number of timers
+ */
+static void test_random(int count)
+{
+	struct test_timer *timers;
+	unsigned int ms;
+	uint64_t tick;
+	int i, added = 0;
+
+	timers = calloc(count, sizeof(*timers));
+	if (timers == NULL) {
+		fail("cannot allocate %d timers", count);
+		return;
+	}
+
+	fired = 0;
+
+	while (added < count || run_to_armed()) {
+		/* A few new timers, with expiries on any of the levels */
+		for (i = rng() % 4; i > 0 && added < count; i--) {
+			switch (rng() % 3) {
+				case 0:
+					ms = rng() % TVR_SIZE;
+					break;
+				case 1:
+					ms = rng() % (TVR_SIZE * TVN_SIZE);
+					break;
+				default:
+					ms = rng() % TEST_MAX_MS;
+					break;
+			}
+
+			timers[added].name = "random";
+			timerwheel_setup(&timers[added].timer, timer_fn, 0);
+			add_timer(&timers[added], ms);
+			added++;
+		}
+
+		/* Woken up early, now and then */
+		pthread_mutex_lock(&wheel_lock);
+		tick = armed_tick;
+		pthread_mutex_unlock(&wheel_lock);
+
+		if (tick > current_tick() + 1 && (rng() & 1)) {
+			clock_to_tick(current_tick() + 1 +
+				      rng() % (tick - current_tick() - 1));
+			timerwheel_run();
+		} else {
+			run_to_armed();
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (timers[i].timer.pending || !timers[i].fired)
+			fail("timer %d due on tick %llu never ran", i,
+			     (unsigned long long)timers[i].due);
+	}
+
+	if (fired != (unsigned long)count)
+		fail("%lu timers ran out of %d", fired, count);
+
+	free(timers);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -n <count>      Random timers (default %d)\n"
+		"  -s <seed>       Random seed\n"
+		"  -v              More logs, can be repeated\n",
+		prog, TEST_TIMERS);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, count = TEST_TIMERS;
+
+	while ((opt = getopt(argc, argv, "n:s:v")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 's':
+				rng_state = strtoul(optarg, NULL, 0);
+				if (!rng_state)
+					rng_state = 1;
+				break;
+			case 'v':
+				host_log_level++;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (count <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	host_clock_start(NSEC_PER_SEC);
+	if (timerwheel_init(TEST_SLACK_MS) < 0) {
+		fprintf(stderr, "Cannot initialize the timer wheel\n");
+		return 1;
+	}
+
+	test_two_levels();
+	test_random(count);
+
+	printf("%d random timers, last on tick %llu: %lu failures\n",
+	       count, (unsigned long long)current_tick(), failures);
+
+	return failures ? 1 : 0;
+}
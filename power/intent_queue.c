@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-PowerHAL-Queue"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include <utils/Log.h>
+
+#include "intent_queue.h"
+
+/*
+ * Power hints come from any binder thread, while profiles get
+ * applied by one single thread: hints are queued as intents on a
+ * bounded lock-free ring (one sequence number per slot, so that
+ * producers only ever contend on a compare-and-swap of the write
+ * position) and the applier gets woken up through an eventfd.
+ *
+ * The doorbell only gets rung when the applier may be sleeping:
+ * a burst of hints costs one single wakeup.
+ */
+
+#define INTENT_QUEUE_MASK	(INTENT_QUEUE_SIZE - 1)
+
+struct intent_slot {
+	uint32_t seq;
+	struct power_intent intent;
+};
+
+static struct intent_slot ring[INTENT_QUEUE_SIZE];
+static uint32_t enqueue_pos;
+static uint32_t dequeue_pos;	/* Applier only */
+static int doorbell_rung;
+static int efd = -1;
+
+/*
+ * intent_queue_init - Initialize the intents queue
+ *
+ * \return Returns success (0) or failure (negative errno)
+ */
+int intent_queue_init(void)
+{
+	uint32_t i;
+
+	if (efd >= 0)
+		return 0;
+
+	for (i = 0; i < INTENT_QUEUE_SIZE; i++)
+		ring[i].seq = i;
+	enqueue_pos = 0;
+	dequeue_pos = 0;
+	doorbell_rung = 0;
+
+	efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0) {
+		ALOGE("Cannot create intents doorbell: %d", errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+/*
+ * intent_queue_get_fd - Get the file descriptor to watch for intents
+ *
+ * \return Returns the doorbell eventfd, or -1 if not initialized
+ */
+int intent_queue_get_fd(void)
+{
+	return efd;
+}
+
+/*
+ * intent_push - Queue an intent for the applier
+ *
+ * Safe to call from any number of threads at once.
+ *
+ * \param intent - Intent to queue
+ * \return Returns success (0) or failure (negative errno)
+ */
+int intent_push(const struct power_intent *intent)
+{
+	struct intent_slot *slot;
+	uint32_t pos, seq;
+	uint64_t one = 1;
+	int32_t diff;
+
+	if (efd < 0)
+		return -ENODEV;
+
+	pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &ring[pos & INTENT_QUEUE_MASK];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (int32_t)(seq - pos);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&enqueue_pos, &pos,
+					pos + 1, true, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* The applier is this far behind: full */
+			return -ENOSPC;
+		} else {
+			pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->intent = *intent;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	if (!__atomic_exchange_n(&doorbell_rung, 1, __ATOMIC_SEQ_CST) &&
+	    write(efd, &one, sizeof(one)) != sizeof(one))
+		ALOGE("Cannot ring intents doorbell: %d", errno);
+
+	return 0;
+}
+
+/*
+ * intent_pop - Take the oldest intent out of the queue
+ *
+ * Note: Only for the applier thread.
+ *
+ * \param intent - Receives the intent
+ * \return Returns true if an intent was dequeued
+ */
+bool intent_pop(struct power_intent *intent)
+{
+	struct intent_slot *slot = &ring[dequeue_pos & INTENT_QUEUE_MASK];
+	uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+	/* Empty, or a producer is still filling the slot */
+	if ((int32_t)(seq - (dequeue_pos + 1)) < 0)
+		return false;
+
+	*intent = slot->intent;
+	__atomic_store_n(&slot->seq, dequeue_pos + INTENT_QUEUE_SIZE,
+			 __ATOMIC_RELEASE);
+	dequeue_pos++;
+
+	return true;
+}
+
+/*
+ * intent_queue_ack - Acknowledge the doorbell
+ *
+ * To be called by the applier before draining the queue: intents
+ * queued from now on ring the doorbell again.
+ */
+void intent_queue_ack(void)
+{
+	uint64_t count;
+
+	if (efd >= 0 && read(efd, &count, sizeof(count)) < 0 &&
+	    errno != EAGAIN)
+		ALOGE("Cannot read intents doorbell: %d", errno);
+
+	__atomic_store_n(&doorbell_rung, 0, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __INTENT_QUEUE_H__
+#define __INTENT_QUEUE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define INTENT_QUEUE_SIZE	256	/* Power of two */
+
+/*
+ * enum power_intent_t
+ * What a power intent asks for
+ *
+ * INTENT_BASE_MODE:   Set the base power mode, arg is the mode
+ * INTENT_LAUNCH:      Launch started (arg 1) or ended (arg 0)
+ * INTENT_INTERACTION: Touch boost, arg is the duration in ms
+ * INTENT_INTERACTIVE: Screen turned on (arg 1) or off (arg 0)
+ */
+typedef enum {
+	INTENT_BASE_MODE,
+	INTENT_LAUNCH,
+	INTENT_INTERACTION,
+	INTENT_INTERACTIVE,
+	/* Do not use this entry */
+	INTENT_MAX,
+} power_intent_t;
+
+/*
+ * struct power_intent
+ * One request queued for the applier
+ */
+struct power_intent {
+	uint16_t type;		/* From enum power_intent_t */
+	int16_t hint;		/* Originating power hint, -1 if none */
+	int32_t arg;
+	uint64_t start_ns;	/* Time the request was received */
+};
+
+/* Exported functions */
+int intent_queue_init(void);
+int intent_queue_get_fd(void);
+int intent_push(const struct power_intent *intent);
+bool intent_pop(struct power_intent *intent);
+void intent_queue_ack(void);
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-PowerHAL-Interaction"
+
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <cutils/properties.h>
+#include <utils/Log.h>
+
+#include "power.h"
+#include "arbiter.h"
+#include "interaction.h"
+#include "timerwheel.h"
+
+/*
+ * Interaction boost.
+ *
+ * A touch brings the interaction boost to its top level, which makes
+ * the arbiter bring more cores online and lower the thresholds, so
+ * that the start of a gesture doesn't wait for cores to be plugged.
+ * Once the boost time is over, the boost decays one level at a time
+ * instead of going straight back to the base profile.
+ *
+ * Touches coming while the boost is at its top level only push the
+ * decay further, with no profile re-evaluation nor sysfs writes.
+ */
+
+static int cur_level = 0;
+static int default_ms = INTERACTION_DEFAULT_MS;
+static uint64_t boost_end_ms;
+
+static struct tw_timer decay_timer;
+static pthread_mutex_t interaction_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000);
+}
+
+/*
+ * interaction_decay - Decay timer callback
+ *
+ * \param timer - Decay timer
+ */
+static void interaction_decay(struct tw_timer *timer)
+{
+	uint64_t now = monotonic_ms();
+
+	pthread_mutex_lock(&interaction_lock);
+
+	/* Extended by a touch meanwhile */
+	if (now < boost_end_ms) {
+		timerwheel_add(timer, boost_end_ms - now);
+		goto end;
+	}
+
+	if (cur_level > 0) {
+		cur_level--;
+		set_boost_level(cur_level);
+	}
+
+	if (cur_level > 0)
+		timerwheel_add(timer, INTERACTION_STEP_MS);
+
+end:
+	pthread_mutex_unlock(&interaction_lock);
+}
+
+/*
+ * interaction_init - Initialize the interaction boost
+ */
+void interaction_init(void)
+{
+	char propval[PROPERTY_VALUE_MAX];
+
+	property_get(PROP_INTERACTION_MS, propval, "");
+	if (propval[0])
+		default_ms = atoi(propval);
+
+	timerwheel_setup(&decay_timer, interaction_decay, 0);
+}
+
+/*
+ * interaction_hint - Handle a POWER_HINT_INTERACTION hint
+ *
+ * \param duration_ms - Requested boost length, 0 for the default one
+ */
+void interaction_hint(int duration_ms)
+{
+	uint64_t until;
+
+	if (duration_ms <= 0)
+		duration_ms = default_ms;
+	if (duration_ms <= 0)
+		return;
+	if (duration_ms > INTERACTION_MAX_MS)
+		duration_ms = INTERACTION_MAX_MS;
+
+	pthread_mutex_lock(&interaction_lock);
+
+	until = monotonic_ms() + duration_ms;
+
+	if (cur_level != ARBITER_BOOST_LEVELS) {
+		cur_level = ARBITER_BOOST_LEVELS;
+		set_boost_level(cur_level);
+		timerwheel_add(&decay_timer, duration_ms);
+	} else if (until <= boost_end_ms) {
+		goto end;
+	}
+
+	/* Already boosted: the decay timer catches up on expiry */
+	boost_end_ms = until;
+
+end:
+	pthread_mutex_unlock(&interaction_lock);
+}
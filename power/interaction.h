@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __INTERACTION_H__
+#define __INTERACTION_H__
+
+#define INTERACTION_DEFAULT_MS	500	/* Boost length without hint data */
+#define INTERACTION_MAX_MS	5000
+#define INTERACTION_STEP_MS	100	/* Time spent on each decay level */
+
+/* Exported functions */
+void interaction_init(void);
+void interaction_hint(int duration_ms);
+
+#endif
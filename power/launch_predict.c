@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RQBalance-PowerHAL-Launch"
+
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <utils/Log.h>
+
+#include "power.h"
+#include "launch_predict.h"
+#include "timerwheel.h"
+
+/*
+ * Launch boost prediction.
+ *
+ * Android sends POWER_HINT_LAUNCH when an application starts launching
+ * and again, with no data, when it is done, but the second hint may
+ * never come. The start and end time of the recent launches are kept
+ * in a ring buffer and the PERFORMANCE mode gets released automatically
+ * after the 95th percentile of the launch durations seen so far, unless
+ * the end hint comes first.
+ *
+ * A start hint arriving while a launch is in progress is the same
+ * launch being hinted again: it only pushes the release further.
+ */
+
+struct launch_entry {
+	uint64_t start_ms;
+	uint32_t duration_ms;	/* 0: still running or never ended */
+};
+
+static struct launch_entry history[LAUNCH_HISTORY];
+static unsigned int history_head = 0;	/* Next entry to write */
+static unsigned int history_count = 0;
+
+static bool launch_active = false;
+static bool launch_expired = false;
+static uint64_t release_at_ms;
+static uint32_t hold_ms = LAUNCH_DEFAULT_HOLD_MS;
+
+static uint32_t total_launches = 0;
+static uint32_t auto_releases = 0;
+static uint32_t late_ends = 0;
+
+static struct tw_timer release_timer;
+static pthread_mutex_t launch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000);
+}
+
+/*
+ * percentile - Get a percentile out of a set of values
+ *
+ * \param vals - Values, sorted in place
+ * \param n - Number of values
+ * \param pct - Percentile (0-100)
+ * \return Returns the percentile value, 0 if there are no values
+ */
+static uint32_t percentile(uint32_t *vals, int n, int pct)
+{
+	uint32_t tmp;
+	int i, j, idx;
+
+	if (n <= 0)
+		return 0;
+
+	/* Few entries: insertion sort is just fine */
+	for (i = 1; i < n; i++) {
+		tmp = vals[i];
+		for (j = i; j > 0 && vals[j - 1] > tmp; j--)
+			vals[j] = vals[j - 1];
+		vals[j] = tmp;
+	}
+
+	/* Nearest rank */
+	idx = ((n * pct) + 99) / 100 - 1;
+	if (idx < 0)
+		idx = 0;
+
+	return vals[idx];
+}
+
+/*
+ * history_at - Get an entry of the history, newest first
+ *
+ * Note: Has to be called with launch_lock held.
+ *
+ * \param age - 0 for the newest entry
+ * \return Returns the entry
+ */
+static struct launch_entry *history_at(unsigned int age)
+{
+	return &history[(history_head + LAUNCH_HISTORY - 1 - age) %
+			LAUNCH_HISTORY];
+}
+
+/*
+ * collect_durations - Collect the durations of the ended launches
+ *
+ * Note: Has to be called with launch_lock held.
+ *
+ * \param vals - Array of LAUNCH_HISTORY values to fill
+ * \return Returns number of values
+ */
+static int collect_durations(uint32_t *vals)
+{
+	unsigned int i;
+	int n = 0;
+
+	for (i = 0; i < history_count; i++) {
+		if (history_at(i)->duration_ms)
+			vals[n++] = history_at(i)->duration_ms;
+	}
+
+	return n;
+}
+
+/*
+ * collect_intervals - Collect the times between launch starts
+ *
+ * Note: Has to be called with launch_lock held.
+ *
+ * \param vals - Array of LAUNCH_HISTORY values to fill
+ * \return Returns number of values
+ */
+static int collect_intervals(uint32_t *vals)
+{
+	unsigned int i;
+	int n = 0;
+
+	for (i = 0; i + 1 < history_count; i++)
+		vals[n++] = history_at(i)->start_ms - history_at(i + 1)->start_ms;
+
+	return n;
+}
+
+/*
+ * update_hold - Predict how long the next launches will need
+ *
+ * Note: Has to be called with launch_lock held.
+ */
+static void update_hold(void)
+{
+	uint32_t vals[LAUNCH_HISTORY];
+	int n;
+
+	n = collect_durations(vals);
+	if (n < LAUNCH_MIN_SAMPLES) {
+		hold_ms = LAUNCH_DEFAULT_HOLD_MS;
+		return;
+	}
+
+	hold_ms = percentile(vals, n, LAUNCH_PERCENTILE);
+	if (hold_ms < LAUNCH_MIN_HOLD_MS)
+		hold_ms = LAUNCH_MIN_HOLD_MS;
+	else if (hold_ms > LAUNCH_MAX_HOLD_MS)
+		hold_ms = LAUNCH_MAX_HOLD_MS;
+}
+
+/*
+ * launch_release - Drop the launch boost
+ *
+ * Only the vote taken by launch_start() goes away: the base mode
+ * and the other requests are left as they are.
+ *
+ * Note: Has to be called with launch_lock held.
+ */
+static void launch_release(void)
+{
+	launch_active = false;
+	lock_power_mode(POWER_MODE_PERFORMANCE, 0, false);
+}
+
+/*
+ * launch_timeout - Release timer callback
+ *
+ * \param timer - Release timer
+ */
+static void launch_timeout(struct tw_timer *timer __attribute__((unused)))
+{
+	pthread_mutex_lock(&launch_lock);
+
+	/* The launch may have been hinted again meanwhile */
+	if (launch_active && monotonic_ms() >= release_at_ms) {
+		ALOGD("Launch not ended after %u ms, releasing", hold_ms);
+		launch_expired = true;
+		auto_releases++;
+		launch_release();
+	}
+
+	pthread_mutex_unlock(&launch_lock);
+}
+
+/*
+ * launch_start - Handle a launch start hint
+ *
+ * Note: Has to be called with launch_lock held.
+ *
+ * \param now - Current time in milliseconds
+ */
+static void launch_start(uint64_t now)
+{
+	struct launch_entry *entry;
+
+	if (launch_active) {
+		/* Same launch, hinted again */
+		release_at_ms = now + hold_ms;
+		timerwheel_add(&release_timer, hold_ms);
+		return;
+	}
+
+	entry = &history[history_head];
+	entry->start_ms = now;
+	entry->duration_ms = 0;
+	history_head = (history_head + 1) % LAUNCH_HISTORY;
+	if (history_count < LAUNCH_HISTORY)
+		history_count++;
+
+	total_launches++;
+	launch_active = true;
+	launch_expired = false;
+	release_at_ms = now + hold_ms;
+
+	lock_power_mode(POWER_MODE_PERFORMANCE, 0, true);
+	timerwheel_add(&release_timer, hold_ms);
+}
+
+/*
+ * launch_end - Handle a launch end hint
+ *
+ * Note: Has to be called with launch_lock held.
+ *
+ * \param now - Current time in milliseconds
+ */
+static void launch_end(uint64_t now)
+{
+	struct launch_entry *entry;
+
+	if (!history_count)
+		return;
+
+	/* Learn from launches released too early, too */
+	entry = history_at(0);
+	if (!entry->duration_ms && (launch_active || launch_expired)) {
+		entry->duration_ms = now - entry->start_ms;
+		if (!entry->duration_ms)
+			entry->duration_ms = 1;
+		if (launch_expired)
+			late_ends++;
+		update_hold();
+	}
+
+	launch_expired = false;
+
+	if (launch_active) {
+		timerwheel_del(&release_timer);
+		launch_release();
+	}
+}
+
+/*
+ * launch_predict_init - Initialize the launch predictor
+ */
+void launch_predict_init(void)
+{
+	timerwheel_setup(&release_timer, launch_timeout, 0);
+}
+
+/*
+ * launch_predict_hint - Handle a POWER_HINT_LAUNCH hint
+ *
+ * \param start - true: launch started, false: launch ended
+ */
+void launch_predict_hint(bool start)
+{
+	uint64_t now = monotonic_ms();
+
+	pthread_mutex_lock(&launch_lock);
+
+	if (start)
+		launch_start(now);
+	else
+		launch_end(now);
+
+	pthread_mutex_unlock(&launch_lock);
+}
+
+/*
+ * launch_predict_stats - Get the launch predictor statistics
+ *
+ * \param stats - Array to fill, indexed by enum launch_stat_t
+ * \param max - Size of the array
+ * \return Returns number of statistics filled
+ */
+int launch_predict_stats(int32_t *stats, int max)
+{
+	uint32_t vals[LAUNCH_HISTORY];
+	int32_t all[LAUNCH_STAT_MAX];
+	int n;
+
+	pthread_mutex_lock(&launch_lock);
+
+	n = collect_durations(vals);
+	all[LAUNCH_STAT_SAMPLES] = n;
+	all[LAUNCH_STAT_DURATION_P95] = percentile(vals, n, LAUNCH_PERCENTILE);
+	all[LAUNCH_STAT_DURATION_P50] = percentile(vals, n, 50);
+
+	n = collect_intervals(vals);
+	all[LAUNCH_STAT_INTERVAL_P50] = percentile(vals, n, 50);
+
+	all[LAUNCH_STAT_HOLD] = hold_ms;
+	all[LAUNCH_STAT_LAUNCHES] = total_launches;
+	all[LAUNCH_STAT_AUTO_RELEASES] = auto_releases;
+	all[LAUNCH_STAT_LATE_ENDS] = late_ends;
+
+	pthread_mutex_unlock(&launch_lock);
+
+	if (max > LAUNCH_STAT_MAX)
+		max = LAUNCH_STAT_MAX;
+	if (max < 0)
+		max = 0;
+
+	memcpy(stats, all, max * sizeof(int32_t));
+
+	return max;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __LAUNCH_PREDICT_H__
+#define __LAUNCH_PREDICT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LAUNCH_HISTORY		32	/* Launches remembered */
+#define LAUNCH_MIN_SAMPLES	8	/* Launches needed to predict */
+#define LAUNCH_DEFAULT_HOLD_MS	3000	/* Hold while still learning */
+#define LAUNCH_MIN_HOLD_MS	200
+#define LAUNCH_MAX_HOLD_MS	5000
+#define LAUNCH_PERCENTILE	95
+
+/*
+ * enum launch_stat_t
+ * Launch predictor statistics, in the order they get reported
+ *
+ * All the times are in milliseconds.
+ */
+typedef enum {
+	LAUNCH_STAT_SAMPLES,		/* Launches in the history */
+	LAUNCH_STAT_DURATION_P50,	/* Median launch duration */
+	LAUNCH_STAT_DURATION_P95,	/* 95th percentile launch duration */
+	LAUNCH_STAT_INTERVAL_P50,	/* Median time between launches */
+	LAUNCH_STAT_HOLD,		/* Current auto-release timeout */
+	LAUNCH_STAT_LAUNCHES,		/* Launches since boot */
+	LAUNCH_STAT_AUTO_RELEASES,	/* Launches released by timeout */
+	LAUNCH_STAT_LATE_ENDS,		/* Launches ended after timeout */
+	/* Do not use this entry */
+	LAUNCH_STAT_MAX,
+} launch_stat_t;
+
+/* Exported functions */
+void launch_predict_init(void);
+void launch_predict_hint(bool start);
+int launch_predict_stats(int32_t *stats, int max);
+
+#endif
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-PowerHAL-Metrics"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <utils/Log.h>
+
+#include "power.h"
+#include "metrics.h"
+#include "profiles.h"
+#include "rqbalance_halext.h"
+
+/*
+ * PowerHAL metrics, to tune the configuration with real data:
+ *
+ * - Time spent in each profile and number of profile transitions
+ * - Latency of each power hint, from power_hint() entry to the end
+ *   of the batch that applied it, last sysfs write included, as a
+ *   log2 histogram: queueing on the PowerServer is accounted for
+ * - Performance locks acquired, by lock type
+ * - Timer wheel runs and expired timers
+ *
+ * All counters only ever grow, from boot: readers can diff dumps.
+ */
+
+#define NSEC_PER_MSEC	1000000ULL
+#define NSEC_PER_USEC	1000ULL
+
+struct hint_metrics {
+	uint32_t count;
+	uint64_t total_us;
+	uint32_t max_us;
+	uint32_t buckets[METRICS_LAT_BUCKETS];
+};
+
+static uint64_t mode_residency_ms[MAX_PROFILES];
+static uint32_t mode_transitions[MAX_PROFILES];
+static int cur_mode = -1;
+static uint64_t mode_since_ns;
+
+static struct hint_metrics hints[METRICS_MAX_HINTS];
+static uint32_t lock_counts[MAX_LOCK_TYPES];
+static uint32_t timer_runs;
+static uint64_t timer_expiries;
+
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * metrics_now_ns - Get a timestamp for the metrics
+ *
+ * \return Returns monotonic time in nanoseconds
+ */
+uint64_t metrics_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/*
+ * account_mode - Add the time spent in the current mode
+ *
+ * Note: Has to be called with metrics_mutex held.
+ *
+ * \param now - Current time in nanoseconds
+ */
+static void account_mode(uint64_t now)
+{
+	if (cur_mode >= 0)
+		mode_residency_ms[cur_mode] +=
+			(now - mode_since_ns) / NSEC_PER_MSEC;
+
+	/* Keep the remainder, not to lose it on frequent dumps */
+	mode_since_ns = now - ((now - mode_since_ns) % NSEC_PER_MSEC);
+}
+
+/*
+ * metrics_mode - Record the profile being applied
+ *
+ * \param mode - Profile index
+ */
+void metrics_mode(int mode)
+{
+	uint64_t now = metrics_now_ns();
+
+	if (mode < 0 || mode >= MAX_PROFILES)
+		return;
+
+	pthread_mutex_lock(&metrics_mutex);
+
+	if (mode != cur_mode) {
+		account_mode(now);
+		mode_since_ns = now;
+		mode_transitions[mode]++;
+		cur_mode = mode;
+	}
+
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+/*
+ * metrics_hint - Record the latency of a power hint
+ *
+ * \param hint - Power hint (from power_hint_t)
+ * \param start_ns - Time the hint was received, from metrics_now_ns()
+ */
+void metrics_hint(int hint, uint64_t start_ns)
+{
+	struct hint_metrics *hm;
+	uint64_t us = (metrics_now_ns() - start_ns) / NSEC_PER_USEC;
+	int bucket = 0;
+
+	if (hint < 0 || hint >= METRICS_MAX_HINTS)
+		return;
+
+	while (bucket < METRICS_LAT_BUCKETS - 1 && (us >> (bucket + 1)))
+		bucket++;
+
+	pthread_mutex_lock(&metrics_mutex);
+
+	hm = &hints[hint];
+	hm->count++;
+	hm->total_us += us;
+	if (us > hm->max_us)
+		hm->max_us = us;
+	hm->buckets[bucket]++;
+
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+/*
+ * metrics_lock - Record a performance lock acquisition
+ *
+ * \param type - Lock type (from LOCKTYPE)
+ */
+void metrics_lock(int type)
+{
+	if (type < 0 || type >= MAX_LOCK_TYPES)
+		return;
+
+	pthread_mutex_lock(&metrics_mutex);
+	lock_counts[type]++;
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+/*
+ * metrics_timers - Record a timer wheel run
+ *
+ * \param expired - Number of timers expired in this run
+ */
+void metrics_timers(int expired)
+{
+	pthread_mutex_lock(&metrics_mutex);
+	timer_runs++;
+	if (expired > 0)
+		timer_expiries += expired;
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+/*
+ * metrics_dump - Dump all the metrics as text
+ *
+ * One line per item, as "<section> <key> <name>=<value>...",
+ * skipping anything that never happened.
+ *
+ * \param buf - Destination buffer
+ * \param len - Size of the buffer
+ * \return Returns the length of the dump, truncated to fit
+ */
+int metrics_dump(char *buf, size_t len)
+{
+	struct hint_metrics *hm;
+	size_t off = 0;
+	int i, b;
+
+#define DUMP(...)							\
+	do {								\
+		if (off < len)						\
+			off += snprintf(buf + off, len - off, __VA_ARGS__); \
+	} while (0)
+
+	if (!len)
+		return 0;
+
+	pthread_mutex_lock(&metrics_mutex);
+
+	account_mode(metrics_now_ns());
+
+	for (i = 0; i < profiles_count() && i < MAX_PROFILES; i++) {
+		if (!mode_transitions[i])
+			continue;
+		DUMP("mode %s residency_ms=%llu transitions=%u%s\n",
+		     profile_name(i),
+		     (unsigned long long)mode_residency_ms[i],
+		     mode_transitions[i], i == cur_mode ? " current" : "");
+	}
+
+	for (i = 0; i < METRICS_MAX_HINTS; i++) {
+		hm = &hints[i];
+		if (!hm->count)
+			continue;
+		DUMP("hint %d count=%u avg_us=%llu max_us=%u hist=", i,
+		     hm->count, (unsigned long long)(hm->total_us / hm->count),
+		     hm->max_us);
+		for (b = 0; b < METRICS_LAT_BUCKETS; b++)
+			DUMP("%s%u", b ? "," : "", hm->buckets[b]);
+		DUMP("\n");
+	}
+
+	for (i = 0; i < MAX_LOCK_TYPES; i++) {
+		if (lock_counts[i])
+			DUMP("lock 0x%02x count=%u\n", i, lock_counts[i]);
+	}
+
+	DUMP("timers runs=%u expired=%llu\n", timer_runs,
+	     (unsigned long long)timer_expiries);
+
+	pthread_mutex_unlock(&metrics_mutex);
+
+#undef DUMP
+
+	return off < len ? (int)off : (int)len - 1;
+}
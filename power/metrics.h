@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_MAX_HINTS	16	/* power_hint_t values tracked */
+#define METRICS_LAT_BUCKETS	16	/* Bucket n: up to 2^(n+1) us */
+#define METRICS_DUMP_MAX	4096
+
+/* Exported functions */
+uint64_t metrics_now_ns(void);
+void metrics_mode(int mode);
+void metrics_hint(int hint, uint64_t start_ns);
+void metrics_lock(int type);
+void metrics_timers(int expired);
+int metrics_dump(char *buf, size_t len);
+
+#endif
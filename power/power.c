@@ -18,14 +18,12 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/socket.h>
-#include <sys/un.h>
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
 
-#include <private/android_filesystem_config.h>
 #include <cutils/properties.h>
 #include <utils/Log.h>
 
@@ -33,28 +31,41 @@
 #include <hardware/power.h>
 
 #include "power.h"
+#include "arbiter.h"
+#include "boost.h"
+#include "cluster_ctl.h"
+#include "intent_queue.h"
+#include "interaction.h"
+#include "launch_predict.h"
+#include "metrics.h"
+#include "powerserver.h"
+#include "profiles.h"
 #include "rqbalance_halext.h"
+#include "sysfs_cache.h"
+#include "sysfs_journal.h"
+#include "thermal.h"
+#include "timerwheel.h"
 
 #define LOG_TAG "RQBalance-PowerHAL"
 
-static struct rqbalance_params *rqb;
 static int hal_init_ok = false;
-static rqb_pwr_mode_t cur_pwrmode;
+static int cur_pwrmode;
+static unsigned long total_skipped_writes = 0;
+static int lock_batch_depth = 0;
+static bool lock_batch_dirty = false;
+
+/*
+ * All the profile changes happen on the PowerServer thread: power
+ * hints get queued as intents and applied from there, in batches.
+ * The applier lock is held by the PowerServer while it works and
+ * by whoever applies intents directly when it is not running.
+ */
+static pthread_mutex_t applier_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool suspended = false;
 
 /* Remove this when all platforms will be migrated? */
 static bool param_perf_supported = true;
 
-/* PowerServer */
-static int sock;
-static int clientsock;
-static struct sockaddr_un server_addr;
-static pthread_t powerserver_thread;
-static bool psthread_run = true;
-
-/* XML Configuration support */
-extern int parse_xml_data(char* filepath,
-            char* node, struct rqbalance_params *therqb);
-
 #define UNUSED __attribute__((unused))
 
 /*
@@ -66,14 +77,15 @@ extern int parse_xml_data(char* filepath,
  */
 static bool sysfs_write(char *path, char *s)
 {
-    char buf[80];
+    char buf[80], rpath[SYSFS_PATH_MAX];
     int len;
-    int fd = open(path, O_WRONLY);
+    int fd = open(sysfs_path(path, rpath, sizeof(rpath)), O_WRONLY);
     bool ret = true;
 
     if (fd < 0) {
         strerror_r(errno, buf, sizeof(buf));
         ALOGE("Error opening %s: %s\n", path, buf);
+        sysfs_journal_write(path, s, false);
         return false;
     }
 
@@ -86,6 +98,7 @@ static bool sysfs_write(char *path, char *s)
     }
 
     close(fd);
+    sysfs_journal_write(path, s, ret);
 
     return ret;
 }
@@ -93,54 +106,49 @@ static bool sysfs_write(char *path, char *s)
 /*
  * rqb_param_string - Get power mode string
  *
- * \param pwrmode - RQBalance Power Mode (from enum rqb_pwr_mode_t)
+ * \param pwrmode - Profile index (built-in modes from enum rqb_pwr_mode_t)
  * \param compat - Switch for compatibility string
  * \return Returns compat or new power mode string
  */
-static char* rqb_param_string(rqb_pwr_mode_t pwrmode, bool compat)
+static const char* rqb_param_string(int pwrmode, bool compat)
 {
-    char* type_string;
     char* compat_string;
 
+    if (!compat)
+        return profile_name(pwrmode);
+
     switch (pwrmode) {
         case POWER_MODE_BATTERYSAVE:
-            type_string = "batterysave";
             compat_string = "low";
             break;
         case POWER_MODE_BALANCED:
-            type_string = "balanced";
             compat_string = "normal";
             break;
         case POWER_MODE_PERFORMANCE:
-            type_string = "performance";
             compat_string = "perf";
             break;
         case POWER_MODE_OMXDECODE:
-            type_string = "video_decoding";
             compat_string = "vdec";
             break;
         case POWER_MODE_OMXENCODE:
-            type_string = "video_encoding";
             compat_string = "venc";
+            break;
         default:
             return "unknown";
     }
 
-    if (compat)
-        return compat_string;
-
-    return type_string;
+    return compat_string;
 }
 
 /*
  * print_parameters - Print PowerHAL RQBalance parameters to ALOG
  *
- * \param pwrmode - RQBalance Power Mode (from enum rqb_pwr_mode_t)
+ * \param pwrmode - Profile index (built-in modes from enum rqb_pwr_mode_t)
  */
-static void print_parameters(rqb_pwr_mode_t pwrmode)
+static void print_parameters(int pwrmode)
 {
-    char* mode_string = rqb_param_string(pwrmode, false);
-    struct rqbalance_params *cur_params = &rqb[pwrmode];
+    const char* mode_string = rqb_param_string(pwrmode, false);
+    struct rqbalance_params *cur_params = profile_params(pwrmode);
 
     ALOGI("Parameters for %s mode:", mode_string);
     ALOGI("Minimum cores:       %s", cur_params->min_cpus);
@@ -153,27 +161,46 @@ static void print_parameters(rqb_pwr_mode_t pwrmode)
 /*
  * _set_power_mode - Writes power configuration to the RQBalance driver
  *
+ * Only the parameters that differ from the last written ones
+ * are actually sent to the driver.
+ *
  * \param rqparm - RQBalance Power Mode parameters struct
+ * \return Returns the number of skipped (unchanged) parameter writes
  */
-static void __set_power_mode(struct rqbalance_params *rqparm)
+static int __set_power_mode(struct rqbalance_params *rqparm)
 {
-    bool ret, cpus_error;
+    bool cpus_error = false;
     short retry = 0;
-
-
-    sysfs_write(SYS_UPCORE_THRESH, rqparm->up_thresholds);
-    sysfs_write(SYS_DNCORE_THRESH, rqparm->down_thresholds);
-    sysfs_write(SYS_BALANCE_LVL, rqparm->balance_level);
+    int ret, skipped = 0;
+
+    if (sysfs_cache_update(SYSFS_NODE_UPCORE_THRESH,
+                           rqparm->up_thresholds) == 0)
+        skipped++;
+    if (sysfs_cache_update(SYSFS_NODE_DNCORE_THRESH,
+                           rqparm->down_thresholds) == 0)
+        skipped++;
+    if (sysfs_cache_update(SYSFS_NODE_BALANCE_LVL,
+                           rqparm->balance_level) == 0)
+        skipped++;
 
 set_cpu:
-    ret = sysfs_write(SYS_MAX_CPUS, rqparm->max_cpus);
-    if (!ret)
+    ret = sysfs_cache_update(SYSFS_NODE_MAX_CPUS, rqparm->max_cpus);
+    if (ret < 0)
         cpus_error = true;
+    else if (ret == 0 && !retry)
+        skipped++;
 
-    ret = sysfs_write(SYS_MIN_CPUS, rqparm->min_cpus);
-    if (!ret)
+    ret = sysfs_cache_update(SYSFS_NODE_MIN_CPUS, rqparm->min_cpus);
+    if (ret < 0)
         cpus_error = true;
-
+    else if (ret == 0 && !retry)
+        skipped++;
+
+    /*
+     * The driver refuses min_cpus > max_cpus and vice-versa, so
+     * one of the two may fail depending on the previous mode:
+     * retry once, the succeeded one will be skipped this time.
+     */
     if (cpus_error) {
         cpus_error = false;
         retry++;
@@ -182,8 +209,9 @@ set_cpu:
             goto set_cpu;
     }
 
+    total_skipped_writes += skipped;
 
-    return;
+    return skipped;
 }
 
 /*
@@ -201,9 +229,11 @@ void __set_special_power_mode(char* max_cpus, char* min_cpus,
                               char* up_thresholds, char* down_thresholds,
                               char* balance_level) {
     struct rqbalance_params *setparam;
-    struct rqbalance_params *current = &rqb[cur_pwrmode];
+    struct rqbalance_params *current = profile_params(cur_pwrmode);
 
-    setparam = malloc(sizeof(struct rqbalance_params));
+    setparam = calloc(1, sizeof(struct rqbalance_params));
+    if (!setparam)
+        return;
 
     if (max_cpus)
         memcpy(setparam->max_cpus, max_cpus,
@@ -248,164 +278,401 @@ void __set_special_power_mode(char* max_cpus, char* min_cpus,
 }
 
 /*
- * set_power_mode - Writes power configuration to the RQBalance driver
+ * apply_power_mode - Resolve the effective profile out of all the
+ *                    requested modes and write it to the driver
+ */
+static void apply_power_mode(void)
+{
+    struct rqbalance_params effective;
+    struct rqb_cluster_params clusters[TOPOLOGY_MAX_CLUSTERS];
+    int mode, skipped;
+
+    mode = arbiter_resolve(profiles_get(), &effective, clusters);
+
+    ALOGI("Setting %s mode", rqb_param_string(mode, false));
+
+    skipped = __set_power_mode(&effective);
+    skipped += cluster_ctl_apply(clusters);
+    metrics_mode(mode);
+    sysfs_journal_mode(mode);
+    ALOGD("%d unchanged parameters skipped (%lu total)",
+          skipped, total_skipped_writes);
+
+    cur_pwrmode = mode;
+}
+
+/*
+ * set_power_mode - Sets the base power mode, as requested by Android,
+ *                  and writes the resulting configuration to the
+ *                  RQBalance driver
  *
  * \param mode - RQBalance Power Mode (from enum rqb_pwr_mode_t)
  */
 void set_power_mode(rqb_pwr_mode_t mode)
 {
-    char* mode_string = rqb_param_string(mode, false);
-
     if (mode == POWER_MODE_PERFORMANCE && !param_perf_supported)
         return;
 
-    ALOGI("Setting %s mode", mode_string);
+    arbiter_set_base(mode);
 
-    __set_power_mode(&rqb[mode]);
+    if (lock_batch_depth > 0) {
+        lock_batch_dirty = true;
+        return;
+    }
 
-    cur_pwrmode = mode;
+    apply_power_mode();
 }
 
-static void *powerserver_looper(void *unusedvar UNUSED)
+/*
+ * lock_power_mode - Adds or removes a request for a profile on
+ *                   behalf of a performance lock, then writes the
+ *                   resulting configuration to the RQBalance driver
+ *
+ * \param mode - Profile index (built-in modes from enum rqb_pwr_mode_t)
+ * \param clusters - Bitmask of the clusters the request is pinned to,
+ *                   0 for the whole SoC
+ * \param enable - true: lock acquired, false: lock released
+ */
+void lock_power_mode(int mode, unsigned int clusters, bool enable)
 {
-    int ret;
-    int32_t halext_reply = -EINVAL;
-    uint8_t retry;
-    socklen_t clientlen = sizeof(struct sockaddr_un);
-    struct sockaddr_un client_addr;
-    struct rqbalance_halext_params extparams;
-
-reloop:
-    ALOGI("PowerServer is waiting for connection...");
-    if (clientsock)
-        close(clientsock);
-    retry = 0;
-    while (((clientsock = accept(sock, (struct sockaddr*)&client_addr,
-            &clientlen)) > 0) && (psthread_run == true))
-    {
-        ret = recv(clientsock, &extparams,
-              sizeof(struct rqbalance_halext_params), 0);
-        if (!ret) {
-            ALOGE("Cannot receive data from client");
-            goto reloop;
-        }
+    arbiter_vote(mode, clusters, enable);
 
-        if (ret != sizeof(struct rqbalance_halext_params)) {
-            ALOGE("Received data size mismatch!!");
-            goto reloop;
-        } else ret = 0;
-
-        if (extparams.acquire)
-             halext_reply = halext_perf_lock_acquire(&extparams);
-        else
-             halext_reply = halext_perf_lock_release(extparams.id);
-
-retry_send:
-	retry++;
-        ret = send(clientsock, &halext_reply, sizeof(halext_reply), 0);
-	if (ret == -1) {
-		halext_reply = -EINVAL;
-		if (retry < 50)
-			goto retry_send;
-		ALOGE("ERROR: Cannot send reply!!!");
-		goto reloop;
-	} else retry = 0;
-
-        if (clientsock)
-            close(clientsock);
+    if (lock_batch_depth > 0) {
+        lock_batch_dirty = true;
+        return;
     }
 
-    ALOGI("PowerServer terminated.");
-    return NULL;
+    apply_power_mode();
 }
 
-static int manage_powerserver(bool start)
+/*
+ * lock_cpus_floor - Sets the minimum number of online cores on behalf
+ *                   of the performance locks, then writes the resulting
+ *                   configuration to the RQBalance driver
+ *
+ * \param ncpus - Minimum number of online cores, 0 for no floor
+ */
+void lock_cpus_floor(int ncpus)
 {
-    int ret;
-    struct stat st = {0};
+    arbiter_set_cpus_floor(ncpus);
 
-    if (start == false) {
-        psthread_run = false;
-        if (clientsock) {
-            shutdown(clientsock, SHUT_RDWR);
-            close(clientsock);
-        }
-        if (sock) {
-            shutdown(sock, SHUT_RDWR);
-            close(sock);
+    if (lock_batch_depth > 0) {
+        lock_batch_dirty = true;
+        return;
+    }
+
+    apply_power_mode();
+}
+
+/*
+ * lock_freq_floor - Sets the clusters that have to run at their maximum
+ *                   frequency on behalf of the performance locks, then
+ *                   writes the resulting configuration
+ *
+ * \param clusters - Bitmask of the clusters, 0 for no floor
+ */
+void lock_freq_floor(unsigned int clusters)
+{
+    arbiter_set_freq_floor(clusters);
+
+    if (lock_batch_depth > 0) {
+        lock_batch_dirty = true;
+        return;
+    }
+
+    apply_power_mode();
+}
+
+/*
+ * set_boost_level - Sets the interaction boost level, then writes the
+ *                   resulting configuration to the RQBalance driver
+ *
+ * \param level - Boost level, 0 for no boost
+ */
+void set_boost_level(int level)
+{
+    arbiter_set_boost_level(level);
+
+    if (lock_batch_depth > 0) {
+        lock_batch_dirty = true;
+        return;
+    }
+
+    apply_power_mode();
+}
+
+/*
+ * set_thermal_level - Sets the thermal budget, lowering the thermal
+ *                     online cores limit of the RQBalance driver, then
+ *                     writes the resulting configuration
+ *
+ * \param level - Thermal level, NULL for no thermal budget
+ */
+void set_thermal_level(const struct rqb_thermal_level *level)
+{
+    struct rqbalance_params *balanced = profile_params(POWER_MODE_BALANCED);
+    char max_cpus[sizeof(balanced->max_cpus)];
+
+    if (level && level->max_cpus) {
+        if (snprintf(max_cpus, sizeof(max_cpus), "%u",
+                     level->max_cpus) >= (int)sizeof(max_cpus)) {
+            ALOGE("Thermal cores limit %u out of range", level->max_cpus);
+            snprintf(max_cpus, sizeof(max_cpus), "%s", balanced->max_cpus);
         }
+    } else {
+        snprintf(max_cpus, sizeof(max_cpus), "%s", balanced->max_cpus);
+    }
+    sysfs_write(SYS_THERM_CPUS, max_cpus);
+
+    arbiter_set_thermal(level);
 
-        return 0;
+    if (lock_batch_depth > 0) {
+        lock_batch_dirty = true;
+        return;
+    }
+
+    apply_power_mode();
+}
+
+/*
+ * power_batch_begin - Start collecting lock requests without applying
+ *                     them, so that a burst of lock changes (i.e. many
+ *                     locks expiring together) costs one single profile
+ *                     re-evaluation.
+ *
+ * Note: Only for the PowerServer thread, which owns all the locks.
+ */
+void power_batch_begin(void)
+{
+    lock_batch_depth++;
+}
+
+/*
+ * power_batch_end - Stop collecting lock requests and apply the
+ *                   resulting profile, if anything changed
+ */
+void power_batch_end(void)
+{
+    if (lock_batch_depth == 0 || --lock_batch_depth > 0)
+        return;
+
+    if (lock_batch_dirty) {
+        lock_batch_dirty = false;
+        apply_power_mode();
     }
+}
+
+/*
+ * power_lock - Takes the applier lock
+ */
+void power_lock(void)
+{
+    pthread_mutex_lock(&applier_lock);
+}
+
+/*
+ * power_unlock - Releases the applier lock
+ */
+void power_unlock(void)
+{
+    pthread_mutex_unlock(&applier_lock);
+}
 
-    psthread_run = true;
+/*
+ * set_suspended - Suspends or resumes the PowerHAL on screen changes
+ *
+ * The PowerServer doesn't go anywhere while the screen is off: it
+ * keeps serving its clients, timers and thermal events, but only
+ * the screen off profile gets applied. Locks held or acquired
+ * meanwhile are kept and take effect on resume, power collapse
+ * included.
+ *
+ * \param suspend - true: screen off, false: screen on
+ */
+static void set_suspended(bool suspend)
+{
+    if (suspend == suspended)
+        return;
+
+    ALOGI("Device is %s.", suspend ? "asleep" : "awake");
 
-    /* Create folder, if doesn't exist */
-    if (stat(POWERSERVER_DIR, &st) == -1) {
-        mkdir(POWERSERVER_DIR, 0773);
+    suspended = suspend;
+    arbiter_set_suspended(suspend);
+    boost_set_suspended(suspend);
+    set_power_mode(suspend ? POWER_MODE_BATTERYSAVE : POWER_MODE_BALANCED);
+}
+
+/*
+ * power_suspended - Checks if the screen is off
+ *
+ * Note: Only for the PowerServer thread.
+ *
+ * \return Returns true while suspended
+ */
+bool power_suspended(void)
+{
+    return suspended;
+}
+
+/*
+ * apply_intent - Executes one intent
+ *
+ * \param intent - Intent
+ */
+static void apply_intent(struct power_intent *intent)
+{
+    switch (intent->type) {
+        case INTENT_BASE_MODE:
+            set_power_mode(intent->arg);
+            break;
+        case INTENT_LAUNCH:
+            launch_predict_hint(intent->arg != 0);
+            break;
+        case INTENT_INTERACTION:
+            interaction_hint(intent->arg);
+            break;
+        case INTENT_INTERACTIVE:
+            set_suspended(!intent->arg);
+            break;
+        default:
+            break;
     }
+}
 
-    /* Get socket in the UNIX domain */
-    sock = socket(PF_UNIX, SOCK_SEQPACKET, 0);
-    if (sock < 0) {
-        ALOGE("Could not create the socket");
-        return -EPROTO;
+/*
+ * intent_superseded - Checks if an intent gets overridden by a later
+ *                     one of the same kind
+ *
+ * Base mode and screen state intents only matter as the last one:
+ * quick screen toggles collapse into one single transition.
+ *
+ * \param intent - Intent
+ * \param index - Position of the intent in the batch
+ * \param last - Position of the last intent of each type in the batch
+ * \return Returns true if the intent can be skipped
+ */
+static bool intent_superseded(struct power_intent *intent, int index,
+                              int *last)
+{
+    switch (intent->type) {
+        case INTENT_BASE_MODE:
+        case INTENT_INTERACTIVE:
+            return index != last[intent->type];
+        default:
+            break;
     }
 
-    /* Create address */
-    memset(&server_addr, 0, sizeof(struct sockaddr_un));
-    server_addr.sun_family = AF_UNIX;
-    strcpy(server_addr.sun_path, POWERSERVER_SOCKET);
+    return false;
+}
+
+/*
+ * power_drain_intents - Applies all the queued intents
+ *
+ * Superseded intents get skipped; everything else only updates the
+ * requests, which get resolved and written to sysfs once, at the
+ * end of the batch.
+ *
+ * Note: Has to be called with the applier lock held.
+ */
+void power_drain_intents(void)
+{
+    struct power_intent intents[INTENT_QUEUE_SIZE];
+    int last[INTENT_MAX];
+    int i, count = 0;
 
-    /* Free the existing socket file, if any */
-    unlink(POWERSERVER_SOCKET);
+    intent_queue_ack();
 
-    /* Bind the address to the socket */
-    ret = bind(sock, (struct sockaddr*)&server_addr,
-               sizeof(struct sockaddr_un));
-    if (ret != 0) {
-        ALOGE("Cannot bind socket");
-        return -EINVAL;
+    while (count < INTENT_QUEUE_SIZE && intent_pop(&intents[count])) {
+        if (intents[count].type < INTENT_MAX)
+            last[intents[count].type] = count;
+        count++;
     }
 
-    /* Set socket permissions */
-    chown(server_addr.sun_path, AID_ROOT, AID_SYSTEM);
-    chmod(server_addr.sun_path, 0666);
+    if (!count)
+        return;
 
-    /* Listen on this socket */
-    ret = listen(sock, POWERSERVER_MAXCONN);
-    if (ret != 0) {
-        ALOGE("Cannot listen on socket");
-        return ret;
+    power_batch_begin();
+    for (i = 0; i < count; i++) {
+        if (intent_superseded(&intents[i], i, last))
+            continue;
+        apply_intent(&intents[i]);
     }
+    power_batch_end();
 
-    ret = pthread_create(&powerserver_thread, NULL, powerserver_looper, NULL);
-    if (ret != 0) {
-        ALOGE("Cannot create PowerServer thread");
-        return -ENXIO;
+    for (i = 0; i < count; i++) {
+        if (intents[i].hint >= 0)
+            metrics_hint(intents[i].hint, intents[i].start_ns);
     }
+}
 
-    return 0;
+/*
+ * submit_intent - Queues an intent for the PowerServer, or applies
+ *                 it right away if the PowerServer can't
+ *
+ * \param type - Intent type (from enum power_intent_t)
+ * \param hint - Originating power hint, -1 if none
+ * \param arg - Intent argument
+ * \param start_ns - Time the request was received
+ */
+static void submit_intent(int type, int hint, int arg, uint64_t start_ns)
+{
+    struct power_intent intent = {
+        .type = type,
+        .hint = hint,
+        .arg = arg,
+        .start_ns = start_ns,
+    };
+
+    if (powerserver_running() && intent_push(&intent) == 0)
+        return;
+
+    /* Keep the ordering: anything still queued goes first */
+    power_lock();
+    power_drain_intents();
+
+    power_batch_begin();
+    apply_intent(&intent);
+    power_batch_end();
+
+    if (hint >= 0)
+        metrics_hint(hint, start_ns);
+    power_unlock();
 }
 
-static bool init_all_rqb_params(void)
+/*
+ * power_reload - Reloads the configuration file and applies the
+ *                resulting profile
+ *
+ * The new configuration gets built aside and swapped in at once:
+ * the hint path keeps working on the old one meanwhile. Parameters
+ * that didn't change are skipped by the sysfs cache.
+ *
+ * Note: Only for the PowerServer thread, which owns all the locks.
+ *
+ * \return Returns success (0) or failure (negative errno)
+ */
+int power_reload(void)
 {
-    int i, ret;
-
-    rqb = malloc(sizeof(struct rqbalance_params) * POWER_MODE_MAX);
-    assert(rqb != NULL);
-
-    for (i = 0; i < POWER_MODE_MAX; i++)
-    {
-        ret = parse_xml_data(RQBHAL_CONF_FILE,
-                rqb_param_string(i, false), &rqb[i]);
-        if (ret < 0) {
-            ALOGE("Cannot parse configuration for %s mode!!!",
-                  rqb_param_string(i, false));
-        }
+    struct rqb_config *conf;
+    int ret;
+
+    ret = profiles_load(&conf);
+    if (ret < 0) {
+        ALOGE("Cannot reload configuration, keeping the current one");
+        return ret;
     }
 
-    return ret;
+    power_batch_begin();
+    halext_revote(false);
+    profiles_publish(conf);
+    halext_revote(true);
+    thermal_update(true);
+    lock_batch_dirty = true;
+    power_batch_end();
+
+    ALOGI("Configuration reloaded");
+
+    return 0;
 }
 
 /*
@@ -417,11 +684,13 @@ static void power_init(struct power_module *module UNUSED)
     int i;
     char ext_lib_path[127];
     char propval[2];
+    char arbval[PROPERTY_VALUE_MAX];
+    char slackval[PROPERTY_VALUE_MAX];
     struct rqbalance_params *rqbparm;
 
     ALOGI("Initializing PowerHAL...");
 
-    ret = init_all_rqb_params();
+    ret = profiles_init();
     if (ret < 0)
         goto general_error;
 
@@ -433,22 +702,61 @@ static void power_init(struct power_module *module UNUSED)
     property_get(PROP_DEBUGLVL, propval, "0");
     dbg_lvl = atoi(propval);
 
+    property_get(PROP_ARBITRATION, arbval, "priority");
+    if (strcmp(arbval, "merge") == 0) {
+        ALOGI("Merging parameters of concurrent power modes");
+        arbiter_set_policy(ARBITER_MERGE);
+    }
+
     if (dbg_lvl > 0) {
         ALOGW("WARNING: Starting in debug mode");
-        for (i = 0; i < POWER_MODE_MAX; i++) {
+        for (i = 0; i < profiles_count(); i++) {
 	        print_parameters(i);
 	}
     } else {
         ALOGI("Loading with debug off. To turn on, set %s", PROP_DEBUGLVL);
     }
 
+    /* Keep the RQBalance nodes open for fast mode switching */
+    ret = sysfs_cache_init();
+    if (ret > 0)
+        ALOGW("%d RQBalance nodes not available yet", ret);
+
     /* Init thermal_max_cpus and default profile */
-    rqbparm = &rqb[POWER_MODE_BALANCED];
+    rqbparm = profile_params(POWER_MODE_BALANCED);
     sysfs_write(SYS_THERM_CPUS, rqbparm->max_cpus);
     set_power_mode(POWER_MODE_BALANCED);
 
+    /* Perf lock resources: frequency floors, power collapse */
+    if (boost_init() < 0)
+        ALOGW("Perf lock resources are not available");
+
+    /* Per-cluster profile parameters */
+    if (cluster_ctl_init() < 0)
+        ALOGW("Cluster parameters are not available");
+
     ALOGI("Initialized successfully.");
 
+    /* Power hints get applied by the PowerServer */
+    if (intent_queue_init() < 0)
+        ALOGW("Cannot queue power hints: applying them synchronously");
+
+    /* Lock expiries within the same slack window get coalesced */
+    property_get(PROP_TIMER_SLACK, slackval, "");
+    ret = timerwheel_init(slackval[0] ? (unsigned int)atoi(slackval) :
+                          TIMERWHEEL_DEFAULT_SLACK_MS);
+    if (ret < 0)
+        ALOGE("Cannot initialize timers: timed locks won't expire!");
+
+    /* Thermal budget, sampled on the timer wheel */
+    thermal_init();
+
+    /* Launch boosts get released after the predicted launch time */
+    launch_predict_init();
+
+    /* Touch boosts decay through the timer wheel too */
+    interaction_init();
+
     ret = manage_powerserver(true);
     if (ret == 0)
         ALOGI("PowerHAL PowerServer started");
@@ -465,7 +773,7 @@ general_error:
 
 void power_init_ext(void)
 {
-    if (init_all_rqb_params())
+    if (profiles_init() == 0)
         hal_init_ok = true;
 }
 
@@ -479,41 +787,59 @@ void power_init_ext(void)
 static void power_hint(struct power_module *module UNUSED, power_hint_t hint,
                             void *data)
 {
+    uint64_t start_ns;
+
     if (!hal_init_ok)
         return;
 
-    switch (hint) {
-        case POWER_HINT_VSYNC:
-            break;
+    start_ns = metrics_now_ns();
 
+    /* Never touch sysfs here: the PowerServer applies the hints */
+    switch (hint) {
         case POWER_HINT_LOW_POWER:
             if (data) {
-                set_power_mode(POWER_MODE_BATTERYSAVE);
+                submit_intent(INTENT_BASE_MODE, hint,
+                              POWER_MODE_BATTERYSAVE, start_ns);
             } else {
-                set_power_mode(POWER_MODE_BALANCED);
+                submit_intent(INTENT_BASE_MODE, hint,
+                              POWER_MODE_BALANCED, start_ns);
             }
-            break;
+            return;
 
         case POWER_HINT_VR_MODE:
             if (data && param_perf_supported) {
-                set_power_mode(POWER_MODE_PERFORMANCE);
+                submit_intent(INTENT_BASE_MODE, hint,
+                              POWER_MODE_PERFORMANCE, start_ns);
             } else {
-                set_power_mode(POWER_MODE_BALANCED);
+                submit_intent(INTENT_BASE_MODE, hint,
+                              POWER_MODE_BALANCED, start_ns);
+            }
+            return;
+
+        case POWER_HINT_INTERACTION:
+            if (param_perf_supported) {
+                submit_intent(INTENT_INTERACTION, hint,
+                              data ? *(int *)data : 0, start_ns);
+                return;
             }
             break;
 
         case POWER_HINT_LAUNCH:
-            if (data && param_perf_supported) {
-                set_power_mode(POWER_MODE_PERFORMANCE);
+            if (param_perf_supported) {
+                submit_intent(INTENT_LAUNCH, hint, data != NULL, start_ns);
             } else {
-                set_power_mode(POWER_MODE_BALANCED);
+                submit_intent(INTENT_BASE_MODE, hint,
+                              POWER_MODE_BALANCED, start_ns);
             }
-            break;
+            return;
 
+        case POWER_HINT_VSYNC:
         default:
             break;
     }
 
+    metrics_hint(hint, start_ns);
+
     return;
 }
 
@@ -528,22 +854,11 @@ static void set_interactive(struct power_module *module UNUSED, int on)
     if (!hal_init_ok)
         return;
 
-    if (!on) {
-        ALOGI("Device is asleep.");
-
-	/* Stop PowerServer: we don't need it while sleeping */
-        manage_powerserver(false);
-
-        set_power_mode(POWER_MODE_BATTERYSAVE);
-    } else {
-        ALOGI("Device is awake.");
-
-	/* Restart PowerServer */
-        if (!psthread_run)
-            manage_powerserver(true);
+    /* Only if it died: the PowerServer stays up while sleeping */
+    if (on && !powerserver_running())
+        manage_powerserver(true);
 
-        set_power_mode(POWER_MODE_BALANCED);
-    }
+    submit_intent(INTENT_INTERACTIVE, -1, on, metrics_now_ns());
 }
 
 /*
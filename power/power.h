@@ -14,6 +14,11 @@
  * limitations under the License.
  */
 
+#ifndef __POWER_H__
+#define __POWER_H__
+
+#include <stdbool.h>
+
 #define PROP_VALUE_MAX 70
 
 /* sysfs nodes */
@@ -30,19 +35,38 @@
 
 /* Android properties */
 #define PROP_DEBUGLVL			"powerhal.debug_level"
+#define PROP_ARBITRATION		"powerhal.arbitration"
+#define PROP_TIMER_SLACK		"powerhal.timer_slack_ms"
+#define PROP_PROFILE_CACHE		"powerhal.profile_cache"
+#define PROP_INTERACTION_MS		"powerhal.interaction_ms"
+#define PROP_SYSFS_ROOT			"powerhal.sysfs_root"
+#define PROP_DEBUGGABLE			"ro.debuggable"
 
 /* PowerServer definitions */
+#ifndef POWERSERVER_DIR		/* Host builds use their own */
 #define POWERSERVER_DIR			"/data/misc/powerhal/"
+#endif
 #define POWERSERVER_SOCKET		POWERSERVER_DIR "rqbsvr"
 #define POWERSERVER_MAXCONN		10
+#define POWERSERVER_MAXCLIENTS		32
+
+/* Compiled profiles */
+#define PROFILE_CACHE_FILE		POWERSERVER_DIR "profiles.bin"
 
 /* Others */
-#define RQBHAL_CONF_FILE		"/system/etc/rqbalance_config.xml"
+#ifndef RQBHAL_CONF_DIR		/* Host builds use their own */
+#define RQBHAL_CONF_DIR			"/system/etc/"
+#endif
+#define RQBHAL_CONF_NAME		"rqbalance_config.xml"
+#define RQBHAL_CONF_FILE		RQBHAL_CONF_DIR RQBHAL_CONF_NAME
+#define RQBHAL_RELOAD_DELAY_MS		200
 
 /*
  * enum rqb_pwr_mode_t
  * Provides RQBalance Power Modes definitions
  *
+ * These are the built-in profiles, always present at the start
+ * of the profiles table: more can be defined in the configuration.
  * The POWER_MODE_MAX entry is used as commodity for code
  * and shall NEVER be used as a Power Mode.
  */
@@ -65,8 +89,8 @@ typedef enum {
  * RQBalance kernel driver, as per coding style spec.
  */
 struct rqbalance_params {
-	char min_cpus[2];
-	char max_cpus[2];
+	char min_cpus[4];
+	char max_cpus[4];
 	char up_thresholds[PROP_VALUE_MAX];
 	char down_thresholds[PROP_VALUE_MAX];
 	char balance_level[PROP_VALUE_MAX];
@@ -78,3 +102,18 @@ void __set_special_power_mode(char* max_cpus, char* min_cpus,
                               char* up_thresholds, char* down_thresholds,
                               char* balance_level);
 void set_power_mode(rqb_pwr_mode_t mode);
+void lock_power_mode(int mode, unsigned int clusters, bool enable);
+void lock_cpus_floor(int ncpus);
+void lock_freq_floor(unsigned int clusters);
+void set_boost_level(int level);
+struct rqb_thermal_level;
+void set_thermal_level(const struct rqb_thermal_level *level);
+void power_batch_begin(void);
+void power_batch_end(void);
+int power_reload(void);
+void power_lock(void);
+void power_unlock(void);
+void power_drain_intents(void);
+bool power_suspended(void);
+
+#endif
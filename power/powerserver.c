@@ -0,0 +1,785 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RQBalance-PowerServer"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#include <private/android_filesystem_config.h>
+#include <utils/Log.h>
+
+#include "power.h"
+#include "powerserver.h"
+#include "halext_shm.h"
+#include "intent_queue.h"
+#include "launch_predict.h"
+#include "metrics.h"
+#include "sysfs_journal.h"
+#include "thermal.h"
+#include "timerwheel.h"
+#include "rqbalance_halext.h"
+
+#define UNUSED __attribute__((unused))
+
+/*
+ * The PowerServer serves all the clients from a single thread,
+ * multiplexing the listening socket and every client connection
+ * on one epoll instance: clients are free to keep their connection
+ * open and to send more than one request without waiting for the
+ * previous reply, so that many concurrent hint sources (decoder,
+ * encoder, display) don't queue up behind accept().
+ *
+ * The server gets stopped by signalling an eventfd that is also
+ * watched by the loop. It is not stopped while the screen is off:
+ * it keeps its socket and clients, while the arbiter only applies
+ * the screen off profile, so that waking up doesn't have to bring
+ * anything back up.
+ *
+ * The timed locks expire on this same thread, out of the timer
+ * wheel timerfd: every lock expiring in one run gets released
+ * in a single batch, with a single profile re-evaluation.
+ *
+ * The configuration file gets watched with inotify: changes are
+ * debounced on the timer wheel, as editors tend to write a file
+ * in more than one go, then the configuration gets reloaded on
+ * this thread, out of the hint path. Clients can also ask for a
+ * reload explicitly.
+ *
+ * Trusted clients can also get a shared memory ring for their
+ * lock requests, whose doorbell is watched by this same loop.
+ *
+ * This is also the thread applying the power hints, which get
+ * queued by the binder threads as intents: every change to the
+ * profiles happens here, with the applier lock held.
+ */
+
+#define POWERSERVER_MAXEVENTS	16
+#define POWERSERVER_MSG_MAX	4096
+#define POWERSERVER_SEND_TMO	100	/* milliseconds */
+
+static int sock = -1;
+static int epfd = -1;
+static int stopfd = -1;
+static int watchfd = -1;
+static struct tw_timer reload_timer;
+static int clients[POWERSERVER_MAXCLIENTS];
+static pthread_t powerserver_thread;
+static bool psthread_run = false;
+static bool psthread_started = false;	/* Not joined yet */
+
+/*
+ * client_add - Register a new client connection on the event loop
+ *
+ * \param fd - Client socket
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int client_add(int fd)
+{
+	struct epoll_event ev;
+	int i;
+
+	for (i = 0; i < POWERSERVER_MAXCLIENTS; i++) {
+		if (clients[i] < 0)
+			break;
+	}
+
+	if (i == POWERSERVER_MAXCLIENTS) {
+		ALOGE("Too many clients, refusing connection");
+		return -EMFILE;
+	}
+
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		ALOGE("Cannot watch client socket: %d", errno);
+		return -errno;
+	}
+
+	clients[i] = fd;
+
+	return 0;
+}
+
+/*
+ * client_remove - Unregister and close a client connection
+ *
+ * \param fd - Client socket
+ */
+static void client_remove(int fd)
+{
+	int i;
+
+	for (i = 0; i < POWERSERVER_MAXCLIENTS; i++) {
+		if (clients[i] == fd) {
+			clients[i] = -1;
+			break;
+		}
+	}
+
+	halext_shm_detach(fd, epfd);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+}
+
+/*
+ * client_send_fds - Send a reply to a client, passing descriptors
+ *
+ * Clients are non-blocking: if one is not reading its replies,
+ * wait a little for room in its queue, then give up on it.
+ *
+ * \param fd - Client socket
+ * \param buf - Reply data
+ * \param len - Reply length
+ * \param fds - Descriptors to pass along, NULL for none
+ * \param nfds - Number of descriptors
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int client_send_fds(int fd, void *buf, size_t len, int *fds, int nfds)
+{
+	char cbuf[CMSG_SPACE(HALEXT_SHM_FDS * sizeof(int))];
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct pollfd pfd;
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (fds != NULL && nfds > 0 && nfds <= HALEXT_SHM_FDS) {
+		memset(cbuf, 0, sizeof(cbuf));
+		msg.msg_control = cbuf;
+		msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+
+	for (;;) {
+		ret = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret >= 0)
+			return 0;
+
+		if (errno == EINTR)
+			continue;
+
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			break;
+
+		if (poll(&pfd, 1, POWERSERVER_SEND_TMO) <= 0) {
+			errno = ETIMEDOUT;
+			break;
+		}
+	}
+
+	ALOGE("ERROR: Cannot send reply!!! (%d)", errno);
+	return -errno;
+}
+
+/*
+ * client_send - Send a reply to a client
+ *
+ * \param fd - Client socket
+ * \param buf - Reply data
+ * \param len - Reply length
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int client_send(int fd, void *buf, size_t len)
+{
+	return client_send_fds(fd, buf, len, NULL, 0);
+}
+
+/*
+ * powerserver_perf_lock - Run one HALExt performance lock request
+ *
+ * \param params - Request parameters
+ * \return Returns lock handle or failure (negative errno)
+ */
+static int32_t powerserver_perf_lock(struct rqbalance_halext_params *params)
+{
+	if (params->acquire)
+		return halext_perf_lock_acquire(params);
+
+	return halext_perf_lock_release(params->id);
+}
+
+/*
+ * powerserver_reload - Reload timer callback
+ *
+ * \param timer - Reload timer
+ */
+static void powerserver_reload(struct tw_timer *timer UNUSED)
+{
+	power_reload();
+}
+
+/*
+ * powerserver_watch_event - Handle the configuration file changes
+ */
+static void powerserver_watch_event(void)
+{
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *ev;
+	bool changed = false;
+	ssize_t len;
+	char *p;
+
+	for (;;) {
+		len = read(watchfd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *)p;
+			if (ev->len && strcmp(ev->name, RQBHAL_CONF_NAME) == 0)
+				changed = true;
+		}
+	}
+
+	if (changed)
+		timerwheel_add(&reload_timer, RQBHAL_RELOAD_DELAY_MS);
+}
+
+/*
+ * powerserver_watch - Start watching the configuration file
+ *
+ * The directory is watched, not the file: files replaced by
+ * renaming a new one over them would silently drop the watch.
+ *
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int powerserver_watch(void)
+{
+	timerwheel_setup(&reload_timer, powerserver_reload, 0);
+
+	watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watchfd < 0)
+		return -errno;
+
+	if (inotify_add_watch(watchfd, RQBHAL_CONF_DIR,
+			      IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(watchfd);
+		watchfd = -1;
+		return -errno;
+	}
+
+	return 0;
+}
+
+/*
+ * powerserver_text - Reply to a request with a text dump
+ *
+ * \param fd - Client socket
+ * \param hdr - Request header
+ * \param dump - Function writing the dump
+ * \param max - Maximum length of the dump
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int powerserver_text(int fd, struct rqbalance_halext_hdr *hdr,
+			    int (*dump)(char *buf, size_t len), size_t max)
+{
+	static struct {
+		struct rqbalance_halext_hdr hdr;
+		char text[SYSFS_JOURNAL_DUMP_MAX];
+	} reply;
+	int len;
+
+	/* Only ever used by the PowerServer thread */
+	reply.hdr = *hdr;
+	reply.hdr.count = 0;
+
+	if (max > sizeof(reply.text))
+		max = sizeof(reply.text);
+	len = dump(reply.text, max);
+
+	return client_send(fd, &reply, sizeof(reply.hdr) + len);
+}
+
+/*
+ * powerserver_shm_attach - Reply to a shared memory ring request
+ *
+ * \param fd - Client socket
+ * \param hdr - Request header
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int powerserver_shm_attach(int fd, struct rqbalance_halext_hdr *hdr)
+{
+	struct rqbalance_halext_reply reply;
+	size_t len = sizeof(reply.hdr) + sizeof(int32_t);
+	int fds[HALEXT_SHM_FDS];
+	int ret;
+
+	reply.hdr = *hdr;
+	reply.hdr.count = 1;
+	reply.reply[0] = halext_shm_attach(fd, epfd, fds);
+
+	if (reply.reply[0] < 0)
+		return client_send(fd, &reply, len);
+
+	ret = client_send_fds(fd, &reply, len, fds, HALEXT_SHM_FDS);
+	if (ret < 0)
+		halext_shm_detach(fd, epfd);
+
+	return ret;
+}
+
+/*
+ * powerserver_handle_msg - Decode, execute and reply to one message
+ *
+ * \param fd - Client socket
+ * \param buf - Message data
+ * \param len - Message length
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int powerserver_handle_msg(int fd, void *buf, size_t len)
+{
+	struct rqbalance_halext_batch_msg *msg = buf;
+	struct rqbalance_halext_reply reply;
+	int32_t legacy_reply;
+	size_t hdrsz = sizeof(struct rqbalance_halext_hdr);
+	size_t paramsz = sizeof(struct rqbalance_halext_params);
+	int count;
+
+	/* Legacy clients: one bare request, one bare reply */
+	if (len == paramsz) {
+		legacy_reply = powerserver_perf_lock(buf);
+		return client_send(fd, &legacy_reply, sizeof(legacy_reply));
+	}
+
+	if (len < hdrsz || msg->hdr.magic != HALEXT_MSG_MAGIC) {
+		ALOGE("Received data size mismatch!!");
+		return -EINVAL;
+	}
+
+	if (msg->hdr.op == HALEXT_OP_METRICS && len == hdrsz)
+		return powerserver_text(fd, &msg->hdr, metrics_dump,
+					METRICS_DUMP_MAX);
+
+	if (msg->hdr.op == HALEXT_OP_SYSFS_JOURNAL && len == hdrsz)
+		return powerserver_text(fd, &msg->hdr, sysfs_journal_dump,
+					SYSFS_JOURNAL_DUMP_MAX);
+
+	if (msg->hdr.op == HALEXT_OP_SHM_ATTACH && len == hdrsz)
+		return powerserver_shm_attach(fd, &msg->hdr);
+
+	reply.hdr = msg->hdr;
+	reply.hdr.count = 1;
+
+	switch (msg->hdr.op) {
+		case HALEXT_OP_PERF_LOCK:
+			if (len != hdrsz + paramsz) {
+				reply.reply[0] = -EINVAL;
+				break;
+			}
+			reply.reply[0] = powerserver_perf_lock(&msg->params[0]);
+			break;
+		case HALEXT_OP_PERF_LOCK_BATCH:
+			count = msg->hdr.count;
+			if (count < 1 || count > HALEXT_MAX_BATCH ||
+			    len != hdrsz + (count * paramsz)) {
+				reply.reply[0] = -EINVAL;
+				break;
+			}
+			halext_perf_lock_batch(msg->params, count, reply.reply);
+			reply.hdr.count = count;
+			break;
+		case HALEXT_OP_LAUNCH_STATS:
+			if (len != hdrsz) {
+				reply.reply[0] = -EINVAL;
+				break;
+			}
+			reply.hdr.count = launch_predict_stats(reply.reply,
+							       HALEXT_MAX_BATCH);
+			break;
+		case HALEXT_OP_METRICS:
+		case HALEXT_OP_SYSFS_JOURNAL:
+		case HALEXT_OP_SHM_ATTACH:
+			/* Well formed ones are served above */
+			reply.reply[0] = -EINVAL;
+			break;
+		case HALEXT_OP_RELOAD:
+			if (len != hdrsz) {
+				reply.reply[0] = -EINVAL;
+				break;
+			}
+			reply.reply[0] = power_reload();
+			break;
+		default:
+			ALOGE("Unknown request 0x%x", msg->hdr.op);
+			reply.reply[0] = -EOPNOTSUPP;
+			break;
+	}
+
+	return client_send(fd, &reply,
+			   hdrsz + (reply.hdr.count * sizeof(int32_t)));
+}
+
+/*
+ * powerserver_client_event - Serve all the pending messages of a client
+ *
+ * \param fd - Client socket
+ * \param events - Events reported by epoll
+ */
+static void powerserver_client_event(int fd, uint32_t events)
+{
+	uint8_t buf[POWERSERVER_MSG_MAX];
+	ssize_t len;
+	int ret;
+
+	if (events & EPOLLIN) {
+		for (;;) {
+			len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+			if (len < 0 && errno == EINTR)
+				continue;
+			if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			if (len <= 0)
+				goto disconnect;
+
+			/* Malformed messages are dropped, not fatal */
+			ret = powerserver_handle_msg(fd, buf, len);
+			if (ret < 0 && ret != -EINVAL)
+				goto disconnect;
+		}
+	}
+
+	if (events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))
+		goto disconnect;
+
+	return;
+
+disconnect:
+	client_remove(fd);
+}
+
+/*
+ * powerserver_accept - Accept all the pending connections
+ */
+static void powerserver_accept(void)
+{
+	int fd;
+
+	for (;;) {
+		fd = accept4(sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				ALOGE("Cannot accept connection: %d", errno);
+			return;
+		}
+
+		if (client_add(fd) < 0)
+			close(fd);
+	}
+}
+
+/*
+ * powerserver_timers - Run the expired timers of the timer wheel
+ */
+static void powerserver_timers(void)
+{
+	int expired;
+
+	power_batch_begin();
+	expired = timerwheel_run();
+	power_batch_end();
+
+	metrics_timers(expired);
+
+	if (expired > 0)
+		ALOGD("%d timed locks expired", expired);
+}
+
+static void *powerserver_looper(void *unusedvar UNUSED)
+{
+	struct epoll_event events[POWERSERVER_MAXEVENTS];
+	int i, nev;
+
+	ALOGI("PowerServer is waiting for connections...");
+
+	/* Intents queued while starting up */
+	power_lock();
+	power_drain_intents();
+	power_unlock();
+
+	while (__atomic_load_n(&psthread_run, __ATOMIC_ACQUIRE)) {
+		nev = epoll_wait(epfd, events, POWERSERVER_MAXEVENTS, -1);
+		if (nev < 0) {
+			if (errno == EINTR)
+				continue;
+			ALOGE("PowerServer epoll error: %d", errno);
+			goto died;
+		}
+
+		power_lock();
+		for (i = 0; i < nev; i++) {
+			if (events[i].data.fd == stopfd) {
+				power_unlock();
+				goto end;
+			} else if (events[i].data.fd == intent_queue_get_fd())
+				power_drain_intents();
+			else if (events[i].data.fd == timerwheel_get_fd())
+				powerserver_timers();
+			else if (events[i].data.fd == watchfd)
+				powerserver_watch_event();
+			else if (events[i].data.fd == thermal_get_fd())
+				thermal_event();
+			else if (events[i].data.fd == sock)
+				powerserver_accept();
+			else if (halext_shm_is_doorbell(events[i].data.fd))
+				halext_shm_event(events[i].data.fd);
+			else
+				powerserver_client_event(events[i].data.fd,
+							 events[i].events);
+		}
+		power_unlock();
+	}
+
+	goto end;
+
+died:
+	/*
+	 * Nobody asked for it: refuse new connections so that the
+	 * clients fail fast, and let the intents get applied inline
+	 * until the PowerServer gets started again.
+	 */
+	shutdown(sock, SHUT_RDWR);
+	close(sock);
+	sock = -1;
+	__atomic_store_n(&psthread_run, false, __ATOMIC_RELEASE);
+
+end:
+	for (i = 0; i < POWERSERVER_MAXCLIENTS; i++) {
+		if (clients[i] >= 0) {
+			halext_shm_detach(clients[i], epfd);
+			close(clients[i]);
+			clients[i] = -1;
+		}
+	}
+
+	ALOGI("PowerServer terminated.");
+	return NULL;
+}
+
+/*
+ * powerserver_teardown - Release all the PowerServer resources
+ */
+static void powerserver_teardown(void)
+{
+	if (sock >= 0) {
+		shutdown(sock, SHUT_RDWR);
+		close(sock);
+		sock = -1;
+	}
+	if (stopfd >= 0) {
+		close(stopfd);
+		stopfd = -1;
+	}
+	if (watchfd >= 0) {
+		timerwheel_del(&reload_timer);
+		close(watchfd);
+		watchfd = -1;
+	}
+	if (epfd >= 0) {
+		close(epfd);
+		epfd = -1;
+	}
+}
+
+/*
+ * powerserver_reap - Release a PowerServer thread that already exited
+ *
+ * The looper thread may die on its own: it has to be joined and
+ * its resources released before the PowerServer gets started again.
+ */
+static void powerserver_reap(void)
+{
+	if (!psthread_started)
+		return;
+
+	pthread_join(powerserver_thread, NULL);
+	psthread_started = false;
+	powerserver_teardown();
+}
+
+/*
+ * powerserver_running - Check if the PowerServer thread is alive
+ *
+ * \return Returns true if the PowerServer is running
+ */
+bool powerserver_running(void)
+{
+	return __atomic_load_n(&psthread_run, __ATOMIC_ACQUIRE);
+}
+
+int manage_powerserver(bool start)
+{
+	int i, ret;
+	struct stat st = {0};
+	struct sockaddr_un server_addr;
+	struct epoll_event ev;
+	uint64_t stop = 1;
+
+	if (start == false) {
+		if (!powerserver_running()) {
+			powerserver_reap();
+			return 0;
+		}
+
+		__atomic_store_n(&psthread_run, false, __ATOMIC_RELEASE);
+		if (write(stopfd, &stop, sizeof(stop)) == sizeof(stop)) {
+			pthread_join(powerserver_thread, NULL);
+			psthread_started = false;
+		} else {
+			ALOGE("Cannot signal PowerServer termination");
+		}
+
+		powerserver_teardown();
+
+		return 0;
+	}
+
+	/* Clean up after a PowerServer that died */
+	powerserver_reap();
+
+	for (i = 0; i < POWERSERVER_MAXCLIENTS; i++)
+		clients[i] = -1;
+
+	/* Create folder, if doesn't exist */
+	if (stat(POWERSERVER_DIR, &st) == -1) {
+		mkdir(POWERSERVER_DIR, 0773);
+	}
+
+	/* Get socket in the UNIX domain */
+	sock = socket(PF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		ALOGE("Could not create the socket");
+		return -EPROTO;
+	}
+
+	/* Create address */
+	memset(&server_addr, 0, sizeof(struct sockaddr_un));
+	server_addr.sun_family = AF_UNIX;
+	strcpy(server_addr.sun_path, POWERSERVER_SOCKET);
+
+	/* Free the existing socket file, if any */
+	unlink(POWERSERVER_SOCKET);
+
+	/* Bind the address to the socket */
+	ret = bind(sock, (struct sockaddr*)&server_addr,
+		   sizeof(struct sockaddr_un));
+	if (ret != 0) {
+		ALOGE("Cannot bind socket");
+		ret = -EINVAL;
+		goto err;
+	}
+
+	/* Set socket permissions */
+	chown(server_addr.sun_path, AID_ROOT, AID_SYSTEM);
+	chmod(server_addr.sun_path, 0666);
+
+	/* Listen on this socket */
+	ret = listen(sock, POWERSERVER_MAXCONN);
+	if (ret != 0) {
+		ALOGE("Cannot listen on socket");
+		goto err;
+	}
+
+	/* Event loop: listening socket, timers and termination request */
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	stopfd = eventfd(0, EFD_CLOEXEC);
+	if (epfd < 0 || stopfd < 0) {
+		ALOGE("Cannot create PowerServer event loop");
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.fd = sock;
+	ret = epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev);
+	if (ret == 0) {
+		ev.data.fd = stopfd;
+		ret = epoll_ctl(epfd, EPOLL_CTL_ADD, stopfd, &ev);
+	}
+	if (ret == 0 && timerwheel_get_fd() >= 0) {
+		ev.data.fd = timerwheel_get_fd();
+		ret = epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+	}
+	if (ret == 0 && intent_queue_get_fd() >= 0) {
+		ev.data.fd = intent_queue_get_fd();
+		ret = epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+	}
+	if (ret == 0 && thermal_get_fd() >= 0) {
+		ev.data.fd = thermal_get_fd();
+		ret = epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+	}
+	if (ret != 0) {
+		ALOGE("Cannot setup PowerServer event loop");
+		ret = -EINVAL;
+		goto err;
+	}
+
+	/* Not fatal: the configuration can still be reloaded on request */
+	if (powerserver_watch() == 0) {
+		ev.data.fd = watchfd;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, watchfd, &ev) < 0)
+			ALOGW("Cannot watch configuration file");
+	} else {
+		ALOGW("Cannot watch configuration file");
+	}
+
+	psthread_run = true;
+	ret = pthread_create(&powerserver_thread, NULL, powerserver_looper, NULL);
+	if (ret != 0) {
+		ALOGE("Cannot create PowerServer thread");
+		psthread_run = false;
+		ret = -ENXIO;
+		goto err;
+	}
+	psthread_started = true;
+
+	return 0;
+
+err:
+	powerserver_teardown();
+	return ret;
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RQBalance-PowerHAL-Cache"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <utils/Log.h>
+
+#include "power.h"
+#include "profiles.h"
+#include "profile_cache.h"
+
+/*
+ * Parsing the XML configuration is on the boot critical path.
+ *
+ * Once parsed, the profiles get stored as a binary blob, stamped
+ * with the modification time and size of the XML file they come
+ * from: on the next boots, if the XML didn't change, the blob is
+ * mapped and validated by checksum, skipping XML parsing entirely.
+ * Any mismatch just makes the HAL fall back to the XML.
+ *
+ * The cache directory is shared with the PowerServer socket and is
+ * writable by others: blobs not owned by the HAL are ignored, and
+ * loaded ones are bounds checked before use.
+ */
+
+/*
+ * checksum_update - FNV-1a hash of a buffer
+ *
+ * \param hash - Previous hash value
+ * \param buf - Buffer
+ * \param len - Buffer length
+ * \return Returns updated hash
+ */
+static uint32_t checksum_update(uint32_t hash, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/*
+ * blob_checksum - Compute the checksum of a profiles blob
+ *
+ * \param hdr - Blob header
+ * \param profiles - Configuration following the header
+ * \return Returns checksum
+ */
+static uint32_t blob_checksum(const struct profile_cache_hdr *hdr,
+			      const void *profiles)
+{
+	struct profile_cache_hdr tmp;
+	uint32_t hash = 2166136261U;
+
+	memcpy(&tmp, hdr, sizeof(tmp));
+	tmp.checksum = 0;
+
+	hash = checksum_update(hash, &tmp, sizeof(tmp));
+	hash = checksum_update(hash, profiles, hdr->config_size);
+
+	return hash;
+}
+
+/*
+ * terminated - Check that a fixed size string buffer holds a C string
+ *
+ * \param s - Buffer
+ * \param len - Buffer length
+ * \return Returns true if the buffer contains a NUL character
+ */
+static bool terminated(const char *s, size_t len)
+{
+	return memchr(s, '\0', len) != NULL;
+}
+
+/*
+ * validate_config - Sanity check a configuration read from a blob
+ *
+ * The checksum only catches accidental corruption: everything that
+ * is later used as an index or as a C string gets checked here, so
+ * that a crafted blob cannot make the HAL read out of bounds.
+ *
+ * \param conf - Configuration
+ * \return Returns true if the configuration can be used
+ */
+static bool validate_config(const struct rqb_config *conf)
+{
+	const struct rqb_profile *p;
+	int i;
+
+	if (conf->num_profiles < POWER_MODE_MAX ||
+	    conf->num_profiles > MAX_PROFILES)
+		return false;
+
+	for (i = 0; i < conf->num_profiles; i++) {
+		p = &conf->profiles[i];
+		if (!terminated(p->name, sizeof(p->name)) ||
+		    !terminated(p->params.min_cpus,
+				sizeof(p->params.min_cpus)) ||
+		    !terminated(p->params.max_cpus,
+				sizeof(p->params.max_cpus)) ||
+		    !terminated(p->params.up_thresholds,
+				sizeof(p->params.up_thresholds)) ||
+		    !terminated(p->params.down_thresholds,
+				sizeof(p->params.down_thresholds)) ||
+		    !terminated(p->params.balance_level,
+				sizeof(p->params.balance_level)))
+			return false;
+
+		if (conf->sorted[i] >= conf->num_profiles)
+			return false;
+	}
+
+	for (i = 0; i < PROFILE_MAX_LOCKTYPES; i++) {
+		if (conf->locktype_profile[i] < -1 ||
+		    conf->locktype_profile[i] >= conf->num_profiles)
+			return false;
+	}
+
+	if (!terminated(conf->thermal.zone, sizeof(conf->thermal.zone)) ||
+	    conf->thermal.num_levels > THERMAL_MAX_LEVELS)
+		return false;
+
+	return true;
+}
+
+/*
+ * fill_header - Fill a blob header for the current XML file
+ *
+ * \param hdr - Blob header
+ * \param xmlpath - Path to the XML configuration file
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int fill_header(struct profile_cache_hdr *hdr, const char *xmlpath)
+{
+	struct stat st;
+
+	if (stat(xmlpath, &st) < 0)
+		return -errno;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = PROFILE_CACHE_MAGIC;
+	hdr->version = PROFILE_CACHE_VERSION;
+	hdr->config_size = sizeof(struct rqb_config);
+	hdr->xml_mtime_sec = st.st_mtim.tv_sec;
+	hdr->xml_mtime_nsec = st.st_mtim.tv_nsec;
+	hdr->xml_size = st.st_size;
+
+	return 0;
+}
+
+/*
+ * profile_cache_load - Load the profiles from the compiled blob
+ *
+ * \param xmlpath - Path to the XML configuration file
+ * \param cachepath - Path to the compiled blob
+ * \param conf - Configuration to fill
+ * \return Returns success (0) or failure (negative errno)
+ */
+int profile_cache_load(const char *xmlpath, const char *cachepath,
+		       struct rqb_config *conf)
+{
+	struct profile_cache_hdr expected;
+	const struct profile_cache_hdr *hdr;
+	struct stat st;
+	size_t len;
+	void *map;
+	int fd, ret;
+
+	ret = fill_header(&expected, xmlpath);
+	if (ret < 0)
+		return ret;
+
+	fd = open(cachepath, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return -errno;
+
+	/* Only trust blobs written by the HAL itself */
+	len = sizeof(*hdr) + sizeof(struct rqb_config);
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_uid != geteuid() || (size_t)st.st_size != len) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	hdr = map;
+	expected.checksum = hdr->checksum;
+
+	if (memcmp(hdr, &expected, sizeof(expected)) != 0) {
+		ALOGI("Compiled profiles are outdated");
+		ret = -ESTALE;
+		goto end;
+	}
+
+	/* Check the private copy: the file may change under the mapping */
+	memcpy(conf, hdr + 1, sizeof(struct rqb_config));
+
+	if (blob_checksum(hdr, conf) != hdr->checksum ||
+	    !validate_config(conf)) {
+		ALOGE("Compiled profiles are corrupted");
+		ret = -EBADMSG;
+		goto end;
+	}
+
+	ret = 0;
+
+end:
+	munmap(map, len);
+	return ret;
+}
+
+/*
+ * profile_cache_store - Store the profiles as a compiled blob
+ *
+ * The blob gets written to a temporary file and renamed over
+ * the old one, so that a reader never sees a partial blob.
+ *
+ * \param xmlpath - Path to the XML configuration file
+ * \param cachepath - Path to the compiled blob
+ * \param conf - Configuration to store
+ * \return Returns success (0) or failure (negative errno)
+ */
+int profile_cache_store(const char *xmlpath, const char *cachepath,
+			struct rqb_config *conf)
+{
+	struct profile_cache_hdr hdr;
+	char tmppath[PATH_MAX];
+	size_t len = sizeof(struct rqb_config);
+	int fd, ret;
+
+	ret = fill_header(&hdr, xmlpath);
+	if (ret < 0)
+		return ret;
+
+	hdr.checksum = blob_checksum(&hdr, conf);
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", cachepath);
+
+	/* Never write through a file or link planted by someone else */
+	unlink(tmppath);
+	fd = open(tmppath, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+		  0600);
+	if (fd < 0)
+		return -errno;
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write(fd, conf, len) != (ssize_t)len ||
+	    fsync(fd) < 0) {
+		ret = -EIO;
+		close(fd);
+		goto err;
+	}
+	close(fd);
+
+	if (rename(tmppath, cachepath) < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	return 0;
+
+err:
+	unlink(tmppath);
+	return ret;
+}
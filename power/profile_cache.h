@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PROFILE_CACHE_H__
+#define __PROFILE_CACHE_H__
+
+#include <stdint.h>
+
+#include "profiles.h"
+
+#define PROFILE_CACHE_MAGIC	0x52514250	/* "RQBP" */
+#define PROFILE_CACHE_VERSION	4
+
+/*
+ * struct profile_cache_hdr
+ * Header of the compiled profiles blob
+ *
+ * The blob is only valid for the very same build of the HAL
+ * (version and configuration size) and for the very same XML
+ * file it was compiled from (modification time and size).
+ * The checksum covers the header, with the checksum field set
+ * to zero, followed by the configuration.
+ */
+struct profile_cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t config_size;
+	uint32_t reserved0;
+	int64_t xml_mtime_sec;
+	int64_t xml_mtime_nsec;
+	int64_t xml_size;
+	uint32_t checksum;
+	uint32_t reserved1;
+};
+
+/* Exported functions */
+int profile_cache_load(const char *xmlpath, const char *cachepath,
+		       struct rqb_config *conf);
+int profile_cache_store(const char *xmlpath, const char *cachepath,
+			struct rqb_config *conf);
+
+#endif
@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RQBalance-PowerHAL-Profiles"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cutils/properties.h>
+#include <utils/Log.h>
+
+#include "power.h"
+#include "profiles.h"
+#include "profile_cache.h"
+
+/*
+ * Power profiles:
+ *
+ * Every element directly under the root of the configuration file
+ * defines a profile named after the element itself, or after its
+ * name attribute for <profile> elements. The built-in power modes
+ * are just profiles with well-known names, always defined.
+ * Perf lock types can be mapped to any profile with <locktype>:
+ *
+ * <profile name="camera_preview" priority="3">
+ *     <cpuquiet min_cpus="2" max_cpus="4" />
+ *     <rqbalance ... />
+ * </profile>
+ * <locktype id="0x47" profile="camera_preview" />
+ *
+ * Profiles can also set per-cluster parameters, clusters being
+ * numbered in CPU order (little is 0, big is 1):
+ *
+ * <cluster id="big" min_cpus="1" min_freq="998400" />
+ *
+ * and lock types can be pinned to some clusters only, so that
+ * their profile doesn't affect the others, nor the parameters
+ * that are global to the whole SoC:
+ *
+ * <locktype id="0x46" profile="video_encoding" cluster="big" />
+ *
+ * The thermal budget is a list of levels, each one clamping the
+ * online cores and the cluster frequencies from its temperature
+ * (in millidegrees) upwards; any profile or lock gets clamped:
+ *
+ * <thermal zone="tsens_tz_sensor5" poll_ms="2000" hysteresis="2000">
+ *     <level temp="45000" max_cpus="6" />
+ *     <level temp="50000" max_cpus="4">
+ *         <cluster id="big" max_freq="1555200" />
+ *     </level>
+ * </thermal>
+ */
+
+/* XML Configuration support */
+extern int parse_xml_data(char *filepath, struct rqb_config *conf,
+			  unsigned int *found);
+
+static const struct {
+	const char *name;
+	int priority;
+} builtin_profiles[POWER_MODE_MAX] = {
+	[POWER_MODE_BATTERYSAVE]	= { "batterysave",	0 },
+	[POWER_MODE_BALANCED]		= { "balanced",		1 },
+	[POWER_MODE_PERFORMANCE]	= { "performance",	4 },
+	[POWER_MODE_OMXDECODE]		= { "video_decoding",	2 },
+	[POWER_MODE_OMXENCODE]		= { "video_encoding",	3 },
+};
+
+/*
+ * The configuration can be reloaded at any time by the PowerServer
+ * thread while the hint path is reading it: a new configuration is
+ * built aside and published with a single pointer store, readers
+ * load the pointer once and keep using what they got.
+ * The old configuration is retired, not freed, and only goes away
+ * when the next one gets published: by then, no reader can still
+ * be running on it.
+ */
+static struct rqb_config *config;
+static struct rqb_config *retired;
+
+static inline struct rqb_config *config_load(void)
+{
+	return __atomic_load_n(&config, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * profiles_reset - Initialize a configuration with the built-in
+ *                  profiles only, all with empty parameters
+ *
+ * \param conf - Configuration
+ */
+void profiles_reset(struct rqb_config *conf)
+{
+	int i;
+
+	memset(conf, 0, sizeof(*conf));
+
+	for (i = 0; i < POWER_MODE_MAX; i++) {
+		snprintf(conf->profiles[i].name, PROFILE_NAME_MAX, "%s",
+			 builtin_profiles[i].name);
+		conf->profiles[i].priority = builtin_profiles[i].priority;
+	}
+	conf->num_profiles = POWER_MODE_MAX;
+
+	memset(conf->locktype_profile, -1, sizeof(conf->locktype_profile));
+}
+
+/*
+ * profiles_add - Get a profile by name, adding it if needed
+ *
+ * To be used while building a configuration only: the lookup
+ * doesn't rely on the sorted table.
+ *
+ * \param conf - Configuration
+ * \param name - Profile name
+ * \return Returns profile index or failure (negative errno)
+ */
+int profiles_add(struct rqb_config *conf, const char *name)
+{
+	struct rqb_profile *prof;
+	int i;
+
+	for (i = 0; i < conf->num_profiles; i++) {
+		if (strcmp(conf->profiles[i].name, name) == 0)
+			return i;
+	}
+
+	if (conf->num_profiles >= MAX_PROFILES) {
+		ALOGE("Too many profiles, ignoring %s", name);
+		return -ENOSPC;
+	}
+
+	if (strlen(name) >= PROFILE_NAME_MAX) {
+		ALOGE("Profile name %s is too long", name);
+		return -ENAMETOOLONG;
+	}
+
+	prof = &conf->profiles[conf->num_profiles];
+	snprintf(prof->name, PROFILE_NAME_MAX, "%s", name);
+	prof->priority = PROFILE_DEFAULT_PRIORITY;
+
+	return conf->num_profiles++;
+}
+
+/*
+ * profiles_finalize - Complete a configuration after parsing
+ *
+ * Built-in modes missing from the configuration file behave like
+ * the balanced one, and the sorted names table gets built.
+ *
+ * \param conf - Configuration
+ * \param found - Bitmask of the profiles defined by the file
+ */
+void profiles_finalize(struct rqb_config *conf, unsigned int found)
+{
+	struct rqb_thermal_level lvl;
+	uint8_t tmp;
+	int i, j;
+
+	for (i = 0; i < POWER_MODE_MAX; i++) {
+		if (found & (1 << i))
+			continue;
+
+		ALOGE("Cannot parse configuration for %s mode!!!",
+		      conf->profiles[i].name);
+		if (i != POWER_MODE_BALANCED)
+			memcpy(&conf->profiles[i].params,
+			       &conf->profiles[POWER_MODE_BALANCED].params,
+			       sizeof(struct rqbalance_params));
+	}
+
+	/* Thermal levels may come in any order */
+	for (i = 1; i < (int)conf->thermal.num_levels; i++) {
+		lvl = conf->thermal.levels[i];
+		for (j = i; j > 0 && conf->thermal.levels[j - 1].temp > lvl.temp;
+		     j--)
+			conf->thermal.levels[j] = conf->thermal.levels[j - 1];
+		conf->thermal.levels[j] = lvl;
+	}
+
+	/* Few entries: insertion sort is just fine */
+	for (i = 0; i < conf->num_profiles; i++) {
+		tmp = i;
+		for (j = i; j > 0; j--) {
+			if (strcmp(conf->profiles[conf->sorted[j - 1]].name,
+				   conf->profiles[tmp].name) <= 0)
+				break;
+			conf->sorted[j] = conf->sorted[j - 1];
+		}
+		conf->sorted[j] = tmp;
+	}
+}
+
+/*
+ * profiles_load - Build a configuration, either from the compiled
+ *                 profiles or from the XML configuration file
+ *
+ * \param out - Receives the new configuration, to be published
+ * \return Returns success (0) or failure (negative errno)
+ */
+int profiles_load(struct rqb_config **out)
+{
+	char propval[PROPERTY_VALUE_MAX];
+	struct rqb_config *conf;
+	unsigned int found = 0;
+	bool use_cache;
+	int ret;
+
+	conf = calloc(1, sizeof(struct rqb_config));
+	if (conf == NULL)
+		return -ENOMEM;
+
+	property_get(PROP_PROFILE_CACHE, propval, "1");
+	use_cache = atoi(propval) != 0;
+
+	if (use_cache && profile_cache_load(RQBHAL_CONF_FILE,
+			PROFILE_CACHE_FILE, conf) == 0) {
+		ALOGI("Loaded compiled profiles");
+		goto end;
+	}
+
+	profiles_reset(conf);
+
+	ret = parse_xml_data(RQBHAL_CONF_FILE, conf, &found);
+	if (ret < 0) {
+		ALOGE("Cannot parse configuration file!!!");
+		free(conf);
+		return ret;
+	}
+
+	profiles_finalize(conf, found);
+
+	if (use_cache) {
+		mkdir(POWERSERVER_DIR, 0773);
+		if (profile_cache_store(RQBHAL_CONF_FILE,
+				PROFILE_CACHE_FILE, conf) < 0)
+			ALOGW("Cannot store compiled profiles");
+	}
+
+end:
+	*out = conf;
+
+	return 0;
+}
+
+/*
+ * profiles_publish - Make a configuration the current one
+ *
+ * Note: Not to be called concurrently, readers can run anytime.
+ *
+ * \param conf - New configuration, from profiles_load()
+ */
+void profiles_publish(struct rqb_config *conf)
+{
+	struct rqb_config *old;
+
+	old = __atomic_exchange_n(&config, conf, __ATOMIC_ACQ_REL);
+
+	free(retired);
+	retired = old;
+}
+
+/*
+ * profiles_init - Load and publish the configuration
+ *
+ * \return Returns success (0) or failure (negative errno)
+ */
+int profiles_init(void)
+{
+	struct rqb_config *conf;
+	int ret;
+
+	ret = profiles_load(&conf);
+	if (ret < 0)
+		return ret;
+
+	profiles_publish(conf);
+
+	return 0;
+}
+
+/*
+ * profiles_get - Get the current configuration
+ *
+ * The configuration stays valid until the next one after it
+ * gets published: load it once and keep using it.
+ *
+ * \return Returns the configuration
+ */
+struct rqb_config *profiles_get(void)
+{
+	return config_load();
+}
+
+/*
+ * profiles_count - Get the number of profiles
+ *
+ * \return Returns the number of profiles
+ */
+int profiles_count(void)
+{
+	struct rqb_config *conf = config_load();
+
+	return conf ? conf->num_profiles : 0;
+}
+
+/*
+ * profile_find - Find a profile by name
+ *
+ * \param name - Profile name
+ * \return Returns profile index or failure (negative errno)
+ */
+int profile_find(const char *name)
+{
+	struct rqb_config *conf = config_load();
+	int lo, hi, mid, cmp;
+
+	if (conf == NULL)
+		return -ENODEV;
+
+	/* Binary search on the sorted names table */
+	lo = 0;
+	hi = conf->num_profiles - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		cmp = strcmp(name, conf->profiles[conf->sorted[mid]].name);
+		if (cmp == 0)
+			return conf->sorted[mid];
+		if (cmp < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * profile_name - Get the name of a profile
+ *
+ * \param profile - Profile index
+ * \return Returns the profile name
+ */
+const char *profile_name(int profile)
+{
+	struct rqb_config *conf = config_load();
+
+	if (conf == NULL || profile < 0 || profile >= conf->num_profiles)
+		return "unknown";
+
+	return conf->profiles[profile].name;
+}
+
+/*
+ * profile_params - Get the parameters of a profile
+ *
+ * \param profile - Profile index
+ * \return Returns the parameters, or NULL if no such profile
+ */
+struct rqbalance_params *profile_params(int profile)
+{
+	struct rqb_config *conf = config_load();
+
+	if (conf == NULL || profile < 0 || profile >= conf->num_profiles)
+		return NULL;
+
+	return &conf->profiles[profile].params;
+}
+
+/*
+ * profile_for_locktype - Get the profile mapped to a perf lock type
+ *
+ * \param type - Lock type
+ * \return Returns profile index or failure (negative errno)
+ */
+int profile_for_locktype(int type)
+{
+	struct rqb_config *conf = config_load();
+
+	if (conf == NULL || type < 0 || type >= PROFILE_MAX_LOCKTYPES)
+		return -EINVAL;
+
+	if (conf->locktype_profile[type] < 0)
+		return -ENOENT;
+
+	return conf->locktype_profile[type];
+}
+
+/*
+ * profile_clusters_for_locktype - Get the clusters a lock type is
+ *                                 pinned to
+ *
+ * \param type - Lock type
+ * \return Returns clusters bitmask, 0 if not pinned
+ */
+unsigned int profile_clusters_for_locktype(int type)
+{
+	struct rqb_config *conf = config_load();
+
+	if (conf == NULL || type < 0 || type >= PROFILE_MAX_LOCKTYPES)
+		return 0;
+
+	return conf->locktype_clusters[type];
+}
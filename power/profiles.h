@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PROFILES_H__
+#define __PROFILES_H__
+
+#include <stdint.h>
+
+#include "power.h"
+#include "cluster_ctl.h"
+
+#define PROFILE_NAME_MAX		32
+#define MAX_PROFILES			32
+#define PROFILE_MAX_LOCKTYPES		0x100
+#define PROFILE_DEFAULT_PRIORITY	2
+#define THERMAL_ZONE_MAX		40
+#define THERMAL_MAX_LEVELS		8
+#define THERMAL_DEFAULT_POLL_MS		2000
+#define THERMAL_DEFAULT_HYSTERESIS	2000	/* millidegrees */
+
+/*
+ * struct rqb_profile
+ * One named power profile
+ *
+ * The first POWER_MODE_MAX profiles always are the built-in
+ * power modes, in rqb_pwr_mode_t order: any other profile
+ * comes from the configuration file.
+ */
+struct rqb_profile {
+	char name[PROFILE_NAME_MAX];
+	int32_t priority;		/* Higher value wins */
+	struct rqbalance_params params;
+	struct rqb_cluster_params clusters[TOPOLOGY_MAX_CLUSTERS];
+};
+
+/*
+ * struct rqb_thermal_level
+ * One step of the thermal budget
+ *
+ * Applies from its temperature upwards, until the next level.
+ * A zero limit leaves the parameter unclamped.
+ */
+struct rqb_thermal_level {
+	int32_t temp;			/* millidegrees Celsius */
+	uint32_t max_cpus;
+	uint32_t max_freq[TOPOLOGY_MAX_CLUSTERS];	/* KHz */
+};
+
+/*
+ * struct rqb_thermal
+ * Thermal budget configuration, levels sorted by temperature
+ */
+struct rqb_thermal {
+	char zone[THERMAL_ZONE_MAX];	/* Thermal zone type */
+	uint32_t poll_ms;
+	int32_t hysteresis;		/* millidegrees */
+	uint32_t num_levels;		/* 0: no thermal budget */
+	struct rqb_thermal_level levels[THERMAL_MAX_LEVELS];
+};
+
+/*
+ * struct rqb_config
+ * The whole PowerHAL configuration
+ *
+ * Flat and fixed size, so that it can be stored and mapped
+ * back as-is by the profiles cache.
+ */
+struct rqb_config {
+	int32_t num_profiles;
+	struct rqb_profile profiles[MAX_PROFILES];
+	uint8_t sorted[MAX_PROFILES];	/* Profiles indexes, sorted by name */
+	int8_t locktype_profile[PROFILE_MAX_LOCKTYPES];	/* -1: not mapped */
+	uint8_t locktype_clusters[PROFILE_MAX_LOCKTYPES]; /* 0: not pinned */
+	struct rqb_thermal thermal;
+};
+
+/* Exported functions */
+void profiles_reset(struct rqb_config *conf);
+int profiles_add(struct rqb_config *conf, const char *name);
+void profiles_finalize(struct rqb_config *conf, unsigned int found);
+int profiles_load(struct rqb_config **out);
+void profiles_publish(struct rqb_config *conf);
+int profiles_init(void);
+struct rqb_config *profiles_get(void);
+int profiles_count(void);
+int profile_find(const char *name);
+const char *profile_name(int profile);
+struct rqbalance_params *profile_params(int profile);
+int profile_for_locktype(int type);
+unsigned int profile_clusters_for_locktype(int type);
+
+#endif
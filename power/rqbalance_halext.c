@@ -33,6 +33,9 @@
 #include <utils/Log.h>
 
 #include "power.h"
+#include "metrics.h"
+#include "profiles.h"
+#include "timerwheel.h"
 #include "rqbalance_halext.h"
 
 /*******************************************************************/
@@ -64,90 +67,182 @@
  * that was initialized and being used by the driver or Android
  * HAL identified by the specified ID.
  *
+ * If no ID is passed and argument[] holds resource requests
+ * (LOCKPARAM), a new lock holding those resources gets created
+ * instead: resources are restored when the lock is released or
+ * expires.
+ *
+ * While the screen is off, resource requests are refused with
+ * -EAGAIN; lock types are accepted but only take effect on resume.
+ *
  * Please note that there's no fixed ID.
  * The ID is dynamically assigned on a first-come, first-served
  * logic.
  */
 
-static struct rqbalance_ctl_locks current_locks[MAX_PERMITTED_LOCKS];
+/*
+ * The locks table:
+ *
+ * Locks live in slots that never move, allocated in chunks of
+ * LOCK_CHUNK_SIZE as more locks are needed, and get addressed
+ * by the slot index that is embedded in their unique ID, so
+ * that finding a lock from its ID is immediate.
+ * Free slots are kept in a list, and active locks are also
+ * linked in one list per lock type.
+ */
+static struct rqbalance_ctl_locks
+		*lock_chunks[MAX_PERMITTED_LOCKS / LOCK_CHUNK_SIZE];
+static int lock_capacity = 0;
+static int free_slot = -1;
+static int type_head[MAX_LOCK_TYPES] = {
+	[0 ... MAX_LOCK_TYPES - 1] = -1
+};
 static short number_of_locks = 0;
-static int possible_cores = -1;
 
-int get_locktype_by_tid(timer_t timerid);
 int get_locktype_by_id(unsigned int id);
 int locktype_action(int entry, int state);
+void remove_lock(int entryno);
 
-/* Timer Handling */
+/* Locks table */
+
+static inline struct rqbalance_ctl_locks *lock_at(int slot)
+{
+	return &lock_chunks[slot / LOCK_CHUNK_SIZE][slot % LOCK_CHUNK_SIZE];
+}
 
 /*
- * timer_expired - Callback function for rqbalance_ctl timers
+ * grow_locks - Add a chunk of free slots to the locks table
  *
- * \param sig - Structure passed by *(sigev_notify_function)
+ * \return Returns success (0) or failure (negative errno)
  */
-static void timer_expired(union sigval sig)
+static int grow_locks(void)
 {
-	int ltid;
+	struct rqbalance_ctl_locks *chunk;
+	int i;
 
-	if (sig.sival_int == 0)
-		return;
+	if (lock_capacity >= MAX_PERMITTED_LOCKS)
+		return -ENOSPC;
 
-	ltid = get_locktype_by_id((unsigned int)sig.sival_int);
+	chunk = calloc(LOCK_CHUNK_SIZE, sizeof(struct rqbalance_ctl_locks));
+	if (chunk == NULL)
+		return -ENOMEM;
 
-	locktype_action(ltid, 0);
+	lock_chunks[lock_capacity / LOCK_CHUNK_SIZE] = chunk;
 
-	return;
+	/* Push in reverse, so that lower slots get used first */
+	for (i = LOCK_CHUNK_SIZE - 1; i >= 0; i--) {
+		chunk[i].gen = 1;
+		chunk[i].next = free_slot;
+		free_slot = lock_capacity + i;
+	}
+
+	lock_capacity += LOCK_CHUNK_SIZE;
+
+	return 0;
 }
 
 /*
- * start_timer - Initialize itimerspec and start the timer
+ * slot_alloc - Take a free slot out of the locks table
  *
- * \param timerid - ID of the timer
- * \param duration_ms - Timer duration in milliseconds
- * \return Returns success (0) or failure (negative errno)
+ * \return Returns slot index or failure (negative errno)
  */
-static int start_timer(timer_t timerid, int duration_ms)
+static int slot_alloc(void)
 {
-	struct itimerspec tspec;
-	int entryno;
-
-	tspec.it_value.tv_sec = MSEC_TO_SEC(duration_ms);
-	tspec.it_value.tv_nsec = MSEC_TO_NSEC(duration_ms);
-	/* Do not auto-rearm */
-	tspec.it_interval.tv_sec = 0;
-	tspec.it_interval.tv_nsec = 0;
+	int slot, ret;
 
-	entryno = get_locktype_by_tid(timerid);
-	if (!entryno) {
-		ALOGE("WTF: Tried to start timer for unexistant perflock!");
-		return entryno;
+	if (free_slot < 0) {
+		ret = grow_locks();
+		if (ret < 0)
+			return ret;
 	}
 
-	locktype_action(entryno, 1);
+	slot = free_slot;
+	free_slot = lock_at(slot)->next;
 
-	return timer_settime(timerid, 0, &tspec, NULL);
+	return slot;
 }
 
 /*
- * new_timer - Create a new monotonic timer with unique ID
+ * slot_free - Give a slot back to the locks table
  *
- * \param timerid - ID of the timer
- * \param luid - Lock unique identifier
- * \return Returns success (0) or failure (negative errno)
+ * \param slot - Slot index
  */
-static int new_timer(timer_t timerid, int luid)
+static void slot_free(int slot)
 {
-	int ret = 0;
-	struct sigevent sev;
+	struct rqbalance_ctl_locks *lock = lock_at(slot);
 
-	sev.sigev_notify = SIGEV_SIGNAL;
-	sev.sigev_notify_function = &timer_expired;
-	sev.sigev_notify_attributes = NULL;
-	sev.sigev_value.sival_int = luid;
+	lock->used = false;
+	lock->luid = 0;
 
-	if (!timer_create(CLOCK_MONOTONIC, &sev, &timerid))
-		return -ETIME;
+	/* Invalidate any handle still pointing to this slot */
+	lock->gen = (lock->gen + 1) & LOCK_GEN_MASK;
+	if (lock->gen == 0)
+		lock->gen = 1;
 
-	return 0;
+	lock->next = free_slot;
+	free_slot = slot;
+}
+
+/*
+ * type_link - Add a lock to the list of its lock type
+ *
+ * \param slot - Slot index
+ */
+static void type_link(int slot)
+{
+	struct rqbalance_ctl_locks *lock = lock_at(slot);
+	int head = type_head[lock->drid];
+
+	lock->prev = -1;
+	lock->next = head;
+	if (head >= 0)
+		lock_at(head)->prev = slot;
+	type_head[lock->drid] = slot;
+}
+
+/*
+ * type_unlink - Remove a lock from the list of its lock type
+ *
+ * \param slot - Slot index
+ */
+static void type_unlink(int slot)
+{
+	struct rqbalance_ctl_locks *lock = lock_at(slot);
+
+	if (lock->prev >= 0)
+		lock_at(lock->prev)->next = lock->next;
+	else
+		type_head[lock->drid] = lock->next;
+
+	if (lock->next >= 0)
+		lock_at(lock->next)->prev = lock->prev;
+}
+
+/* Timer Handling */
+
+/*
+ * lock_expired - Callback function for rqbalance_ctl timers
+ *
+ * Timers run on the PowerServer thread, from the timer wheel,
+ * which is the same thread serving the lock requests.
+ *
+ * \param timer - Expired timer, carrying the lock unique identifier
+ */
+static void lock_expired(struct tw_timer *timer)
+{
+	int ltid;
+
+	if (timer->data == 0)
+		return;
+
+	ltid = get_locktype_by_id((unsigned int)timer->data);
+	if (ltid < 0)
+		return;
+
+	/* Expired: drop the lock, so that its request gets removed */
+	remove_lock(ltid);
+
+	return;
 }
 
 char* lock_type_str(int t)
@@ -167,88 +262,110 @@ char* lock_type_str(int t)
 }
 
 /* Search functions */
-int get_locktype_by_tid(timer_t tid)
+int get_locktype_by_id(unsigned int id)
 {
-	int i;
+	int slot = id & LOCK_SLOT_MASK;
 
-	for (i = 0; i < number_of_locks; i++) {
-		if (current_locks[number_of_locks].tid == tid)
-			return i;
-	}
+	if (slot >= lock_capacity)
+		return -EINVAL;
 
-	return -EINVAL;
+	/* Stale IDs carry an old generation */
+	if (!lock_at(slot)->used || lock_at(slot)->luid != id)
+		return -EINVAL;
+
+	return slot;
 }
 
-int get_locktype_by_id(unsigned int id)
+int get_locktype_by_type(unsigned short type)
 {
-	int i;
+	if (type >= MAX_LOCK_TYPES || type_head[type] < 0)
+		return -EINVAL;
 
-	for (i = 0; i < number_of_locks; i++) {
-		if (current_locks[number_of_locks].luid == id)
-			return i;
-	}
-
-	return -EINVAL;
+	return type_head[type];
 }
 
-int get_locktype_by_type(unsigned short type)
+/* HALExt Logic */
+
+/*
+ * locktype_to_mode - Get the profile requested by a lock type
+ *
+ * Lock types mapped to a profile by the configuration take
+ * precedence over the built-in mapping.
+ *
+ * \param type - Lock type (from enum LOCKTYPE)
+ * \return Returns profile index or failure (negative errno)
+ */
+static int locktype_to_mode(int type)
 {
-	int i;
+	int profile = profile_for_locktype(type);
 
-	for (i = 0; i < number_of_locks; i++) {
-		if (current_locks[number_of_locks].drid == type)
-			return i;
+	if (profile >= 0)
+		return profile;
+
+	switch (type) {
+		case OMX_DECODER:
+			return POWER_MODE_OMXDECODE;
+		case OMX_ENCODER:
+			return POWER_MODE_OMXENCODE;
+		default:
+			break;
 	}
 
 	return -EINVAL;
 }
 
-/* HALExt Logic */
+/*
+ * lock_vote - Add or remove the profile request of a lock
+ *
+ * \param lock - Lock
+ * \param enable - true: add request, false: remove request
+ * \return Returns true if the lock type requests a profile
+ */
+static bool lock_vote(struct rqbalance_ctl_locks *lock, bool enable)
+{
+	int mode = locktype_to_mode(lock->drid);
+
+	if (mode < 0)
+		return false;
+
+	lock_power_mode(mode, profile_clusters_for_locktype(lock->drid),
+			enable);
+	return true;
+}
 
 /*
  * locktype_action - Take an action for the input lock type
  *
+ * Every active lock holds a request for its power mode: the
+ * effective profile gets resolved out of all the requests, so
+ * releasing one lock never drops the profile of the others.
+ *
  * \param entry - Position in the locks array
  * \param state - Requested action
  * \return Returns success (0) or failure (negative errno)
  */
 int locktype_action(int entry, int state)
 {
-	int type = current_locks[entry].drid;
+	struct rqbalance_ctl_locks *lock = lock_at(entry);
+	int type = lock->drid;
+
+	state = state ? STATE_ENABLE : STATE_DISABLE;
+	if (lock->state == state)
+		return 0;
+
+	ALOGI("%s hint %s.", lock_type_str(type),
+	      state ? "received" : "released");
+
+	lock->state = state;
+
+	if (lock_vote(lock, state))
+		return 0;
 
 	switch (type)
 	{
-		case OMX_DECODER:
-			ALOGI("OMX Decoder hint received.");
-			if (state) {
-				set_power_mode(POWER_MODE_OMXDECODE);
-			} else {
-				set_power_mode(POWER_MODE_BALANCED);
-			}
-			break;
 		case DISPLAY_LAYER:
-			ALOGI("Display layer hint received.");
-			if (state) {
-			/* do stuff */
-			} else {
-			/* revert stuff */
-			}
-			break;
-		case OMX_ENCODER:
-			ALOGI("OMX Encoder hint received.");
-			if (state) {
-				set_power_mode(POWER_MODE_OMXENCODE);
-			} else {
-				set_power_mode(POWER_MODE_BALANCED);
-			}
-			break;
 		case RQB_POWERHAL:
-			ALOGI("RQBalance PowerHAL hint received.");
-			if (state) {
-			/* do stuff */
-			} else {
-			/* revert stuff */
-			}
+			/* Nothing to do (yet) */
 			break;
 		default:
 			ALOGE("ERROR: Unknown hint type %d !!!!", type);
@@ -260,155 +377,106 @@ int locktype_action(int entry, int state)
 
 int new_lock_init(unsigned int time, unsigned short type, int state)
 {
+	struct rqbalance_ctl_locks *lock;
 	unsigned int luid;
-	int locknum, ret;
+	int locknum;
 
-	/* If lock is already present */
-	ret = get_locktype_by_type(type);
-	if (ret) {
-		locknum = ret;
-		luid = current_locks[locknum].luid;
-
-		if (time > 0)
-			start_timer(current_locks[locknum].tid, time);
-
-		goto do_action;
-	} else {
-		luid = rand();
+	/* Every acquisition is a lock on its own, with a unique ID */
+	locknum = slot_alloc();
+	if (locknum < 0) {
+		ALOGE("ERROR: Too many locks!!");
+		return -ENOSPC;
 	}
 
+	/* Initialize the slot with new lock infos */
+	lock = lock_at(locknum);
+	luid = (lock->gen << LOCK_SLOT_BITS) | locknum;
+	lock->luid = luid;
+	lock->time = time;
+	lock->drid = type;
+	lock->state = STATE_DISABLE;
+	lock->used = true;
+	type_link(locknum);
 	number_of_locks++;
+	metrics_lock(type);
 
-	/* Initialize current_locks array element with new lock infos */
-	current_locks[number_of_locks].luid = luid;
-	current_locks[number_of_locks].time = time;
-	current_locks[number_of_locks].drid = type;
-	current_locks[number_of_locks].state = state;
-	locknum = number_of_locks;
-
-do_action:
-	if (time) {
-		ret = new_timer(current_locks[locknum].tid,
-				current_locks[locknum].luid);
-		if (ret) {
-			ALOGE("ERROR: Cannot create timed lock!!");
-			return ret;
-		}
-		ret = start_timer(current_locks[locknum].tid, time);
-		if (ret) {
-			ALOGE("ERROR: Cannot start timer!!");
-			return ret;
-		}
-	} else {
-		locktype_action(locknum, 1);
-	}
+	ALOGD("New %s lock 0x%x (state 0x%x)", lock_type_str(type),
+	      luid, state);
+
+	timerwheel_setup(&lock->timer, lock_expired, luid);
+
+	locktype_action(locknum, 1);
+
+	if (time)
+		timerwheel_add(&lock->timer, time);
 
 	return luid;
 }
 
-int lock_set_arg(int lparm)
+/*
+ * lock_set_args - Make a lock hold the resources (LOCKPARAM) requested
+ *                 by the lock arguments, on top of the ones it holds
+ *
+ * Unknown arguments are skipped, as clients may send requests
+ * meant for other platforms along with the supported ones.
+ *
+ * \param entryno - Position in the locks table
+ * \param params - Lock request
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int lock_set_args(int entryno, struct rqbalance_halext_params *params)
 {
-	int ret = -EINVAL;
-	bool is_varparm;
-	char tmp[2];
-
-	switch (lparm)
-	{
-		case ALL_CPUS_PWR_CLPS_DIS:
-			ALOGE("Power collapse disable not implemented");
-			return -EINVAL;
-		case CPU0_MIN_FREQ_TURBO_MAX:
-		case CPU4_MIN_FREQ_TURBO_MAX:
-			ALOGE("Frequency optimizations not implemented");
-			return -EINVAL;
-		case ALL_CORES_ONLINE:
-			ALOGE("Special core modes not implemented");
-			//snprintf(tmp, 2, "%d", possible_cores);
-			//__set_spc_power_mode(tmp, tmp, NULL, NULL, NULL);
-			/*
-			 * TODO: Create a timer? When should we put cores back
-			 *       to the balanced/previous profile???
-			 */
-			return -EINVAL;
-		default:
-			ALOGD("Parameter not implemented: 0x%x", lparm);
-			return -EINVAL;
+	struct rqbalance_ctl_locks *lock = lock_at(entryno);
+	struct boost_set set;
+	int i, count, found = 0;
+
+	/* Number of arguments, but there's always at least one */
+	count = params->arraysz > 0 ? params->arraysz : 1;
+	if (count > MAX_ARGUMENTS)
+		count = MAX_ARGUMENTS;
+
+	memcpy(&set, &lock->boost, sizeof(set));
+	for (i = 0; i < count; i++) {
+		if (boost_parse_arg(&set, params->argument[i]) == 0)
+			found++;
 	}
 
-	return ret;
+	if (!found)
+		return -EINVAL;
+
+	/* Take the new set before dropping the old one: no bouncing */
+	boost_apply(&set, true);
+	boost_apply(&lock->boost, false);
+	memcpy(&lock->boost, &set, sizeof(set));
+
+	return 0;
 }
 
-void remove_and_reorder(int entryno)
+void remove_lock(int entryno)
 {
-	/* This is paranoid, but avoids possible future coding mistakes */
-	/* Note: Will probably get optimized out by the compiler */
-	if (entryno == number_of_locks)
-		goto end;
-
-	if (entryno < number_of_locks) {
-		memcpy(&current_locks[entryno], &current_locks[number_of_locks],
-			sizeof(struct rqbalance_ctl_locks));
+	struct rqbalance_ctl_locks *lock;
+
+	if (entryno < 0 || entryno >= lock_capacity)
+		return;
+
+	lock = lock_at(entryno);
+	if (!lock->used)
 		return;
-	}
 
-end:
 	/* Run optimization parameter deactivation */
 	locktype_action(entryno, 0);
-	/*
-	 * Remove only the ID. That's the only sensible information
-	 * in there (may contain a possible hook to a kernel driver)
-	 */
-	current_locks[entryno].luid = 0;
-	number_of_locks--;
-	return;
-}
 
-static ssize_t sysfs_read(char *path, char *s, int num_bytes)
-{
-    char buf[80];
-    ssize_t count;
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) {
-        strerror_r(errno, buf, sizeof(buf));
-        ALOGE("Error reading from %s: %s\n", path, buf);
-        return -1;
-    }
-    if ((count = read(fd, s, (num_bytes - 1))) < 0) {
-        strerror_r(errno, buf, sizeof(buf));
-        ALOGE("Error reading from  %s: %s\n", path, buf);
-    } else {
-        if ((count >= 1) && (s[count-1] == '\n')) {
-            s[count-1] = '\0';
-        } else {
-            s[count] = '\0';
-        }
-    }
-    close(fd);
-    ALOGV("read '%s' from %s", s, path);
-    return count;
-}
+	timerwheel_del(&lock->timer);
 
-/*
- * get_possible_cores - Read configured cores from sysfs
- *
- * \return Returns number of cores or failure (negative errno)
- */
-static int get_possible_cores(void)
-{
-	char buf[10];
-	int mincore, maxcore;
+	/* Give back the resources, restoring their previous state */
+	boost_apply(&lock->boost, false);
+	memset(&lock->boost, 0, sizeof(lock->boost));
 
-	if (sysfs_read(SYS_CPUPOSS_PATH, buf, 10) < 0) {
-		ALOGE("Cannot get number of cores in the system!!!");
-		return -ENXIO;
-	}
-
-	if (sscanf(buf, "%d-%d", &mincore, &maxcore) < 2) {
-		ALOGE("Error while scanning cores!!");
-		return -ENXIO;
-	}
-
-	return maxcore;
+	/* Other slots are left untouched: their IDs stay valid */
+	type_unlink(entryno);
+	slot_free(entryno);
+	number_of_locks--;
+	return;
 }
 
 /*
@@ -420,19 +488,40 @@ static int get_possible_cores(void)
  */
 int halext_perf_lock_acquire(struct rqbalance_halext_params *params)
 {
-	int arraysz, id, lock_type, lock_state, i, ret = -EINVAL;
-
-	if (possible_cores < 0)
-		possible_cores = get_possible_cores();
+	int arraysz, id, lock_type, lock_state, i, entryno, ret;
 
 	arraysz = params->arraysz;
 	id = params->id;
 
+	/* Same requests from the socket and from the shared ring */
+	if (arraysz < 0 || arraysz > MAX_ARGUMENTS)
+		return -EINVAL;
+
+	/* Resources are written directly: not while suspended */
+	if (power_suspended() && boost_is_arg(params->argument[0]))
+		return -EAGAIN;
+
+	if (!id && boost_is_arg(params->argument[0])) {
+		/* A new lock holding resources only */
+		id = new_lock_init((unsigned int)params->time,
+					RQB_POWERHAL, STATE_ENABLE);
+		if (id < 0)
+			return id;
+
+		ret = lock_set_args(get_locktype_by_id(id), params);
+		if (ret < 0) {
+			remove_lock(get_locktype_by_id(id));
+			return ret;
+		}
+
+		return id;
+	}
+
 	if (!id) {
 		if (arraysz > 1) {
 			ALOGE("Unexpected argument. Bailing out.");
 			ALOGD("Arguments: %d", arraysz);
-			for (i = 0; i <=arraysz; i++)
+			for (i = 0; i < arraysz && i < MAX_ARGUMENTS; i++)
 				ALOGD("Arg[%d]: 0x%x", i, params->argument[i]);
 			return -EINVAL;
 		}
@@ -444,35 +533,80 @@ int halext_perf_lock_acquire(struct rqbalance_halext_params *params)
 					lock_type, lock_state);
 	}
 
-	for (i = 0; i <= arraysz; i++) {
-		ret = lock_set_arg(params->argument[i]);
-		if (ret < 0)
-			return ret;
-	}
+	/* Add resources to an existing lock */
+	entryno = get_locktype_by_id((unsigned int)id);
+	if (entryno < 0)
+		return -ENXIO;
+
+	ret = lock_set_args(entryno, params);
+	if (ret < 0)
+		return ret;
 
-	return ret;
+	return id;
 }
 
 int halext_perf_lock_release(int id)
+{
+	int entryno;
+
+	entryno = get_locktype_by_id((unsigned int)id);
+	if (entryno < 0) {
+		ALOGD("WTF: Tried to remove an unexistant lock.");
+		return -ENXIO;
+	}
+
+	remove_lock(entryno);
+	return 0;
+}
+
+/*
+ * halext_revote - Add or remove the profile requests of all the
+ *                 active locks
+ *
+ * Lock types may map to different profiles after a configuration
+ * reload: requests get removed with the old configuration, then
+ * added back with the new one.
+ *
+ * \param enable - true: add requests, false: remove requests
+ */
+void halext_revote(bool enable)
+{
+	struct rqbalance_ctl_locks *lock;
+	int slot;
+
+	for (slot = 0; slot < lock_capacity; slot++) {
+		lock = lock_at(slot);
+		if (lock->used && lock->state == STATE_ENABLE)
+			lock_vote(lock, enable);
+	}
+}
+
+/*
+ * halext_perf_lock_batch - Acquires and/or releases a set of performance
+ *                          locks in one go.
+ *
+ * \param params - Array of lock requests
+ * \param count - Number of requests
+ * \param replies - Array receiving one handle or errno per request
+ * \return Returns success (0) or negative errno.
+ */
+int halext_perf_lock_batch(struct rqbalance_halext_params *params,
+			   int count, int32_t *replies)
 {
 	int i;
 
-	/*
-	 * Many times, it happens that a driver
-	 * requests a lock for a very small amount
-	 * of time, hence search in reverse order.
-	 */
-	for (i = number_of_locks; i >=0; i--) {
-		if (i < 0) {
-			ALOGD("WTF: FIXME FIXME FIXME FIXME FIXME FIXME");
-			ALOGD("WTF: Tried to remove an unexistant lock.");
-			ALOGD("WTF: FIXME FIXME FIXME FIXME FIXME FIXME");
-			return -ENXIO;
-		} else if ((unsigned int)id == current_locks[i].luid) {
-			remove_and_reorder(i);
-			break;
-		}
+	if (count <= 0 || count > HALEXT_MAX_BATCH)
+		return -EINVAL;
+
+	/* One profile re-evaluation for the whole batch */
+	power_batch_begin();
+	for (i = 0; i < count; i++) {
+		if (params[i].acquire)
+			replies[i] = halext_perf_lock_acquire(&params[i]);
+		else
+			replies[i] = halext_perf_lock_release(params[i].id);
 	}
+	power_batch_end();
 
 	return 0;
 }
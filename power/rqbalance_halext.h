@@ -14,21 +14,46 @@
  * limitations under the License.
  */
 
-#define SYS_CPUPOSS_PATH	"/sys/devices/system/cpu/possible"
+#ifndef __RQBALANCE_HALEXT_H__
+#define __RQBALANCE_HALEXT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "boost.h"
+#include "timerwheel.h"
 
 /* HalExt definitions */
-#define MAX_PERMITTED_LOCKS	10	/* Maximum number of locks */
+#define LOCK_SLOT_BITS		10
+#define LOCK_SLOT_MASK		((1 << LOCK_SLOT_BITS) - 1)
+#define LOCK_GEN_MASK		(0x7fffffff >> LOCK_SLOT_BITS)
+#define LOCK_CHUNK_SIZE		16	/* Locks allocated at once */
+#define MAX_PERMITTED_LOCKS	(1 << LOCK_SLOT_BITS) /* Max number of locks */
+#define MAX_LOCK_TYPES		0x100
 #define MAX_ARGUMENTS		20	/* Maximum number of params */
 
 #define MSEC_TO_SEC(x)		x/1000
 #define MSEC_TO_NSEC(x)		x*1000000
 
+/*
+ * struct rqbalance_ctl_locks
+ * One slot of the locks table
+ *
+ * The lock unique identifier is made of the slot generation,
+ * bumped every time that the slot gets freed, and the slot
+ * index: a handle of a released lock never matches a new one.
+ */
 struct rqbalance_ctl_locks {
 	unsigned int luid;	/* Lock unique identifier */
+	unsigned int gen;	/* Slot generation */
 	unsigned int time;	/* Time to hold the lock */
 	unsigned short drid;	/* Driver/HAL identifier */
-	timer_t tid;		/* ID of the POSIX timer */
+	struct tw_timer timer;	/* Lock expiry timer */
+	struct boost_set boost;	/* Resources held by the lock */
 	int state;		/* State: enable/disable */
+	bool used;		/* Slot holds an active lock */
+	int prev;		/* Previous lock of the same type */
+	int next;		/* Next lock of the same type, or free slot */
 };
 
 struct rqbalance_halext_params {
@@ -39,6 +64,112 @@ struct rqbalance_halext_params {
 	int32_t arraysz;
 };
 
+/*
+ * PowerServer protocol
+ *
+ * Every message starts with a header carrying a client chosen
+ * request id, which the server echoes back in the reply: this
+ * lets a client keep one connection open and have more than one
+ * request in flight on it.
+ * A message that is exactly sizeof(struct rqbalance_halext_params)
+ * long is a legacy request and gets a bare int32_t reply.
+ */
+#define HALEXT_MSG_MAGIC	0x52514258	/* "RQBX" */
+#define HALEXT_MAX_BATCH	16	/* Maximum locks per batch message */
+
+typedef enum {
+	HALEXT_OP_PERF_LOCK	= 0x1,
+	HALEXT_OP_PERF_LOCK_BATCH,
+	HALEXT_OP_LAUNCH_STATS,
+	HALEXT_OP_METRICS,
+	HALEXT_OP_RELOAD,
+	HALEXT_OP_SYSFS_JOURNAL,
+	HALEXT_OP_SHM_ATTACH,
+} HALEXT_OP;
+
+struct rqbalance_halext_hdr {
+	uint32_t magic;
+	uint32_t reqid;
+	uint16_t op;
+	uint16_t count;
+};
+
+struct rqbalance_halext_msg {
+	struct rqbalance_halext_hdr hdr;
+	struct rqbalance_halext_params params;
+};
+
+/*
+ * Batch messages carry hdr.count requests, each one being either
+ * an acquire or a release, and get hdr.count replies back in the
+ * same order. Only the used part of the arrays is transferred.
+ *
+ * Launch statistics requests are a bare header and get back
+ * LAUNCH_STAT_MAX replies, ordered as enum launch_stat_t.
+ *
+ * Metrics requests are a bare header too: the reply header has
+ * a zero count and is followed by a plain text dump, one line per
+ * item, up to the end of the message.
+ *
+ * Reload requests are a bare header as well, and get one reply:
+ * zero if the configuration got reloaded, negative errno if not.
+ *
+ * Sysfs journal requests work like the metrics ones: the text dump
+ * has the write counters of every node, then the last sysfs writes
+ * and profile switches, oldest first.
+ *
+ * Shared memory attach requests are a bare header and get one
+ * reply: zero, with the ring memory, request doorbell and
+ * completion doorbell file descriptors attached (SCM_RIGHTS, in
+ * this order), or negative errno. Attaching again replaces the
+ * ring of the connection.
+ */
+struct rqbalance_halext_batch_msg {
+	struct rqbalance_halext_hdr hdr;
+	struct rqbalance_halext_params params[HALEXT_MAX_BATCH];
+};
+
+struct rqbalance_halext_reply {
+	struct rqbalance_halext_hdr hdr;
+	int32_t reply[HALEXT_MAX_BATCH];
+};
+
+/*
+ * Shared memory ring
+ *
+ * Trusted clients on the per-frame path can skip the socket round
+ * trip: every slot of the ring carries one lock request, which the
+ * client claims (FREE -> BUSY), fills and hands over (REQUEST),
+ * then rings the request doorbell. The PowerServer takes it
+ * (RUNNING), runs it, stores the reply (DONE) and rings the
+ * completion doorbell. The client reads the reply and gives the
+ * slot back (FREE). A client may take back a request that the
+ * server didn't take yet (REQUEST -> FREE).
+ */
+#define HALEXT_SHM_MAGIC	0x52514253	/* "RQBS" */
+#define HALEXT_SHM_SLOTS	32	/* At most 32: one bit each */
+#define HALEXT_SHM_FDS		3	/* Memory, request and completion */
+
+typedef enum {
+	HALEXT_SLOT_FREE,
+	HALEXT_SLOT_BUSY,
+	HALEXT_SLOT_REQUEST,
+	HALEXT_SLOT_RUNNING,
+	HALEXT_SLOT_DONE,
+} HALEXT_SLOT_STATE;
+
+struct rqbalance_halext_slot {
+	uint32_t state;
+	int32_t reply;
+	struct rqbalance_halext_params params;
+};
+
+struct rqbalance_halext_ring {
+	uint32_t magic;
+	uint32_t num_slots;
+	struct rqbalance_halext_slot slots[HALEXT_SHM_SLOTS];
+};
+
 typedef enum {
 	ALL_CPUS_PWR_CLPS_DIS		= 0x101,
 	MINCORES			= 0x700,	/* 0x7XX XX=NCores */
@@ -62,3 +193,8 @@ typedef enum {
 /* Exported functions */
 int halext_perf_lock_acquire(struct rqbalance_halext_params *params);
 int halext_perf_lock_release(int id);
+int halext_perf_lock_batch(struct rqbalance_halext_params *params,
+			   int count, int32_t *replies);
+void halext_revote(bool enable);
+
+#endif
@@ -0,0 +1,421 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RQBalance-PowerHAL-SysFS"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <cutils/properties.h>
+#include <utils/Log.h>
+
+#include "power.h"
+#include "sysfs_cache.h"
+#include "sysfs_journal.h"
+
+/*
+ * The RQBalance nodes get written on every power mode switch and
+ * launch hints are fired really often: opening and closing five
+ * files every time adds measurable latency to the hint path.
+ *
+ * Keep every node open for the whole HAL lifetime and rewrite it
+ * with pwrite() at offset 0, which makes sysfs call the store()
+ * callback again exactly like a fresh open/write/close would.
+ *
+ * If a node disappears or gets recreated (driver reload, CPU
+ * hotplug), the write fails with a "stale descriptor" class of
+ * error: in that case, reopen the node and retry once.
+ *
+ * Every node also keeps a shadow copy of the last value that was
+ * successfully written to it, so that sysfs_cache_update() can skip
+ * writing values that the driver already has: a redundant write to
+ * nr_power_max_cpus is not free, as it may kick hotplug work.
+ * The shadow gets invalidated whenever we lose track of the real
+ * node contents (reopen or failed write).
+ *
+ * More nodes (i.e. per-CPU cpufreq ones) can be added at runtime,
+ * optionally opened for reading as well, to save their value.
+ *
+ * Every write and skipped write is recorded in the sysfs journal.
+ *
+ * On debuggable builds, all of the sysfs accesses of the HAL can be
+ * redirected to a directory mirroring the sysfs layout, set with
+ * the powerhal.sysfs_root property, to run a policy against fake
+ * nodes and read back what it wrote from the journal.
+ */
+
+struct sysfs_cached_node {
+	const char *path;
+	int fd;
+	bool readable;
+	bool shadow_valid;
+	char shadow[PROP_VALUE_MAX];
+};
+
+static struct sysfs_cached_node nodes[SYSFS_NODE_MAX + SYSFS_DYN_NODES] = {
+	[SYSFS_NODE_UPCORE_THRESH]	= { SYS_UPCORE_THRESH,	-1 },
+	[SYSFS_NODE_DNCORE_THRESH]	= { SYS_DNCORE_THRESH,	-1 },
+	[SYSFS_NODE_BALANCE_LVL]	= { SYS_BALANCE_LVL,	-1 },
+	[SYSFS_NODE_MAX_CPUS]		= { SYS_MAX_CPUS,	-1 },
+	[SYSFS_NODE_MIN_CPUS]		= { SYS_MIN_CPUS,	-1 },
+};
+
+static int num_nodes = SYSFS_NODE_MAX;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char sysfs_root[PROPERTY_VALUE_MAX];
+static pthread_once_t sysfs_root_once = PTHREAD_ONCE_INIT;
+
+/*
+ * sysfs_root_init - Read the sysfs root redirection, once
+ */
+static void sysfs_root_init(void)
+{
+	char propval[PROPERTY_VALUE_MAX];
+	size_t len;
+
+	property_get(PROP_DEBUGGABLE, propval, "0");
+	if (strcmp(propval, "1") != 0)
+		return;
+
+	property_get(PROP_SYSFS_ROOT, sysfs_root, "");
+
+	/* Paths already start with a slash */
+	len = strlen(sysfs_root);
+	while (len > 0 && sysfs_root[len - 1] == '/')
+		sysfs_root[--len] = '\0';
+
+	if (len)
+		ALOGW("Redirecting sysfs to %s", sysfs_root);
+}
+
+/*
+ * sysfs_path - Get the path to actually access for a sysfs node
+ *
+ * \param path - Path to the sysfs node
+ * \param buf - Buffer for the redirected path
+ * \param len - Buffer length
+ * \return Returns path itself, or buf holding the redirected one
+ */
+const char *sysfs_path(const char *path, char *buf, size_t len)
+{
+	pthread_once(&sysfs_root_once, sysfs_root_init);
+
+	if (sysfs_root[0] == '\0')
+		return path;
+
+	snprintf(buf, len, "%s%s", sysfs_root, path);
+	return buf;
+}
+
+/*
+ * node_open - Open (or reopen) a cached node
+ *
+ * \param cn - Cached node
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int node_open(struct sysfs_cached_node *cn)
+{
+	char buf[80], path[SYSFS_PATH_MAX];
+
+	cn->shadow_valid = false;
+
+	if (cn->fd >= 0) {
+		close(cn->fd);
+		cn->fd = -1;
+	}
+
+	cn->fd = open(sysfs_path(cn->path, path, sizeof(path)),
+		      (cn->readable ? O_RDWR : O_WRONLY) | O_CLOEXEC);
+	if (cn->fd < 0) {
+		strerror_r(errno, buf, sizeof(buf));
+		ALOGE("Error opening %s: %s\n", cn->path, buf);
+		return -errno;
+	}
+
+	return 0;
+}
+
+/*
+ * node_is_stale - Check if a write error means that the node is gone
+ *
+ * \param err - errno returned by pwrite()
+ * \return Returns true if reopening the node may fix the error
+ */
+static bool node_is_stale(int err)
+{
+	switch (err) {
+		case EBADF:
+		case ENODEV:
+		case ENOENT:
+		case ENXIO:
+		case ESTALE:
+			return true;
+		default:
+			break;
+	}
+
+	return false;
+}
+
+/*
+ * node_write - Write string to a cached node and update its shadow
+ *
+ * Note: Has to be called with cache_lock held.
+ *
+ * \param cn - Cached node
+ * \param s  - String to write
+ * \return Returns success (true) or failure (false)
+ */
+static bool node_write(struct sysfs_cached_node *cn, char *s)
+{
+	char buf[80];
+	size_t len = strlen(s);
+	ssize_t ret;
+	bool retried = false;
+
+	if (cn->fd < 0 && node_open(cn) < 0) {
+		sysfs_journal_write(cn->path, s, false);
+		return false;
+	}
+
+retry:
+	ret = pwrite(cn->fd, s, len, 0);
+	if (ret < 0 && !retried && node_is_stale(errno)) {
+		ALOGD("Node %s is stale, reopening", cn->path);
+		retried = true;
+		if (node_open(cn) == 0)
+			goto retry;
+	}
+
+	if (ret < 0) {
+		strerror_r(errno, buf, sizeof(buf));
+		ALOGE("Error writing to %s: %s\n", cn->path, buf);
+		cn->shadow_valid = false;
+		sysfs_journal_write(cn->path, s, false);
+		return false;
+	}
+
+	sysfs_journal_write(cn->path, s, true);
+
+	if (len < sizeof(cn->shadow)) {
+		memcpy(cn->shadow, s, len + 1);
+		cn->shadow_valid = true;
+	} else {
+		cn->shadow_valid = false;
+	}
+
+	return true;
+}
+
+/*
+ * sysfs_cache_write - Write string to a cached sysfs node
+ *
+ * \param node - Node to write (enum sysfs_node_t or sysfs_cache_add())
+ * \param s    - String to write
+ * \return Returns success (true) or failure (false)
+ */
+bool sysfs_cache_write(int node, char *s)
+{
+	bool ret;
+
+	if (node < 0 || node >= num_nodes)
+		return false;
+
+	pthread_mutex_lock(&cache_lock);
+	ret = node_write(&nodes[node], s);
+	pthread_mutex_unlock(&cache_lock);
+
+	return ret;
+}
+
+/*
+ * sysfs_cache_update - Write string to a cached sysfs node, only if
+ *                      it differs from the last written value
+ *
+ * \param node - Node to write (enum sysfs_node_t or sysfs_cache_add())
+ * \param s    - String to write
+ * \return Returns 1 if written, 0 if skipped or negative errno
+ */
+int sysfs_cache_update(int node, char *s)
+{
+	struct sysfs_cached_node *cn;
+	int ret;
+
+	if (node < 0 || node >= num_nodes)
+		return -EINVAL;
+
+	cn = &nodes[node];
+
+	pthread_mutex_lock(&cache_lock);
+	if (cn->shadow_valid && strcmp(cn->shadow, s) == 0) {
+		sysfs_journal_skip(cn->path);
+		ret = 0;
+	} else
+		ret = node_write(cn, s) ? 1 : -EIO;
+	pthread_mutex_unlock(&cache_lock);
+
+	return ret;
+}
+
+/*
+ * sysfs_cache_invalidate - Forget the last written value of all nodes
+ *
+ * To be used when something outside of the cache may have
+ * changed the nodes contents: the next update will hit sysfs.
+ */
+void sysfs_cache_invalidate(void)
+{
+	int i;
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; i < num_nodes; i++)
+		nodes[i].shadow_valid = false;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/*
+ * sysfs_cache_read - Read the current contents of a cached sysfs node
+ *
+ * \param node - Node to read (only readable dynamic nodes)
+ * \param s    - Buffer receiving the string, without trailing newline
+ * \param len  - Buffer length
+ * \return Returns number of read bytes or negative errno
+ */
+int sysfs_cache_read(int node, char *s, size_t len)
+{
+	struct sysfs_cached_node *cn;
+	ssize_t ret;
+
+	if (node < 0 || node >= num_nodes || len == 0)
+		return -EINVAL;
+
+	cn = &nodes[node];
+	if (!cn->readable)
+		return -EPERM;
+
+	pthread_mutex_lock(&cache_lock);
+
+	if (cn->fd < 0 && node_open(cn) < 0) {
+		ret = -ENODEV;
+		goto end;
+	}
+
+	ret = pread(cn->fd, s, len - 1, 0);
+	if (ret < 0 && node_is_stale(errno) && node_open(cn) == 0)
+		ret = pread(cn->fd, s, len - 1, 0);
+	if (ret < 0) {
+		ret = -errno;
+		goto end;
+	}
+
+	if (ret > 0 && s[ret - 1] == '\n')
+		ret--;
+	s[ret] = '\0';
+
+end:
+	pthread_mutex_unlock(&cache_lock);
+	return ret;
+}
+
+/*
+ * sysfs_cache_add - Add a node to the cache
+ *
+ * The node gets opened on first access: it doesn't need to exist
+ * yet, which is the case of cpufreq nodes of offline CPUs.
+ *
+ * \param path - Path to the sysfs node
+ * \param readable - Whether the node will also be read
+ * \return Returns node identifier or failure (negative errno)
+ */
+int sysfs_cache_add(const char *path, bool readable)
+{
+	struct sysfs_cached_node *cn;
+	int i, ret;
+
+	pthread_mutex_lock(&cache_lock);
+
+	for (i = 0; i < num_nodes; i++) {
+		if (strcmp(nodes[i].path, path) == 0) {
+			nodes[i].readable |= readable;
+			ret = i;
+			goto end;
+		}
+	}
+
+	if (num_nodes >= SYSFS_NODE_MAX + SYSFS_DYN_NODES) {
+		ret = -ENOSPC;
+		goto end;
+	}
+
+	cn = &nodes[num_nodes];
+	cn->path = strdup(path);
+	if (cn->path == NULL) {
+		ret = -ENOMEM;
+		goto end;
+	}
+	cn->fd = -1;
+	cn->readable = readable;
+	cn->shadow_valid = false;
+
+	ret = num_nodes++;
+end:
+	pthread_mutex_unlock(&cache_lock);
+	return ret;
+}
+
+/*
+ * sysfs_cache_init - Open all the cached sysfs nodes
+ *
+ * Nodes that cannot be opened now get opened again on first write.
+ *
+ * \return Returns number of nodes that could not be opened
+ */
+int sysfs_cache_init(void)
+{
+	int i, failed = 0;
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; i < SYSFS_NODE_MAX; i++) {
+		if (node_open(&nodes[i]) < 0)
+			failed++;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return failed;
+}
+
+/*
+ * sysfs_cache_release - Close all the cached sysfs nodes
+ */
+void sysfs_cache_release(void)
+{
+	int i;
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; i < num_nodes; i++) {
+		if (nodes[i].fd >= 0)
+			close(nodes[i].fd);
+		nodes[i].fd = -1;
+		nodes[i].shadow_valid = false;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
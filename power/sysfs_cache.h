@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SYSFS_CACHE_H__
+#define __SYSFS_CACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SYSFS_DYN_NODES		64	/* Max nodes added at runtime */
+#define SYSFS_PATH_MAX		128
+
+/*
+ * enum sysfs_node_t
+ * Nodes that are kept open for the whole PowerHAL lifetime
+ *
+ * The order of this enumeration has to match the one of the
+ * path table in sysfs_cache.c.
+ */
+typedef enum {
+	SYSFS_NODE_UPCORE_THRESH,
+	SYSFS_NODE_DNCORE_THRESH,
+	SYSFS_NODE_BALANCE_LVL,
+	SYSFS_NODE_MAX_CPUS,
+	SYSFS_NODE_MIN_CPUS,
+	/* Do not use this entry */
+	SYSFS_NODE_MAX,
+} sysfs_node_t;
+
+/* Exported functions */
+int sysfs_cache_init(void);
+void sysfs_cache_release(void);
+bool sysfs_cache_write(int node, char *s);
+int sysfs_cache_update(int node, char *s);
+void sysfs_cache_invalidate(void);
+int sysfs_cache_read(int node, char *s, size_t len);
+int sysfs_cache_add(const char *path, bool readable);
+const char *sysfs_path(const char *path, char *buf, size_t len);
+
+#endif
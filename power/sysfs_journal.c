@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-PowerHAL-Journal"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <utils/Log.h>
+
+#include "power.h"
+#include "metrics.h"
+#include "profiles.h"
+#include "sysfs_journal.h"
+
+/*
+ * Journal of what the PowerHAL did to sysfs, to compare policies
+ * with real numbers before and after a configuration change:
+ *
+ * - The last SYSFS_JOURNAL_SIZE events, timestamped: every write
+ *   that reached a node and every profile switch, so that the
+ *   writes can be told apart by the mode they belong to
+ * - Writes, skipped (unchanged) writes and failures of each node
+ *
+ * Writes skipped by the sysfs cache are only counted, as they are
+ * what most of the updates end up being.
+ */
+
+struct journal_entry {
+	uint64_t ns;
+	const char *path;	/* NULL for profile switches */
+	int mode;
+	bool ok;
+	char value[SYSFS_JOURNAL_VALUE_MAX];
+};
+
+struct journal_node {
+	const char *path;
+	uint32_t writes;
+	uint32_t skipped;
+	uint32_t errors;
+};
+
+static struct journal_entry entries[SYSFS_JOURNAL_SIZE];
+static unsigned int head;	/* Next entry to write */
+static unsigned int used;
+
+static struct journal_node jnodes[SYSFS_JOURNAL_NODES];
+static int num_jnodes;
+static int cur_mode = -1;
+
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * journal_node - Get the counters of a node, adding it if new
+ *
+ * Paths are the ones of the sysfs cache and the constant ones of
+ * the HAL, which are never freed: they are kept by reference.
+ *
+ * Note: Has to be called with journal_mutex held.
+ *
+ * \param path - Path to the sysfs node
+ * \return Returns the node counters, NULL if the table is full
+ */
+static struct journal_node *journal_node(const char *path)
+{
+	int i;
+
+	for (i = 0; i < num_jnodes; i++) {
+		if (jnodes[i].path == path || strcmp(jnodes[i].path, path) == 0)
+			return &jnodes[i];
+	}
+
+	if (num_jnodes >= SYSFS_JOURNAL_NODES)
+		return NULL;
+
+	jnodes[num_jnodes].path = path;
+	return &jnodes[num_jnodes++];
+}
+
+/*
+ * journal_add - Take the next entry of the journal
+ *
+ * Note: Has to be called with journal_mutex held.
+ *
+ * \return Returns the entry, timestamped
+ */
+static struct journal_entry *journal_add(void)
+{
+	struct journal_entry *e = &entries[head];
+
+	head = (head + 1) % SYSFS_JOURNAL_SIZE;
+	if (used < SYSFS_JOURNAL_SIZE)
+		used++;
+
+	memset(e, 0, sizeof(*e));
+	e->ns = metrics_now_ns();
+	e->mode = -1;
+
+	return e;
+}
+
+/*
+ * sysfs_journal_write - Record a write to a sysfs node
+ *
+ * \param path - Path to the sysfs node
+ * \param s - Written string
+ * \param ok - Whether the write succeeded
+ */
+void sysfs_journal_write(const char *path, const char *s, bool ok)
+{
+	struct journal_entry *e;
+	struct journal_node *jn;
+
+	pthread_mutex_lock(&journal_mutex);
+
+	jn = journal_node(path);
+	if (jn) {
+		jn->writes++;
+		if (!ok)
+			jn->errors++;
+	}
+
+	e = journal_add();
+	e->path = path;
+	e->ok = ok;
+	snprintf(e->value, sizeof(e->value), "%s", s);
+
+	pthread_mutex_unlock(&journal_mutex);
+}
+
+/*
+ * sysfs_journal_skip - Record a write skipped as the node already
+ *                      holds the value
+ *
+ * \param path - Path to the sysfs node
+ */
+void sysfs_journal_skip(const char *path)
+{
+	struct journal_node *jn;
+
+	pthread_mutex_lock(&journal_mutex);
+
+	jn = journal_node(path);
+	if (jn)
+		jn->skipped++;
+
+	pthread_mutex_unlock(&journal_mutex);
+}
+
+/*
+ * sysfs_journal_mode - Record the profile being applied
+ *
+ * Only switches get recorded, not re-applications of the same one.
+ *
+ * \param mode - Profile index
+ */
+void sysfs_journal_mode(int mode)
+{
+	struct journal_entry *e;
+
+	pthread_mutex_lock(&journal_mutex);
+
+	if (mode != cur_mode) {
+		cur_mode = mode;
+		e = journal_add();
+		e->mode = mode;
+	}
+
+	pthread_mutex_unlock(&journal_mutex);
+}
+
+/*
+ * sysfs_journal_dump - Dump the journal as text
+ *
+ * Node counters first, as "node <path> writes=<n> skipped=<n>
+ * errors=<n>", then the events from the oldest one, as
+ * "<ns> write <path> <value> [failed]" or "<ns> mode <profile>".
+ *
+ * \param buf - Destination buffer
+ * \param len - Size of the buffer
+ * \return Returns the length of the dump, truncated to fit
+ */
+int sysfs_journal_dump(char *buf, size_t len)
+{
+	struct journal_entry *e;
+	size_t off = 0;
+	unsigned int i;
+
+#define DUMP(...)							\
+	do {								\
+		if (off < len)						\
+			off += snprintf(buf + off, len - off, __VA_ARGS__); \
+	} while (0)
+
+	if (!len)
+		return 0;
+
+	pthread_mutex_lock(&journal_mutex);
+
+	for (i = 0; i < (unsigned int)num_jnodes; i++)
+		DUMP("node %s writes=%u skipped=%u errors=%u\n",
+		     jnodes[i].path, jnodes[i].writes,
+		     jnodes[i].skipped, jnodes[i].errors);
+
+	for (i = 0; i < used; i++) {
+		e = &entries[(head + SYSFS_JOURNAL_SIZE - used + i) %
+			     SYSFS_JOURNAL_SIZE];
+		if (e->path)
+			DUMP("%llu write %s %s%s\n", (unsigned long long)e->ns,
+			     e->path, e->value, e->ok ? "" : " failed");
+		else
+			DUMP("%llu mode %s\n", (unsigned long long)e->ns,
+			     profile_name(e->mode));
+	}
+
+	pthread_mutex_unlock(&journal_mutex);
+
+#undef DUMP
+
+	return off < len ? (int)off : (int)len - 1;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __SYSFS_JOURNAL_H__
+#define __SYSFS_JOURNAL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SYSFS_JOURNAL_SIZE	128	/* Entries kept, oldest dropped */
+#define SYSFS_JOURNAL_VALUE_MAX	24	/* Longer values get truncated */
+#define SYSFS_JOURNAL_NODES	96	/* Nodes with their own counters */
+#define SYSFS_JOURNAL_DUMP_MAX	8192
+
+/* Exported functions */
+void sysfs_journal_write(const char *path, const char *s, bool ok);
+void sysfs_journal_skip(const char *path);
+void sysfs_journal_mode(int mode);
+int sysfs_journal_dump(char *buf, size_t len);
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "RQBalance-PowerHAL-Thermal"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include <utils/Log.h>
+
+#include "power.h"
+#include "cpu_topology.h"
+#include "profiles.h"
+#include "sysfs_cache.h"
+#include "thermal.h"
+#include "timerwheel.h"
+
+/*
+ * Thermal budget.
+ *
+ * The temperature of the configured thermal zone gets sampled on
+ * the timer wheel and, as soon as the kernel reports a thermal
+ * event, out of the kernel uevents. Every time that it crosses a
+ * thermal level, the online cores limit of the RQBalance driver
+ * and the cluster frequency ceilings get lowered to the highest
+ * level the temperature reached, skipping the ones in between if
+ * it rose fast, way before the kernel emergency throttling kicks in.
+ *
+ * The level is also handed to the arbiter, which clamps whatever
+ * the profiles and the performance locks ask for: the mitigation
+ * never gets undone by a boost.
+ * Going back down needs the temperature to drop below the level
+ * by the hysteresis, not to bounce between two levels.
+ */
+
+#define UEVENT_MSG_LEN		1024
+
+static struct tw_timer poll_timer;
+static char zone_name[THERMAL_ZONE_MAX];
+static int temp_fd = -1;
+static int uevent_fd = -1;
+static int cur_level = -1;
+
+/*
+ * zone_open - Open the temperature node of a thermal zone
+ *
+ * \param zone - Thermal zone type, or thermal_zoneN directory name
+ * \return Returns file descriptor or failure (negative errno)
+ */
+static int zone_open(const char *zone)
+{
+	char path[80], rpath[SYSFS_PATH_MAX], type[THERMAL_ZONE_MAX];
+	ssize_t len;
+	int i;
+
+	if (strncmp(zone, "thermal_zone", 12) == 0) {
+		snprintf(path, sizeof(path), SYS_THERMAL_PATH "%s/temp", zone);
+		return open(sysfs_path(path, rpath, sizeof(rpath)),
+			    O_RDONLY | O_CLOEXEC);
+	}
+
+	for (i = 0; i < THERMAL_MAX_ZONES; i++) {
+		snprintf(path, sizeof(path),
+			 SYS_THERMAL_PATH "thermal_zone%d/type", i);
+		len = sysfs_read(path, type, sizeof(type));
+		if (len <= 0)
+			continue;
+
+		if (type[len - 1] == '\n')
+			type[len - 1] = '\0';
+		if (strcmp(type, zone) != 0)
+			continue;
+
+		snprintf(path, sizeof(path),
+			 SYS_THERMAL_PATH "thermal_zone%d/temp", i);
+		return open(sysfs_path(path, rpath, sizeof(rpath)),
+			    O_RDONLY | O_CLOEXEC);
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * read_temp - Read the thermal zone temperature
+ *
+ * \param temp - Receives the temperature in millidegrees
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int read_temp(int *temp)
+{
+	char buf[16];
+	ssize_t len;
+
+	len = pread(temp_fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return len < 0 ? -errno : -EIO;
+	buf[len] = '\0';
+
+	*temp = atoi(buf);
+
+	/* Some drivers report whole degrees */
+	if (*temp > -1000 && *temp < 1000)
+		*temp *= 1000;
+
+	return 0;
+}
+
+/*
+ * update_zone - Follow the configured thermal zone
+ *
+ * \param th - Thermal configuration
+ * \return Returns success (0) or failure (negative errno)
+ */
+static int update_zone(const struct rqb_thermal *th)
+{
+	if (temp_fd >= 0 && strcmp(zone_name, th->zone) == 0)
+		return 0;
+
+	if (temp_fd >= 0)
+		close(temp_fd);
+
+	snprintf(zone_name, sizeof(zone_name), "%s", th->zone);
+	temp_fd = zone_open(zone_name);
+	if (temp_fd < 0) {
+		ALOGE("Cannot open thermal zone %s", zone_name);
+		return temp_fd;
+	}
+
+	return 0;
+}
+
+/*
+ * thermal_update - Sample the temperature and update the thermal level
+ *
+ * Note: For the PowerServer thread, or before it gets started.
+ *
+ * \param force - Apply the level even if it didn't change, i.e.
+ *                because the levels themselves got reloaded
+ */
+void thermal_update(bool force)
+{
+	struct rqb_config *conf = profiles_get();
+	const struct rqb_thermal *th;
+	int level, n, temp = 0;
+
+	if (conf == NULL)
+		return;
+
+	th = &conf->thermal;
+	n = th->num_levels;
+	level = cur_level < n ? cur_level : n - 1;
+
+	if (!n) {
+		level = -1;
+		goto apply;
+	}
+
+	/*
+	 * A failed sample says nothing about the temperature: keep
+	 * the current level rather than lifting the mitigation, the
+	 * next poll will tell.
+	 */
+	if (update_zone(th) < 0 || read_temp(&temp) < 0)
+		goto apply;
+
+	while (level + 1 < n && temp >= th->levels[level + 1].temp)
+		level++;
+	while (level >= 0 && temp < th->levels[level].temp - th->hysteresis)
+		level--;
+
+apply:
+	if (level != cur_level || force) {
+		if (level != cur_level)
+			ALOGI("Thermal level %d -> %d", cur_level, level);
+		cur_level = level;
+		set_thermal_level(level >= 0 ? &th->levels[level] : NULL);
+	}
+
+	if (n)
+		timerwheel_add(&poll_timer, th->poll_ms ? th->poll_ms :
+			       THERMAL_DEFAULT_POLL_MS);
+}
+
+static void thermal_poll(struct tw_timer *timer __attribute__((unused)))
+{
+	thermal_update(false);
+}
+
+/*
+ * thermal_get_fd - Get the file descriptor to watch for thermal events
+ *
+ * \return Returns the uevent socket, or -1 if not available
+ */
+int thermal_get_fd(void)
+{
+	return uevent_fd;
+}
+
+/*
+ * thermal_event - Handle the pending kernel uevents
+ *
+ * Only thermal zone events matter: the temperature gets
+ * sampled right away instead of waiting for the next poll.
+ */
+void thermal_event(void)
+{
+	char msg[UEVENT_MSG_LEN + 2];
+	bool thermal = false;
+	ssize_t len;
+	char *p;
+
+	for (;;) {
+		len = recv(uevent_fd, msg, UEVENT_MSG_LEN, MSG_DONTWAIT);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		/* NUL separated KEY=value strings */
+		msg[len] = msg[len + 1] = '\0';
+		for (p = msg; *p; p += strlen(p) + 1) {
+			if (strcmp(p, "SUBSYSTEM=thermal") == 0)
+				thermal = true;
+		}
+	}
+
+	if (thermal)
+		thermal_update(false);
+}
+
+/*
+ * thermal_init - Start the thermal budget management
+ *
+ * \return Returns success (0) or failure (negative errno)
+ */
+int thermal_init(void)
+{
+	struct sockaddr_nl addr;
+
+	timerwheel_setup(&poll_timer, thermal_poll, 0);
+
+	/* Not fatal: the temperature gets polled anyway */
+	uevent_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK |
+			   SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (uevent_fd >= 0) {
+		memset(&addr, 0, sizeof(addr));
+		addr.nl_family = AF_NETLINK;
+		addr.nl_groups = 1;
+		if (bind(uevent_fd, (struct sockaddr *)&addr,
+			 sizeof(addr)) < 0) {
+			ALOGW("Cannot receive thermal uevents: %d", errno);
+			close(uevent_fd);
+			uevent_fd = -1;
+		}
+	}
+
+	thermal_update(true);
+
+	return 0;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __THERMAL_H__
+#define __THERMAL_H__
+
+#include <stdbool.h>
+
+#define SYS_THERMAL_PATH	"/sys/class/thermal/"
+#define THERMAL_MAX_ZONES	64
+
+/* Exported functions */
+int thermal_init(void);
+int thermal_get_fd(void);
+void thermal_event(void);
+void thermal_update(bool force);
+
+#endif
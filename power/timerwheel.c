@@ -0,0 +1,455 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RQBalance-PowerHAL-Timers"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/timerfd.h>
+
+#include <utils/Log.h>
+
+#include "timerwheel.h"
+
+/*
+ * Hierarchical timer wheel, the same way the Linux kernel does it.
+ *
+ * All the PowerHAL timers share a single timerfd, which gets armed
+ * for the earliest pending expiry only and is watched by the
+ * PowerServer event loop: the number of wakeups doesn't depend on
+ * the number of timers and there is no signal delivery involved.
+ *
+ * Time is counted in ticks, one tick being the configured slack:
+ * expiries get rounded up to the next tick, so that all the timers
+ * falling in the same slack window expire together, in one run.
+ *
+ * The first level holds the timers expiring in the next 256 ticks,
+ * one list per tick; every other level holds timers 64 times as far
+ * away with 64 times less resolution and gets cascaded down to the
+ * previous one every time that the previous one wraps around.
+ */
+
+#define TVR_BITS	8
+#define TVN_BITS	6
+#define TVR_SIZE	(1 << TVR_BITS)
+#define TVN_SIZE	(1 << TVN_BITS)
+#define TVR_MASK	(TVR_SIZE - 1)
+#define TVN_MASK	(TVN_SIZE - 1)
+#define TVN_LEVELS	3
+#define TW_MAX_TICKS	((1ULL << (TVR_BITS + TVN_LEVELS * TVN_BITS)) - 1)
+
+#define NSEC_PER_MSEC	1000000ULL
+#define NSEC_PER_SEC	1000000000ULL
+
+static struct tw_timer tv1[TVR_SIZE];
+static struct tw_timer tvn[TVN_LEVELS][TVN_SIZE];
+
+static uint64_t tick_ns;
+static uint64_t origin_ns;
+static uint64_t wheel_ticks;	/* Next tick to be processed */
+static uint64_t armed_tick;	/* Tick the timerfd is armed for */
+static unsigned int pending_timers;
+static int tfd = -1;
+
+static pthread_mutex_t wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * NSEC_PER_SEC) + ts.tv_nsec;
+}
+
+static void list_init(struct tw_timer *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static bool list_empty(struct tw_timer *head)
+{
+	return head->next == head;
+}
+
+static void list_add_tail(struct tw_timer *head, struct tw_timer *t)
+{
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+static void list_unlink(struct tw_timer *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = t->prev = NULL;
+}
+
+/* Move all the timers of src to the (empty) list dst */
+static void list_splice_init(struct tw_timer *src, struct tw_timer *dst)
+{
+	list_init(dst);
+	if (list_empty(src))
+		return;
+
+	dst->next = src->next;
+	dst->prev = src->prev;
+	dst->next->prev = dst;
+	dst->prev->next = dst;
+	list_init(src);
+}
+
+/*
+ * internal_add - Put a timer in the right list for its expiry
+ *
+ * Note: Has to be called with wheel_lock held.
+ *
+ * \param t - Timer
+ */
+static void internal_add(struct tw_timer *t)
+{
+	uint64_t expires = t->expires;
+	uint64_t idx;
+	struct tw_timer *head;
+	int lvl, shift;
+
+	/* Already expired: process on the next tick */
+	if (expires < wheel_ticks)
+		expires = wheel_ticks;
+
+	idx = expires - wheel_ticks;
+	if (idx > TW_MAX_TICKS) {
+		idx = TW_MAX_TICKS;
+		expires = wheel_ticks + idx;
+		t->expires = expires;
+	}
+
+	if (idx < TVR_SIZE) {
+		head = &tv1[expires & TVR_MASK];
+	} else {
+		for (lvl = 0; lvl < TVN_LEVELS - 1; lvl++) {
+			if (idx < (1ULL << (TVR_BITS + (lvl + 1) * TVN_BITS)))
+				break;
+		}
+		shift = TVR_BITS + lvl * TVN_BITS;
+		head = &tvn[lvl][(expires >> shift) & TVN_MASK];
+	}
+
+	list_add_tail(head, t);
+}
+
+/*
+ * cascade - Move the timers of one upper level slot down the wheel
+ *
+ * Note: Has to be called with wheel_lock held.
+ *
+ * \param lvl - Upper level index
+ * \param index - Slot index
+ * \return Returns the slot index
+ */
+static int cascade(int lvl, int index)
+{
+	struct tw_timer head, *t;
+
+	/* Detach the whole list first, timers may go back to this level */
+	list_splice_init(&tvn[lvl][index], &head);
+
+	while (!list_empty(&head)) {
+		t = head.next;
+		list_unlink(t);
+		internal_add(t);
+	}
+
+	return index;
+}
+
+/*
+ * next_expiry - Find the tick of the next event of the wheel
+ *
+ * This is the earliest of the first level expiry and of the
+ * next cascade of every upper level slot that holds timers:
+ * a cascade on an upper level can be due before anything on
+ * the levels below it, so no level can be skipped.
+ *
+ * Note: Has to be called with wheel_lock held.
+ *
+ * \return Returns the tick, or 0 if there is no pending timer
+ */
+static uint64_t next_expiry(void)
+{
+	uint64_t base, tick, next = 0;
+	int i, lvl, shift, index;
+
+	if (!pending_timers)
+		return 0;
+
+	for (i = 0; i < TVR_SIZE; i++) {
+		tick = wheel_ticks + i;
+		if (!list_empty(&tv1[tick & TVR_MASK])) {
+			next = tick;
+			break;
+		}
+	}
+
+	for (lvl = 0; lvl < TVN_LEVELS; lvl++) {
+		shift = TVR_BITS + lvl * TVN_BITS;
+		/* First cascade point not processed yet */
+		base = (wheel_ticks + (1ULL << shift) - 1) >> shift;
+		for (i = 0; i < TVN_SIZE; i++) {
+			index = (base + i) & TVN_MASK;
+			if (list_empty(&tvn[lvl][index]))
+				continue;
+
+			tick = (base + i) << shift;
+			if (!next || tick < next)
+				next = tick;
+			break;
+		}
+	}
+
+	/* Should never happen */
+	if (!next)
+		next = wheel_ticks + TVR_SIZE;
+
+	return next;
+}
+
+/*
+ * rearm - Arm the timerfd for the next event of the wheel
+ *
+ * Note: Has to be called with wheel_lock held.
+ */
+static void rearm(void)
+{
+	struct itimerspec its;
+	uint64_t tick = next_expiry();
+	uint64_t ns;
+
+	if (tick == armed_tick || tfd < 0)
+		return;
+
+	memset(&its, 0, sizeof(its));
+	if (tick) {
+		ns = origin_ns + (tick * tick_ns);
+		its.it_value.tv_sec = ns / NSEC_PER_SEC;
+		its.it_value.tv_nsec = ns % NSEC_PER_SEC;
+	}
+
+	if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		ALOGE("Cannot arm timer wheel: %d", errno);
+		return;
+	}
+
+	armed_tick = tick;
+}
+
+/*
+ * timerwheel_init - Initialize the timer wheel
+ *
+ * \param slack_ms - Tick length: timers expiring in the same
+ *                   slack window expire together
+ * \return Returns success (0) or failure (negative errno)
+ */
+int timerwheel_init(unsigned int slack_ms)
+{
+	int i, lvl;
+
+	pthread_mutex_lock(&wheel_lock);
+
+	if (tfd >= 0)
+		goto end;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tfd < 0) {
+		ALOGE("Cannot create timerfd: %d", errno);
+		pthread_mutex_unlock(&wheel_lock);
+		return -errno;
+	}
+
+	if (!slack_ms)
+		slack_ms = 1;
+
+	/* Start from tick 1: tick 0 means "not armed" */
+	tick_ns = slack_ms * NSEC_PER_MSEC;
+	origin_ns = monotonic_ns() - tick_ns;
+	wheel_ticks = 1;
+	armed_tick = 0;
+	pending_timers = 0;
+
+	for (i = 0; i < TVR_SIZE; i++)
+		list_init(&tv1[i]);
+	for (lvl = 0; lvl < TVN_LEVELS; lvl++)
+		for (i = 0; i < TVN_SIZE; i++)
+			list_init(&tvn[lvl][i]);
+
+end:
+	pthread_mutex_unlock(&wheel_lock);
+	return 0;
+}
+
+/*
+ * timerwheel_get_fd - Get the file descriptor to watch for expiries
+ *
+ * \return Returns the timerfd, or -1 if not initialized
+ */
+int timerwheel_get_fd(void)
+{
+	return tfd;
+}
+
+/*
+ * timerwheel_setup - Initialize a timer
+ *
+ * \param timer - Timer
+ * \param func - Function to call on expiry
+ * \param data - Private data for func
+ */
+void timerwheel_setup(struct tw_timer *timer, tw_timer_fn func,
+		      unsigned long data)
+{
+	memset(timer, 0, sizeof(*timer));
+	timer->func = func;
+	timer->data = data;
+}
+
+/*
+ * timerwheel_add - Arm (or re-arm) a timer
+ *
+ * \param timer - Timer
+ * \param duration_ms - Time to expiry in milliseconds
+ */
+void timerwheel_add(struct tw_timer *timer, unsigned int duration_ms)
+{
+	uint64_t ns;
+
+	pthread_mutex_lock(&wheel_lock);
+
+	if (timer->pending) {
+		list_unlink(timer);
+		pending_timers--;
+	}
+
+	ns = monotonic_ns() - origin_ns;
+
+	/* Idle wheel: skip the ticks elapsed since the last run */
+	if (!pending_timers && ns / tick_ns > wheel_ticks)
+		wheel_ticks = ns / tick_ns;
+
+	/* Round up: never expire early */
+	ns += duration_ms * NSEC_PER_MSEC;
+	timer->expires = (ns + tick_ns - 1) / tick_ns;
+	timer->pending = true;
+	pending_timers++;
+
+	internal_add(timer);
+	rearm();
+
+	pthread_mutex_unlock(&wheel_lock);
+}
+
+/*
+ * timerwheel_del - Disarm a timer
+ *
+ * \param timer - Timer
+ */
+void timerwheel_del(struct tw_timer *timer)
+{
+	pthread_mutex_lock(&wheel_lock);
+
+	if (timer->pending) {
+		list_unlink(timer);
+		timer->pending = false;
+		pending_timers--;
+		rearm();
+	}
+
+	pthread_mutex_unlock(&wheel_lock);
+}
+
+/*
+ * timerwheel_run - Run all the expired timers
+ *
+ * To be called when the timerfd becomes readable.
+ * Callbacks run without the wheel lock held, so that they can
+ * re-arm or delete timers, including the ones that expired in
+ * the same run and did not get called yet: those stay pending
+ * until they are taken off the list of the current tick, one
+ * at a time under the lock.
+ *
+ * \return Returns number of expired timers
+ */
+int timerwheel_run(void)
+{
+	struct tw_timer expired, *t;
+	uint64_t now, count;
+	int index, lvl, shift, nexpired = 0;
+
+	/* Acknowledge the timerfd */
+	if (tfd >= 0 && read(tfd, &count, sizeof(count)) < 0 &&
+	    errno != EAGAIN)
+		ALOGE("Cannot read timer wheel: %d", errno);
+
+	pthread_mutex_lock(&wheel_lock);
+
+	now = (monotonic_ns() - origin_ns) / tick_ns;
+
+	while (wheel_ticks <= now) {
+		index = wheel_ticks & TVR_MASK;
+
+		/* First level wrapped: cascade the upper levels */
+		for (lvl = 0; !index && lvl < TVN_LEVELS; lvl++) {
+			shift = TVR_BITS + lvl * TVN_BITS;
+			if (cascade(lvl, (wheel_ticks >> shift) & TVN_MASK))
+				break;
+		}
+
+		/*
+		 * Timers re-armed by the callbacks below land on the
+		 * next tick at the earliest, never on this list.
+		 */
+		list_splice_init(&tv1[index], &expired);
+		wheel_ticks++;
+
+		while (!list_empty(&expired)) {
+			t = expired.next;
+			list_unlink(t);
+			t->pending = false;
+			pending_timers--;
+			nexpired++;
+
+			if (!t->func)
+				continue;
+
+			pthread_mutex_unlock(&wheel_lock);
+			t->func(t);
+			pthread_mutex_lock(&wheel_lock);
+		}
+	}
+
+	armed_tick = 0;
+	rearm();
+
+	pthread_mutex_unlock(&wheel_lock);
+
+	return nexpired;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 AngeloGioacchino Del Regno <kholk11@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMERWHEEL_DEFAULT_SLACK_MS	20
+
+struct tw_timer;
+typedef void (*tw_timer_fn)(struct tw_timer *timer);
+
+/*
+ * struct tw_timer
+ * One timer of the timer wheel
+ *
+ * Can be embedded in any structure: initialize it once with
+ * timerwheel_setup(), then arm and disarm it as many times as
+ * needed. The structure must not move while the timer is pending.
+ */
+struct tw_timer {
+	struct tw_timer *next;
+	struct tw_timer *prev;
+	uint64_t expires;	/* Expiry, in wheel ticks */
+	tw_timer_fn func;	/* Called on expiry */
+	unsigned long data;	/* Private data for func */
+	bool pending;
+};
+
+/* Exported functions */
+int timerwheel_init(unsigned int slack_ms);
+int timerwheel_get_fd(void);
+void timerwheel_setup(struct tw_timer *timer, tw_timer_fn func,
+		      unsigned long data);
+void timerwheel_add(struct tw_timer *timer, unsigned int duration_ms);
+void timerwheel_del(struct tw_timer *timer);
+int timerwheel_run(void);
+
+#endif